@@ -0,0 +1,63 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include "src/Audit.h"
+
+/*
+ * usage: audit [--database path] [--threads n] [--open] [--shard index shard addresses]
+ * Reports the accounts whose balances disagree with their opening balances and the transactions since.
+ * With --open it records the current balances as right instead, to audit against from then on.
+ * With a shard it audits only the banks of that shard, the shard addresses are the same as for the servers.
+ * Exits with 2 if an account disagrees, so that it can run from a scheduler.
+ */
+int main(int argc, char *argv[]) {
+    std::string database = "banking.sqlite";
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool open = false;
+    long shard = -1;
+    Tools::ShardMap shard_map;
+
+    // parse the options
+    for (int i = 1; i < argc; i++) {
+        const std::string option = argv[i];
+        if (option == "--database" && i + 1 < argc) {
+            database = argv[++i];
+        } else if (option == "--threads" && i + 1 < argc) {
+            threads = std::stoul(argv[++i]);
+        } else if (option == "--open") {
+            open = true;
+        } else if (option == "--shard" && i + 2 < argc) {
+            shard = std::strtol(argv[++i], nullptr, 10);
+            shard_map = Tools::ShardMap::parse(argv[++i]);
+        } else {
+            std::cout << "[audit] usage: " << argv[0] << " [--database path] [--threads n] [--open] "
+                      << "[--shard index shard addresses]" << std::endl;
+            return 1;
+        }
+    }
+    if (shard >= 0 && (std::size_t) shard >= shard_map.size()) {
+        std::cout << "[audit] there is no shard " << shard << std::endl;
+        return 1;
+    }
+
+    // open the database
+    Control::Audit audit;
+    if (!audit.open(database)) {
+        return 1;
+    }
+    if (shard >= 0) {
+        audit.shard(shard, shard_map);
+    }
+
+    // record the opening balances, or compare the balances with them
+    if (open) {
+        return audit.open_balances(threads) ? 0 : 1;
+    }
+    uint64_t discrepancies = 0;
+    if (!audit.audit(threads, discrepancies)) {
+        return 1;
+    }
+    return discrepancies > 0 ? 2 : 0;
+}
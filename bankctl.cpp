@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "src/Control.h"
+
+/*
+ * usage: bankctl import|export table file [--format csv|ndjson] [--database path]
+ * The table is users, accounts or transactions. The file is - for the standard input or output.
+ * The format follows the extension of the file unless given, the database is banking.sqlite unless given.
+ * Messages go to the standard error, so that an export can be written to the standard output.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::clog << "[bankctl] usage: " << argv[0]
+                  << " import|export table file [--format csv|ndjson] [--database path]" << std::endl;
+        return 1;
+    }
+    const std::string command = argv[1];
+    const std::string table = argv[2];
+    const std::string file = argv[3];
+
+    // parse the options
+    std::string database = "banking.sqlite";
+    Control::FORMAT format = Control::Control::format(file);
+    for (int i = 4; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--format" && (value == "csv" || value == "ndjson")) {
+            format = value == "csv" ? Control::FORMAT::CSV : Control::FORMAT::NDJSON;
+        } else if (option == "--database") {
+            database = value;
+        } else {
+            std::clog << "[bankctl] unknown option " << option << " " << value << std::endl;
+            return 1;
+        }
+    }
+
+    // open the database
+    Control::Control control;
+    if (!control.open(database)) {
+        return 1;
+    }
+
+    // import the file into the table
+    if (command == "import") {
+        std::ifstream file_input;
+        std::vector<char> buffer(1 << 20);
+        if (file != "-") {
+            file_input.rdbuf()->pubsetbuf(buffer.data(), (std::streamsize) buffer.size());
+            file_input.open(file, std::ios::binary);
+            if (!file_input) {
+                std::clog << "[bankctl] can not open " << file << std::endl;
+                return 1;
+            }
+        }
+        return control.import_table(table, file == "-" ? std::cin : file_input, format) ? 0 : 1;
+    }
+
+    // export the table into the file
+    if (command == "export") {
+        std::ofstream file_output;
+        if (file != "-") {
+            file_output.open(file, std::ios::binary | std::ios::trunc);
+            if (!file_output) {
+                std::clog << "[bankctl] can not open " << file << std::endl;
+                return 1;
+            }
+        }
+        return control.export_table(table, file == "-" ? std::cout : file_output, format) ? 0 : 1;
+    }
+
+    std::clog << "[bankctl] unknown command " << command << std::endl;
+    return 1;
+}
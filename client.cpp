@@ -1,13 +1,17 @@
 #include "src/Messages.h"
 #include "src/Client.h"
 
-int main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) {
+/*
+ * usage: client [address]
+ * The address is the address of the server, like tcp://127.0.0.1:2609 or ipc:///tmp/banking.ipc on the same host.
+ */
+int main(int argc, char *argv[]) {
 
     // create client
     Client::Client client;
 
     // initialize client (connect to server)
-    client.initialize("tcp://127.0.0.1:2609");
+    client.initialize(argc > 1 ? argv[1] : "tcp://127.0.0.1:2609");
 
     // send ping
     client.send_ping();
@@ -35,6 +39,12 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) {
     ACCOUNT_LIST_RESPONSE account_list_response;
     client.receive_account_list_response(account_list_response);
 
+    // send bank summary request
+    client.send_bank_summary_request(login_response.id, login_response.token);
+
+    // receive bank summary response
+    client.receive_bank_summary_response();
+
     // send add balance request (like an ATM deposit)
     client.send_add_balance_request(login_response.id, login_response.token, login_response.bank,
                                     account_list_response.accounts[0].iban, 1000);
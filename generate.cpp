@@ -0,0 +1,42 @@
+#include <iostream>
+#include <string>
+#include "src/Generator.h"
+
+/*
+ * usage: generate path [--banks n] [--users n] [--accounts n] [--transactions n] [--skew s] [--seed n]
+ * Creates a new database at path filled with synthetic data, the same for the same seed and options.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc % 2 != 0) {
+        std::cout << "[generate] usage: " << argv[0] << " path [--banks n] [--users n] [--accounts n] "
+                  << "[--transactions n] [--skew s] [--seed n]" << std::endl;
+        return 1;
+    }
+
+    // parse the options
+    Control::GeneratorParameters parameters;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const char *value = argv[i + 1];
+        if (option == "--banks") {
+            parameters.banks = (uint32_t) std::stoul(value);
+        } else if (option == "--users") {
+            parameters.users = std::stoull(value);
+        } else if (option == "--accounts") {
+            parameters.accounts = std::stoull(value);
+        } else if (option == "--transactions") {
+            parameters.transactions = std::stoull(value);
+        } else if (option == "--skew") {
+            parameters.skew = std::stod(value);
+        } else if (option == "--seed") {
+            parameters.seed = std::stoull(value);
+        } else {
+            std::cout << "[generate] unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    // generate the database
+    Control::Generator generator;
+    return generator.generate(argv[1], parameters) ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#include <iostream>
+#include <csignal>
+#include "src/Proxy.h"
+
+// global variable to stop the proxy
+volatile sig_atomic_t stop;
+
+// signal signal_handler
+void signal_handler(int signal_number) {
+    stop = 1;
+    std::cout << "[proxy] signal " << signal_number << " received" << std::endl;
+}
+
+/*
+ * usage: proxy address shard addresses
+ * The shard addresses are the comma separated addresses of all shards in order, as given to every shard.
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "[proxy] usage: " << argv[0] << " address shard addresses" << std::endl;
+        return 1;
+    }
+
+    // register signal SIGINT and signal handler
+    signal(SIGINT, signal_handler);
+
+    // create proxy
+    Proxy::Proxy proxy;
+
+    // initialize proxy (bind to address and connect to the shards)
+    if (!proxy.initialize(argv[1], Tools::ShardMap::parse(argv[2]))) {
+        return 1;
+    }
+
+    // infinite loop
+    while (!stop) {
+
+        // forward requests to the shards and responses back to the clients
+        proxy.forward();
+    }
+}
@@ -1,36 +1,192 @@
 #include <iostream>
-#include <thread>
-#include <chrono>
 #include <csignal>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
 #include "src/Server.h"
+#include "src/Trace.h"
 
 // global variable to stop the server
 volatile sig_atomic_t stop;
 
+// global variable to write the trace
+volatile sig_atomic_t dump;
+
+// global variable to reload the fee rules
+volatile sig_atomic_t reload;
+
 // signal signal_handler
 void signal_handler(int signal_number) {
     stop = 1;
     std::cout << "[server] signal " << signal_number << " received" << std::endl;
 }
 
-int main([[maybe_unused]] int argc, [[maybe_unused]] char *argv[]) {
+// signal handler writing the trace
+void dump_handler([[maybe_unused]] int signal_number) {
+    dump = 1;
+}
+
+// signal handler reloading the fee rules
+void reload_handler([[maybe_unused]] int signal_number) {
+    reload = 1;
+}
+
+/*
+ * usage: server [address] [--replication address] [--sync address] [--primary address]
+ *               [--shard index shard addresses peer addresses] [--trace path] [--handoff address] [--take-over]
+ *               [--pipeline cores]
+ * The address is tcp://host:port, or ipc://path for clients on the same host, which skips the TCP stack.
+ * With a trace path every request is traced, and the trace written there on SIGUSR1 and when the server stops.
+ * The fee rules are compiled again on SIGHUP. On SIGINT or SIGTERM the server answers the requests it has and stops.
+ * With a handoff address, an ipc://path next to the database, a new server started with --take-over and the same
+ * handoff address takes over from the running one, keeping its sessions so that its clients stay logged in.
+ * The socket file is restricted to the user of the server, and the servers sign the handoff with BANKING_SECRET.
+ * With --pipeline the messages are received, unpacked, packed and sent by threads of their own, so that the server
+ * thread only handles the requests. The cores are the comma separated cores of the I/O, decode, server and encode
+ * stages in order, a stage whose core is left empty is not pinned, like --pipeline ,,, for none of them.
+ * Without a primary address the server is a primary and publishes its changes on the replication address, and answers
+ * the backups asking for the changes they missed on the sync address. Both hand out the sessions of the clients, so
+ * only the backups may reach them. With a primary address, the sync address of the primary, the server is a
+ * read-only backup of that primary, following the changes the primary publishes.
+ * With a shard it owns only the banks of that shard, the shard addresses are the comma separated addresses of all
+ * shards in order, the same for every shard and the proxy. The peer addresses are those of all shards in the same
+ * order, on which the shards take transactions from each other, signed with the secret in BANKING_SECRET.
+ */
+int main(int argc, char *argv[]) {
+    std::string address = "tcp://127.0.0.1:2609";
+    std::string replication = "tcp://127.0.0.1:2610";
+    std::string sync = "tcp://127.0.0.1:2611";
+    std::string primary;
+    long shard = -1;
+    Tools::ShardMap shard_map;
+    std::string trace;
+    std::string handoff;
+    bool take_over = false;
+    bool pipeline = false;
+    std::vector<int> cores;
+
+    // parse the arguments
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if (argument == "--replication" && i + 1 < argc) {
+            replication = argv[++i];
+        } else if (argument == "--sync" && i + 1 < argc) {
+            sync = argv[++i];
+        } else if (argument == "--primary" && i + 1 < argc) {
+            primary = argv[++i];
+        } else if (argument == "--shard" && i + 3 < argc) {
+            shard = std::strtol(argv[++i], nullptr, 10);
+            const std::string addresses = argv[++i];
+            shard_map = Tools::ShardMap::parse(addresses, argv[++i]);
+        } else if (argument == "--trace" && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (argument == "--handoff" && i + 1 < argc) {
+            handoff = argv[++i];
+        } else if (argument == "--take-over") {
+            take_over = true;
+        } else if (argument == "--pipeline" && i + 1 < argc) {
+            pipeline = true;
+            std::stringstream list(argv[++i]);
+            std::string core;
+            while (std::getline(list, core, ',')) {
+                cores.push_back(core.empty() ? -1 : (int) std::strtol(core.c_str(), nullptr, 10));
+            }
+            cores.resize(4, -1);
+        } else if (argument.rfind("--", 0) != 0) {
+            address = argument;
+        } else {
+            std::cout << "[server] usage: " << argv[0] << " [address] [--replication address] [--sync address] "
+                      << "[--primary address] [--shard index shard addresses peer addresses] [--trace path] "
+                      << "[--handoff address] [--take-over] [--pipeline cores]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    if (take_over && handoff.empty()) {
+        std::cout << "[server] --take-over needs the --handoff address of the running server" << std::endl;
+        return 1;
+    }
+
+    // the servers share a secret kept out of the arguments
+    const char *secret = std::getenv("BANKING_SECRET");
 
-    // register signal SIGINT and signal handler
+    // register signal SIGINT and SIGTERM and signal handler
     signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, reload_handler);
+
+    // trace from the start, so that the connections of the database are traced too
+    if (!trace.empty()) {
+        Tools::Trace::enable(true);
+        signal(SIGUSR1, dump_handler);
+    }
 
     // create server
     Server::Server server;
 
+    // take over from the server running on the same database, if asked to
+    if (take_over) {
+        server.take_over(handoff, secret != nullptr ? secret : "");
+    }
+
     // initialize server (bind to address)
-    server.initialize("tcp://127.0.0.1:2609");
+    if (!server.initialize(address)) {
+        return 1;
+    }
+
+    // own only the banks of the shard
+    if (shard >= 0 && !server.shard(shard, shard_map, secret != nullptr ? secret : "")) {
+        return 1;
+    }
+
+    // publish the changes to the backups, or follow the primary
+    if (!primary.empty()) {
+        server.follow(primary, replication);
+    } else {
+        server.publish(replication, sync);
+    }
+
+    // let the next server take over, if asked to
+    if (!handoff.empty() && !server.hand_off(handoff, secret != nullptr ? secret : "")) {
+        server.terminate();
+        return 1;
+    }
+
+    // move the messages of the clients to the threads of the pipeline
+    if (pipeline && !server.pipeline(cores)) {
+        server.terminate();
+        return 1;
+    }
 
     // infinite loop
-    while (!stop) {
+    while (!stop && !server.handed_off()) {
 
-        // handle incoming requests
+        // evict timed out sessions
+        server.maintain();
+
+        // handle incoming requests, waiting up to a second for one
         if (!server.handle_request()){
             std::cout << "[server] no message received" << std::endl;
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
         }
+
+        // compile the fee rules again when asked to
+        if (reload) {
+            reload = 0;
+            server.reload();
+        }
+
+        // write the trace when asked to
+        if (dump) {
+            dump = 0;
+            Tools::Trace::dump(trace);
+        }
+    }
+
+    // answer the last requests and close the database
+    server.terminate();
+
+    // write the trace of the last requests
+    if (!trace.empty()) {
+        Tools::Trace::dump(trace);
     }
 }
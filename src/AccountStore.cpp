@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <numeric>
+#include "AccountStore.h"
+#include "Ledger.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Server {
+
+    namespace {
+
+        int64_t sum_software(const int64_t *values, std::size_t size) {
+            int64_t sum = 0;
+            for (std::size_t i = 0; i < size; i++) {
+                sum += values[i];
+            }
+            return sum;
+        }
+
+        uint32_t count_negative_software(const int64_t *values, std::size_t size) {
+            uint32_t count = 0;
+            for (std::size_t i = 0; i < size; i++) {
+                count += values[i] < 0;
+            }
+            return count;
+        }
+
+        void find_negative_software(const int64_t *values, std::size_t size, std::vector<uint32_t> &positions) {
+            for (std::size_t i = 0; i < size; i++) {
+                if (values[i] < 0) {
+                    positions.push_back((uint32_t) i);
+                }
+            }
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("avx2")))
+        int64_t sum_avx2(const int64_t *values, std::size_t size) {
+
+            // four lanes, two accumulators to hide the latency of the additions
+            __m256i first = _mm256_setzero_si256();
+            __m256i second = _mm256_setzero_si256();
+            std::size_t i = 0;
+            for (; i + 8 <= size; i += 8) {
+                first = _mm256_add_epi64(first, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i)));
+                second = _mm256_add_epi64(second,
+                                          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i + 4)));
+            }
+            alignas(32) int64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(first, second));
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_software(values + i, size - i);
+        }
+
+        __attribute__((target("avx2,popcnt")))
+        uint32_t count_negative_avx2(const int64_t *values, std::size_t size) {
+            const __m256i zero = _mm256_setzero_si256();
+            uint32_t count = 0;
+            std::size_t i = 0;
+            for (; i + 4 <= size; i += 4) {
+                const __m256i negative = _mm256_cmpgt_epi64(zero, _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(values + i)));
+                count += _mm_popcnt_u32(_mm256_movemask_pd(_mm256_castsi256_pd(negative)));
+            }
+            return count + count_negative_software(values + i, size - i);
+        }
+
+        __attribute__((target("avx2")))
+        void find_negative_avx2(const int64_t *values, std::size_t size, std::vector<uint32_t> &positions) {
+            const __m256i zero = _mm256_setzero_si256();
+            std::size_t i = 0;
+            for (; i + 4 <= size; i += 4) {
+                int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(zero, _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(values + i)))));
+
+                // most blocks have no negative balance at all
+                while (mask != 0) {
+                    positions.push_back((uint32_t) (i + __builtin_ctz(mask)));
+                    mask &= mask - 1;
+                }
+            }
+            const std::size_t tail = positions.size();
+            find_negative_software(values + i, size - i, positions);
+            for (std::size_t j = tail; j < positions.size(); j++) {
+                positions[j] += (uint32_t) i;
+            }
+        }
+
+        const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+
+        int64_t sum(const int64_t *values, std::size_t size) {
+#if defined(__x86_64__)
+            if (avx2) {
+                return sum_avx2(values, size);
+            }
+#endif
+            return sum_software(values, size);
+        }
+
+        uint32_t count_negative(const int64_t *values, std::size_t size) {
+#if defined(__x86_64__)
+            if (avx2) {
+                return count_negative_avx2(values, size);
+            }
+#endif
+            return count_negative_software(values, size);
+        }
+
+        void find_negative(const int64_t *values, std::size_t size, std::vector<uint32_t> &positions) {
+#if defined(__x86_64__)
+            if (avx2) {
+                find_negative_avx2(values, size, positions);
+                return;
+            }
+#endif
+            find_negative_software(values, size, positions);
+        }
+
+    } // namespace
+
+    void AccountStore::assign(const std::vector<LedgerAccount> &accounts) {
+
+        // order the accounts by bank, keeping the ledger order within a bank
+        _accounts.resize(accounts.size());
+        std::iota(_accounts.begin(), _accounts.end(), 0);
+        std::stable_sort(_accounts.begin(), _accounts.end(), [&accounts](uint32_t a, uint32_t b) {
+            return accounts[a].bank < accounts[b].bank;
+        });
+
+        // fill the columns
+        _banks.resize(accounts.size());
+        _cents.resize(accounts.size());
+        _positions.resize(accounts.size());
+        _ranges.clear();
+        for (uint32_t position = 0; position < _accounts.size(); position++) {
+            const LedgerAccount &account = accounts[_accounts[position]];
+            _banks[position] = account.bank;
+            _cents[position] = cents(account.balance);
+            _positions[_accounts[position]] = position;
+            if (_ranges.empty() || _ranges.back().bank != account.bank) {
+                _ranges.push_back(BankRange{account.bank, position, position});
+            }
+            _ranges.back().end = position + 1;
+        }
+    }
+
+    void AccountStore::set(uint32_t account, double_t balance) {
+        _cents[_positions[account]] = cents(balance);
+    }
+
+    std::vector<AccountStore::BankTotal> AccountStore::bank_totals() const {
+        std::vector<BankTotal> totals;
+        totals.reserve(_ranges.size());
+        for (const BankRange &range: _ranges) {
+            const int64_t *cents = _cents.data() + range.begin;
+            const std::size_t size = range.end - range.begin;
+            totals.push_back(BankTotal{range.bank, (uint32_t) size, sum(cents, size), count_negative(cents, size)});
+        }
+        return totals;
+    }
+
+    int64_t AccountStore::total(const std::vector<uint32_t> &accounts) const {
+
+        // a user has a handful of accounts, gathering them is not worth vectorizing
+        int64_t total = 0;
+        for (const uint32_t account: accounts) {
+            total += _cents[_positions[account]];
+        }
+        return total;
+    }
+
+    std::vector<uint32_t> AccountStore::overdrawn() const {
+        std::vector<uint32_t> positions;
+        find_negative(_cents.data(), _cents.size(), positions);
+        for (uint32_t &position: positions) {
+            position = _accounts[position];
+        }
+        return positions;
+    }
+
+    std::size_t AccountStore::size() const {
+        return _cents.size();
+    }
+
+    int64_t AccountStore::cents(double_t balance) {
+        return std::llround(balance * 100);
+    }
+
+} // Server
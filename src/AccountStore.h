@@ -0,0 +1,88 @@
+#ifndef BANKING_ACCOUNTSTORE_H
+#define BANKING_ACCOUNTSTORE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+namespace Server {
+
+    struct LedgerAccount;
+
+    /*
+     * This is a columnar copy of the accounts of the ledger for bulk aggregations.
+     * Banks and balances in cents are kept in separate contiguous arrays, ordered by bank,
+     * so that the totals of a bank are a sum over one range and scans touch nothing but the column they need.
+     * Sums and scans use AVX2 when the processor has it.
+     */
+    class AccountStore {
+
+    public:
+
+        /*
+         * This is the summary of the accounts of one bank.
+         */
+        struct BankTotal {
+            uint16_t bank{};
+            uint32_t accounts{};
+            int64_t cents{}; // sum of the balances
+            uint32_t overdrawn{}; // accounts with a negative balance
+        };
+
+        /*
+         * Rebuilds the columns from the accounts of the ledger.
+         */
+        void assign(const std::vector<LedgerAccount> &accounts);
+
+        /*
+         * Sets the balance of the account at the index in the ledger.
+         */
+        void set(uint32_t account, double_t balance);
+
+        /*
+         * Returns the summary of every bank, in bank order.
+         */
+        std::vector<BankTotal> bank_totals() const;
+
+        /*
+         * Returns the sum of the balances of the accounts at the indexes in the ledger, like those of one user.
+         */
+        int64_t total(const std::vector<uint32_t> &accounts) const;
+
+        /*
+         * Returns the indexes in the ledger of the accounts with a negative balance.
+         */
+        std::vector<uint32_t> overdrawn() const;
+
+        /*
+         * Returns the number of accounts.
+         */
+        std::size_t size() const;
+
+        /*
+         * Converts a balance to whole cents.
+         */
+        static int64_t cents(double_t balance);
+
+    private:
+
+        /*
+         * This is the range of the columns holding the accounts of one bank.
+         */
+        struct BankRange {
+            uint16_t bank{};
+            uint32_t begin{};
+            uint32_t end{};
+        };
+
+        std::vector<uint16_t> _banks{}; // bank of every account
+        std::vector<int64_t> _cents{}; // balance of every account in cents
+        std::vector<uint32_t> _accounts{}; // index in the ledger of every account
+        std::vector<uint32_t> _positions{}; // position in the columns, by index in the ledger
+        std::vector<BankRange> _ranges{}; // accounts of every bank
+    };
+
+} // Server
+
+#endif //BANKING_ACCOUNTSTORE_H
@@ -0,0 +1,281 @@
+#include <iostream>
+#include <thread>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+#include "Audit.h"
+
+namespace Control {
+
+    namespace {
+
+        // rows of transactions a worker takes at a time
+        constexpr int64_t chunk_rows = 1 << 18;
+
+        // difference of balances reported, below it is the rounding of summing in another order
+        constexpr double tolerance = 0.005;
+
+    } // namespace
+
+    Audit::~Audit() {
+        close();
+    }
+
+    bool Audit::open(const std::string &path) {
+        close();
+        if (sqlite3_open_v2(path.c_str(), &_db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+            std::cout << "[audit] can not open database " << path << ": " << sqlite3_errmsg(_db) << std::endl;
+            close();
+            return false;
+        }
+        _path = path;
+        sqlite3_busy_timeout(_db, 5000);
+        return _exec("CREATE TABLE IF NOT EXISTS openings (iban TEXT PRIMARY KEY, balance REAL NOT NULL)");
+    }
+
+    void Audit::close() {
+        if (_db != nullptr) {
+            sqlite3_close(_db);
+            _db = nullptr;
+        }
+    }
+
+    void Audit::shard(std::size_t shard, const Tools::ShardMap &shard_map) {
+        _shard = shard;
+        _shard_map = shard_map;
+    }
+
+    bool Audit::audit(std::size_t threads, uint64_t &discrepancies) {
+        discrepancies = 0;
+        std::vector<double> movements;
+        if (!_read(threads, movements) || !_exec("COMMIT")) {
+            return false;
+        }
+
+        // compare in the order of the accounts table
+        if (_opened == 0) {
+            std::cout << "[audit] no opening balances were recorded, record them with --open first" << std::endl;
+        }
+        for (std::size_t i = 0; i < _ibans.size(); i++) {
+            const double expected = _openings[i] + movements[i];
+            if (std::abs(expected - _balances[i]) >= tolerance) {
+                std::cout << "[audit] " << _ibans[i] << " has " << std::fixed << std::setprecision(2) << _balances[i]
+                          << " but expected " << expected << std::defaultfloat << std::endl;
+                discrepancies++;
+            }
+        }
+        std::cout << "[audit] " << discrepancies << " of " << _ibans.size()
+                  << " accounts disagree with the transactions" << std::endl;
+        return true;
+    }
+
+    bool Audit::open_balances(std::size_t threads) {
+        std::vector<double> movements;
+        if (!_read(threads, movements)) {
+            return false;
+        }
+
+        // the opening balance is what the account had before all of its transactions
+        if (!_exec("DELETE FROM openings")) {
+            _exec("ROLLBACK");
+            return false;
+        }
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(_db, "INSERT INTO openings (iban, balance) VALUES (?, ?)", -1, &stmt,
+                               nullptr) != SQLITE_OK) {
+            std::cout << "[audit] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            _exec("ROLLBACK");
+            return false;
+        }
+        bool error = false;
+        for (std::size_t i = 0; i < _ibans.size() && !error; i++) {
+            sqlite3_bind_text(stmt, 1, _ibans[i].data(), (int) _ibans[i].size(), SQLITE_STATIC);
+            sqlite3_bind_double(stmt, 2, _balances[i] - movements[i]);
+            error = sqlite3_step(stmt) != SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        if (error || !_exec("COMMIT")) {
+            std::cout << "[audit] can not record opening balances: " << sqlite3_errmsg(_db) << std::endl;
+            _exec("ROLLBACK");
+            return false;
+        }
+        std::cout << "[audit] recorded the opening balances of " << _ibans.size() << " accounts" << std::endl;
+        return true;
+    }
+
+    bool Audit::_read(std::size_t threads, std::vector<double> &movements) {
+
+        // no transaction is committed while the workers read, they all see the database as the accounts were read
+        if (!_exec("BEGIN IMMEDIATE")) {
+            return false;
+        }
+        if (!_load_accounts() || !_sum_transactions(threads, movements)) {
+            _exec("ROLLBACK");
+            return false;
+        }
+        return true;
+    }
+
+    bool Audit::_load_accounts() {
+        _ibans.clear();
+        _balances.clear();
+        _openings.clear();
+        _indexes.clear();
+        _opened = 0;
+        sqlite3_stmt *stmt;
+        const char *sql = "SELECT accounts.iban, accounts.balance, openings.balance, accounts.bank FROM accounts "
+                          "LEFT JOIN openings ON openings.iban = accounts.iban";
+        if (sqlite3_prepare_v2(_db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[audit] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        int result;
+        while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+
+            // the accounts of the banks of other shards are audited there, they are outside the database here
+            if (_shard_map.size() > 0 && _shard_map.shard((uint16_t) sqlite3_column_int(stmt, 3)) != _shard) {
+                continue;
+            }
+            std::string iban(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
+                             (std::size_t) sqlite3_column_bytes(stmt, 0));
+            if (!_indexes.emplace(iban, (uint32_t) _ibans.size()).second) {
+                std::cout << "[audit] " << iban << " is in the accounts table twice" << std::endl;
+                continue;
+            }
+            _ibans.push_back(std::move(iban));
+            _balances.push_back(sqlite3_column_double(stmt, 1));
+            _openings.push_back(sqlite3_column_double(stmt, 2));
+            _opened += sqlite3_column_type(stmt, 2) != SQLITE_NULL;
+        }
+        sqlite3_finalize(stmt);
+        if (result != SQLITE_DONE) {
+            std::cout << "[audit] can not read accounts: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool Audit::_sum_transactions(std::size_t threads, std::vector<double> &movements) {
+
+        // the workers take chunks of rowids between the first and the last transaction
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(_db, "SELECT min(rowid), max(rowid) FROM transactions", -1, &stmt,
+                               nullptr) != SQLITE_OK) {
+            std::cout << "[audit] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        int64_t first = 1;
+        int64_t last = 0;
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+            first = sqlite3_column_int64(stmt, 0);
+            last = sqlite3_column_int64(stmt, 1);
+        }
+        sqlite3_finalize(stmt);
+        const auto chunks = static_cast<std::size_t>(last >= first ? (last - first) / chunk_rows + 1 : 0);
+        threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(1, chunks));
+
+        // every worker sums into movements of its own, added up once all of them are done
+        std::atomic<int64_t> next{first};
+        std::vector<std::vector<double>> sums(threads, std::vector<double>(_ibans.size()));
+        std::vector<uint64_t> rows(threads);
+        std::vector<uint64_t> skipped(threads);
+        std::vector<char> scanned(threads);
+        std::vector<std::thread> workers;
+        for (std::size_t i = 0; i < threads; i++) {
+            workers.emplace_back([this, i, last, &next, &sums, &rows, &skipped, &scanned]() {
+                scanned[i] = _scan(last, chunk_rows, next, sums[i], rows[i], skipped[i]);
+            });
+        }
+        for (std::thread &worker: workers) {
+            worker.join();
+        }
+        if (std::find(scanned.begin(), scanned.end(), 0) != scanned.end()) {
+            return false;
+        }
+        movements.assign(_ibans.size(), 0);
+        for (const std::vector<double> &sum: sums) {
+            for (std::size_t i = 0; i < sum.size(); i++) {
+                movements[i] += sum[i];
+            }
+        }
+        uint64_t total = 0;
+        uint64_t outside = 0;
+        for (std::size_t i = 0; i < threads; i++) {
+            total += rows[i];
+            outside += skipped[i];
+        }
+        std::cout << "[audit] summed " << total << " transactions on " << threads << " threads, " << outside
+                  << " sides of them with accounts outside the database or the shard" << std::endl;
+        return true;
+    }
+
+    bool Audit::_scan(int64_t last, int64_t chunk, std::atomic<int64_t> &next, std::vector<double> &movements,
+                      uint64_t &rows, uint64_t &skipped) const {
+        sqlite3 *db;
+        if (sqlite3_open_v2(_path.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+            std::cout << "[audit] can not open database " << _path << ": " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+        sqlite3_stmt *stmt;
+        const char *sql = "SELECT source, destination, amount, fee FROM transactions WHERE rowid >= ? AND rowid < ?";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[audit] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return false;
+        }
+
+        // the source pays the amount and the fee, the destination gets the amount
+        bool error = false;
+        std::string iban;
+        auto index = [this, &iban, stmt](int column) {
+            const auto *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+            iban.assign(text != nullptr ? text : "", (std::size_t) sqlite3_column_bytes(stmt, column));
+            auto it = _indexes.find(iban);
+            return it != _indexes.end() ? (int64_t) it->second : -1;
+        };
+        for (int64_t begin = next.fetch_add(chunk); begin <= last && !error; begin = next.fetch_add(chunk)) {
+            sqlite3_bind_int64(stmt, 1, begin);
+            sqlite3_bind_int64(stmt, 2, begin + chunk);
+            int result;
+            while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+                const double amount = sqlite3_column_double(stmt, 2);
+                const double fee = sqlite3_column_double(stmt, 3);
+                const int64_t source = index(0);
+                const int64_t destination = index(1);
+                if (source >= 0) {
+                    movements[source] -= amount + fee;
+                } else if (sqlite3_column_bytes(stmt, 0) > 0) {
+                    skipped++;
+                }
+                if (destination >= 0) {
+                    movements[destination] += amount;
+                } else if (sqlite3_column_bytes(stmt, 1) > 0) {
+                    skipped++;
+                }
+                rows++;
+            }
+            error = result != SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        if (error) {
+            std::cout << "[audit] can not read transactions: " << sqlite3_errmsg(db) << std::endl;
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return !error;
+    }
+
+    bool Audit::_exec(const char *sql) {
+        char *error = nullptr;
+        if (sqlite3_exec(_db, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+            std::cout << "[audit] can not execute " << sql << ": " << error << std::endl;
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+} // Control
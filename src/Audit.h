@@ -0,0 +1,104 @@
+#ifndef BANKING_AUDIT_H
+#define BANKING_AUDIT_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <sqlite3.h>
+#include "ShardMap.h"
+
+namespace Control {
+
+    /*
+     * This is the audit class, reconciling the balances of the accounts with the transactions that moved them.
+     * The expected balance of an account is its opening balance plus what the transactions moved in and out of it.
+     * Opening balances are recorded once, when the balances are known to be right, in the openings table.
+     * The transactions are streamed by worker threads, each summing a range of rows on a connection of its own,
+     * so memory grows with the number of accounts but not with the number of transactions.
+     * Transactions with accounts that are not in the database are skipped.
+     * On a shard the database holds the accounts of every bank, but only those of the banks the shard owns are audited,
+     * the other side of a transaction between shards is audited on the shard owning it.
+     * The balances and the transactions are read on different connections, so the audit holds the write lock of the
+     * database until it has read them all, and no transaction is committed in between. A running server keeps
+     * journaling meanwhile, and writes the journal to the database once the audit is done.
+     */
+    class Audit {
+
+    public:
+
+        /*
+         * Closes the database.
+         */
+        ~Audit();
+
+        /*
+         * Opens the database at path.
+         */
+        bool open(const std::string &path);
+
+        /*
+         * Closes the database.
+         */
+        void close();
+
+        /*
+         * Audits only the accounts of the banks the shard owns, as the server of the shard does.
+         */
+        void shard(std::size_t shard, const Tools::ShardMap &shard_map);
+
+        /*
+         * Reports every account whose balance is not its expected balance, using threads worker threads.
+         * Returns false if the database can not be read, and sets discrepancies to the number of accounts reported.
+         */
+        bool audit(std::size_t threads, uint64_t &discrepancies);
+
+        /*
+         * Records the opening balances of the accounts so that their current balances are the expected ones.
+         */
+        bool open_balances(std::size_t threads);
+
+    private:
+        sqlite3 *_db{}; // the database
+        std::string _path{}; // path of the database, opened again by every worker
+        std::vector<std::string> _ibans{}; // IBAN of every account, by index
+        std::vector<double> _balances{}; // balance of every account, by index
+        std::vector<double> _openings{}; // opening balance of every account, by index
+        std::size_t _opened{}; // accounts with an opening balance
+        std::unordered_map<std::string, uint32_t> _indexes{}; // index of every account, by IBAN
+        Tools::ShardMap _shard_map{}; // shards of a sharded deployment, empty if the database owns every bank
+        std::size_t _shard{}; // shard of the database
+
+        /*
+         * Takes the write lock of the database, then loads the accounts and sums the transactions of every account.
+         * The lock is kept for the caller to commit, unless the database can not be read.
+         */
+        bool _read(std::size_t threads, std::vector<double> &movements);
+
+        /*
+         * Loads the accounts of the banks the database owns with their balances and opening balances.
+         */
+        bool _load_accounts();
+
+        /*
+         * Sums what the transactions moved in and out of every account, by index.
+         */
+        bool _sum_transactions(std::size_t threads, std::vector<double> &movements);
+
+        /*
+         * Sums the transactions in the chunks of rows a worker takes, until none is left.
+         */
+        bool _scan(int64_t last, int64_t chunk, std::atomic<int64_t> &next, std::vector<double> &movements,
+                   uint64_t &rows, uint64_t &skipped) const;
+
+        /*
+         * Runs statements that return no rows.
+         */
+        bool _exec(const char *sql);
+    };
+
+} // Control
+
+#endif //BANKING_AUDIT_H
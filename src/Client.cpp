@@ -18,14 +18,21 @@ namespace Client {
     }
 
     void Client::initialize(const std::string& address) {
+        initialize(address, _own_ctx);
+    }
+
+    void Client::initialize(const std::string &address, zmq::context_t &context) {
         _address = address;
+        _ctx = &context;
 
         // connect to the server
-        _sock = zmq::socket_t(_ctx, ZMQ_REQ);
+        _sock = zmq::socket_t(*_ctx, ZMQ_REQ);
         _sock.connect(_address);
 
-        // wait for a second for ZMQ to properly initialize
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        // wait for a second for ZMQ to properly initialize, ipc:// and inproc:// connect right away
+        if (_address.rfind("tcp://", 0) == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        }
 
         std::cout << "[client] initialized" << std::endl;
     }
@@ -35,8 +42,8 @@ namespace Client {
             _sock.close();
             std::cout << "[client] socket connection closed" << std::endl;
         }
-        if (_ctx.handle() != nullptr) {
-            _ctx.close();
+        if (_own_ctx.handle() != nullptr) {
+            _own_ctx.close();
             std::cout << "[client] socket context closed" << std::endl;
         }
     }
@@ -53,13 +60,23 @@ namespace Client {
 
     void Client::send_ping() {
 
+        // create a random token
+        Token token;
+        token.resize(Token::capacity());
+        Tools::Tools::random_token(token.data(), token.size());
+
+        // send the PING message
+        send_ping(token);
+    }
+
+    void Client::send_ping(const Token &token) {
+
         // create a PING message
         PING ping;
         ping.type = PING_TYPE::CLIENT;
         ping.client_time = std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::system_clock::now().time_since_epoch()).count();
-        std::string random_token = Tools::Tools::random_string(32);
-        ping.token = random_token;
+        ping.token = token;
 
         // send the PING message
         send_ping(ping);
@@ -126,8 +143,9 @@ namespace Client {
 
     void Client::receive_bank_list_response() {
 
-        // receive a BANK_LIST_RESPONSE message
-        BANK_LIST_RESPONSE bank_list_response;
+        // receive a BANK_LIST_RESPONSE message into an arena
+        std::pmr::monotonic_buffer_resource arena(&_arenas);
+        BANK_LIST_RESPONSE bank_list_response(&arena);
         receive_bank_list_response(bank_list_response);
 
         // print the BANK_LIST_RESPONSE
@@ -199,7 +217,7 @@ namespace Client {
         std::cout << "[client] sent LOGOUT_REQUEST" << std::endl;
     }
 
-    void Client::send_logout_request(const std::string &user, const std::string &token) {
+    void Client::send_logout_request(const std::string &user, const Token &token) {
 
         // create a LOGOUT_REQUEST message
         LOGOUT_REQUEST logout_request;
@@ -244,7 +262,7 @@ namespace Client {
         std::cout << "[client] sent ACCOUNT_LIST_REQUEST" << std::endl;
     }
 
-    void Client::send_account_list_request(const uint32_t &user, const std::string &token, const uint16_t &bank) {
+    void Client::send_account_list_request(const uint32_t &user, const Token &token, const uint16_t &bank) {
 
         // create a ACCOUNT_LIST_REQUEST message
         ACCOUNT_LIST_REQUEST account_list_request;
@@ -282,11 +300,66 @@ namespace Client {
 
     [[maybe_unused]] void Client::receive_account_list_response() {
 
-        // receive a ACCOUNT_LIST_RESPONSE message
-        ACCOUNT_LIST_RESPONSE account_list_response;
+        // receive a ACCOUNT_LIST_RESPONSE message into an arena
+        std::pmr::monotonic_buffer_resource arena(&_arenas);
+        ACCOUNT_LIST_RESPONSE account_list_response(&arena);
         receive_account_list_response(account_list_response);
     }
 
+    void Client::send_bank_summary_request(BANK_SUMMARY_REQUEST &bank_summary_request) {
+
+        // pack the BANK_SUMMARY_REQUEST message
+        _msg = MSG{MSG_ID::BANK_SUMMARY_REQUEST, msgpack::object(bank_summary_request, _z)};
+
+        // send the BANK_SUMMARY_REQUEST message
+        _send_message();
+        std::cout << "[client] sent BANK_SUMMARY_REQUEST" << std::endl;
+    }
+
+    void Client::send_bank_summary_request(const uint32_t &user, const Token &token) {
+
+        // create a BANK_SUMMARY_REQUEST message
+        BANK_SUMMARY_REQUEST bank_summary_request;
+        bank_summary_request.user = user;
+        bank_summary_request.token = token;
+
+        // send the BANK_SUMMARY_REQUEST message
+        send_bank_summary_request(bank_summary_request);
+    }
+
+    void Client::receive_bank_summary_response(BANK_SUMMARY_RESPONSE &bank_summary_response) {
+
+        // receive a message
+        _receive_message();
+
+        // handle the BANK_SUMMARY_RESPONSE message
+        if (_msg.id == MSG_ID::BANK_SUMMARY_RESPONSE) {
+
+            // parse the BANK_SUMMARY_RESPONSE message
+            _msg.msg.convert(bank_summary_response);
+        }
+
+        // print the BANK_SUMMARY_RESPONSE
+        std::cout << "[client] received BANK_SUMMARY_RESPONSE" << std::endl;
+        std::cout.precision(2);
+        std::cout << std::fixed;
+        for (const auto &bank: bank_summary_response.banks) {
+            std::cout << "        bank.id:" << unsigned(bank.id);
+            std::cout << ", bank.accounts:" << bank.accounts;
+            std::cout << ", bank.total:" << bank.total;
+            std::cout << ", bank.overdrawn:" << bank.overdrawn << std::endl;
+        }
+        std::cout << "        bank_summary_response.net_worth:" << bank_summary_response.net_worth << std::endl;
+    }
+
+    void Client::receive_bank_summary_response() {
+
+        // receive a BANK_SUMMARY_RESPONSE message into an arena
+        std::pmr::monotonic_buffer_resource arena(&_arenas);
+        BANK_SUMMARY_RESPONSE bank_summary_response(&arena);
+        receive_bank_summary_response(bank_summary_response);
+    }
+
     void Client::send_add_balance_request(ADD_BALANCE_REQUEST &add_balance_request) {
 
         // pack the ADD_BALANCE_REQUEST message
@@ -297,8 +370,8 @@ namespace Client {
         std::cout << "[client] sent ADD_BALANCE_REQUEST" << std::endl;
     }
 
-    void Client::send_add_balance_request(const uint32_t &user, const std::string &token, const uint16_t &bank,
-                                          const std::string &iban, const double_t &amount) {
+    void Client::send_add_balance_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                          const IBAN &iban, const double_t &amount, const Token &key) {
 
         // create an ADD_BALANCE_REQUEST message
         ADD_BALANCE_REQUEST add_balance_request;
@@ -307,6 +380,7 @@ namespace Client {
         add_balance_request.bank = bank;
         add_balance_request.iban = iban;
         add_balance_request.amount = amount;
+        add_balance_request.key = key;
 
         // send the ADD_BALANCE_REQUEST message
         send_add_balance_request(add_balance_request);
@@ -348,8 +422,9 @@ namespace Client {
         std::cout << "[client] sent TRANSACTION_REQUEST" << std::endl;
     }
 
-    void Client::send_transaction_request(const uint32_t &user, const std::string &token, const uint16_t &bank,
-                                          const std::string &from, const std::string &to, const double_t &amount) {
+    void Client::send_transaction_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                          const IBAN &from, const IBAN &to, const double_t &amount,
+                                          const Token &key) {
 
         // create a TRANSACTION_REQUEST message
         TRANSACTION_REQUEST transaction_request;
@@ -359,6 +434,7 @@ namespace Client {
         transaction_request.from = from;
         transaction_request.to = to;
         transaction_request.amount = amount;
+        transaction_request.key = key;
 
         // send the TRANSACTION_REQUEST message
         send_transaction_request(transaction_request);
@@ -392,8 +468,94 @@ namespace Client {
         std::cout << "        transaction_response.fee:" << transaction_response.fee << std::endl;
     }
 
+    void Client::send_standing_order_request(STANDING_ORDER_REQUEST &standing_order_request) {
+
+        // pack the STANDING_ORDER_REQUEST message
+        _msg = MSG{MSG_ID::STANDING_ORDER_REQUEST, msgpack::object(standing_order_request, _z)};
+
+        // send the STANDING_ORDER_REQUEST message
+        _send_message();
+        std::cout << "[client] sent STANDING_ORDER_REQUEST" << std::endl;
+    }
+
+    void Client::send_standing_order_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                             const IBAN &from, const IBAN &to, const double_t &amount,
+                                             const uint64_t &first, const uint16_t &period, const bool &monthly,
+                                             const Token &key) {
+
+        // create a STANDING_ORDER_REQUEST message
+        STANDING_ORDER_REQUEST standing_order_request;
+        standing_order_request.user = user;
+        standing_order_request.token = token;
+        standing_order_request.bank = bank;
+        standing_order_request.from = from;
+        standing_order_request.to = to;
+        standing_order_request.amount = amount;
+        standing_order_request.first = first;
+        standing_order_request.period = period;
+        standing_order_request.monthly = monthly;
+        standing_order_request.key = key;
+
+        // send the STANDING_ORDER_REQUEST message
+        send_standing_order_request(standing_order_request);
+    }
+
+    void Client::send_standing_order_cancel_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                                    const Token &order, const Token &key) {
+
+        // create a STANDING_ORDER_REQUEST message naming the order to cancel
+        STANDING_ORDER_REQUEST standing_order_request;
+        standing_order_request.user = user;
+        standing_order_request.token = token;
+        standing_order_request.bank = bank;
+        standing_order_request.order = order;
+        standing_order_request.key = key;
+
+        // send the STANDING_ORDER_REQUEST message
+        send_standing_order_request(standing_order_request);
+    }
+
+    void Client::receive_standing_order_response(STANDING_ORDER_RESPONSE &standing_order_response) {
+
+        // receive a message
+        _receive_message();
+
+        // handle the STANDING_ORDER_RESPONSE message
+        if (_msg.id == MSG_ID::STANDING_ORDER_RESPONSE) {
+
+            // parse the STANDING_ORDER_RESPONSE message
+            _msg.msg.convert(standing_order_response);
+        }
+    }
+
+    void Client::receive_standing_order_response() {
+
+        // receive a STANDING_ORDER_RESPONSE message
+        STANDING_ORDER_RESPONSE standing_order_response;
+        receive_standing_order_response(standing_order_response);
+
+        // print the STANDING_ORDER_RESPONSE
+        std::cout << "[client] received STANDING_ORDER_RESPONSE" << std::endl;
+        std::cout << "        standing_order_response.type:" << unsigned(standing_order_response.type) << std::endl;
+        std::cout << "        standing_order_response.order:" << standing_order_response.order << std::endl;
+    }
+
+    void Client::set_timeout(uint64_t timeout) {
+        _timeout = timeout;
+    }
+
+    bool Client::server_busy(SERVER_BUSY &server_busy) const {
+        if (_busy) {
+            server_busy = _server_busy;
+        }
+        return _busy;
+    }
+
     void Client::_send_message() {
 
+        // tell the server how long the answer is awaited
+        _msg.deadline = _timeout == 0 ? 0 : Tools::Tools::system_time() + _timeout;
+
         // serialize the message
         std::stringstream buffer;
         msgpack::pack(buffer, _msg);
@@ -421,6 +583,13 @@ namespace Client {
 
         // convert msgpack::object to MSG
         result.get().convert(_msg);
+
+        // the server may have turned the request away instead of answering it
+        _busy = _msg.id == MSG_ID::SERVER_BUSY;
+        if (_busy) {
+            _msg.msg.convert(_server_busy);
+            std::cout << "[client] server busy, retry after " << _server_busy.retry_after << " ms" << std::endl;
+        }
     }
 
 } // Client
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define BANKING_CLIENT_H
 
 #include <string>
+#include <memory_resource>
 #include <zmq.hpp>
 #include "Messages.h"
 
@@ -19,15 +20,34 @@ namespace Client {
          */
         void initialize(const std::string &address);
 
+        /*
+         * Initializes the client like initialize(address), with its socket in the zmq context of the host process.
+         * An inproc:// server is reached only through the context it was initialized with.
+         */
+        void initialize(const std::string &address, zmq::context_t &context);
+
         /*
          * Terminates the client.
          */
         void terminate();
 
+        /*
+         * Sets how many milliseconds the server may take to answer a request, 0 to wait as long as it takes.
+         * The server drops requests that waited longer than that in its queue.
+         */
+        void set_timeout(uint64_t timeout);
+
+        /*
+         * Returns whether the server turned the last request away, and why in server_busy.
+         */
+        bool server_busy(SERVER_BUSY &server_busy) const;
+
         /*
          * Send ping to the server.
+         * Sending the session token as the ping token keeps the session alive.
          */
         void send_ping();
+        void send_ping(const Token &token);
         void send_ping(PING &ping);
 
         /*
@@ -44,6 +64,7 @@ namespace Client {
 
         /*
          * Receive a bank list response from the server.
+         * The banks are unpacked into the memory resource of the response, an arena of the client if none is given.
          */
         void receive_bank_list_response();
         void receive_bank_list_response(BANK_LIST_RESPONSE &bank_list_response);
@@ -64,7 +85,7 @@ namespace Client {
         /*
          * Send a logout request to the server.
          */
-        void send_logout_request(const std::string& user, const std::string& token);
+        void send_logout_request(const std::string& user, const Token &token);
         void send_logout_request(LOGOUT_REQUEST &logout_request);
 
         /*
@@ -76,23 +97,38 @@ namespace Client {
         /*
          * Send an account list request to the server.
          */
-        void send_account_list_request(const uint32_t &user, const std::string &token, const uint16_t &bank);
+        void send_account_list_request(const uint32_t &user, const Token &token, const uint16_t &bank);
         void send_account_list_request(ACCOUNT_LIST_REQUEST &account_list_request);
 
         /*
          * Receive an account list response from the server.
          * Need to save account list for future requests.
+         * The accounts are unpacked into the memory resource of the response.
          */
         void receive_account_list_response(ACCOUNT_LIST_RESPONSE &account_list_response);
         [[maybe_unused]] [[maybe_unused]] void receive_account_list_response();
 
+        /*
+         * Send a bank summary request to the server.
+         */
+        void send_bank_summary_request(const uint32_t &user, const Token &token);
+        void send_bank_summary_request(BANK_SUMMARY_REQUEST &bank_summary_request);
+
+        /*
+         * Receive a bank summary response from the server.
+         * The banks are unpacked into the memory resource of the response, an arena of the client if none is given.
+         */
+        void receive_bank_summary_response(BANK_SUMMARY_RESPONSE &bank_summary_response);
+        void receive_bank_summary_response();
+
         /*
          * Send an add balance request to the server.
          * This is like a superuser adding balance to an IBAN.
          * Or a user adding balance to his/her own IBAN using an ATM.
+         * Resending with the same key is safe, the balance is added only once.
          */
-        void send_add_balance_request(const uint32_t &user, const std::string &token, const uint16_t &bank,
-                                      const std::string &iban, const double_t &amount);
+        void send_add_balance_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                      const IBAN &iban, const double_t &amount, const Token &key = {});
         void send_add_balance_request(ADD_BALANCE_REQUEST &add_balance_request);
 
         /*
@@ -103,9 +139,11 @@ namespace Client {
 
         /*
          * Send a transaction request to the server.
+         * Resending with the same key is safe, the amount is transferred only once.
          */
-        void send_transaction_request(const uint32_t &user, const std::string &token, const uint16_t &bank,
-                                      const std::string &from, const std::string &to, const double_t &amount);
+        void send_transaction_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                      const IBAN &from, const IBAN &to, const double_t &amount,
+                                      const Token &key = {});
         void send_transaction_request(TRANSACTION_REQUEST &transaction_request);
 
         /*
@@ -114,6 +152,28 @@ namespace Client {
         void receive_transaction_response();
         void receive_transaction_response(TRANSACTION_RESPONSE &transaction_response);
 
+        /*
+         * Send a standing order request to the server, transferring amount from first on, every period days or months.
+         * Resending with the same key is safe, the order is registered only once.
+         */
+        void send_standing_order_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                         const IBAN &from, const IBAN &to, const double_t &amount,
+                                         const uint64_t &first, const uint16_t &period, const bool &monthly,
+                                         const Token &key = {});
+        void send_standing_order_request(STANDING_ORDER_REQUEST &standing_order_request);
+
+        /*
+         * Send a request to the server cancelling the standing order with the token order.
+         */
+        void send_standing_order_cancel_request(const uint32_t &user, const Token &token, const uint16_t &bank,
+                                                const Token &order, const Token &key = {});
+
+        /*
+         * Receive a standing order response from the server.
+         */
+        void receive_standing_order_response();
+        void receive_standing_order_response(STANDING_ORDER_RESPONSE &standing_order_response);
+
         /*
          * Destroys the client.
          */
@@ -128,8 +188,13 @@ namespace Client {
         std::string _address{}; // The address of the server.
         msgpack::zone _z; // this is needed for the msgpack::object constructor
         MSG _msg; // this is the message that will be sent or received
-        zmq::context_t _ctx; // create a zmq context
+        zmq::context_t _own_ctx; // create a zmq context, unless the host process gives one
+        zmq::context_t *_ctx{&_own_ctx}; // zmq context of the socket
         zmq::socket_t _sock; // create a zmq socket
+        std::pmr::unsynchronized_pool_resource _arenas{std::pmr::pool_options{0, 1 << 20}}; // memory of the arenas
+        uint64_t _timeout{}; // milliseconds the server may take to answer a request
+        bool _busy{}; // whether the server turned the last request away
+        SERVER_BUSY _server_busy{}; // why the server turned the last request away
 
         /*
          * Sends a message to the server.
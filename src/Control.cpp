@@ -0,0 +1,653 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <charconv>
+#include "Control.h"
+
+namespace Control {
+
+    namespace {
+
+        // rows per transaction of an import
+        constexpr std::size_t batch_rows = 100000;
+
+        // bytes buffered before exported rows are written out
+        constexpr std::size_t export_buffer = 1 << 20;
+
+        // appends a code point to a string as UTF-8
+        void append_utf8(std::string &out, uint32_t code) {
+            if (code < 0x80) {
+                out += static_cast<char>(code);
+            } else if (code < 0x800) {
+                out += static_cast<char>(0xc0 | code >> 6);
+                out += static_cast<char>(0x80 | (code & 0x3f));
+            } else if (code < 0x10000) {
+                out += static_cast<char>(0xe0 | code >> 12);
+                out += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+                out += static_cast<char>(0x80 | (code & 0x3f));
+            } else {
+                out += static_cast<char>(0xf0 | code >> 18);
+                out += static_cast<char>(0x80 | (code >> 12 & 0x3f));
+                out += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+                out += static_cast<char>(0x80 | (code & 0x3f));
+            }
+        }
+
+        // reads four hex digits at position, moving past them
+        bool read_hex(const std::string &line, std::size_t &position, uint32_t &code) {
+            if (position + 4 > line.size()) {
+                return false;
+            }
+            code = 0;
+            for (std::size_t end = position + 4; position < end; position++) {
+                const char c = line[position];
+                code <<= 4;
+                if (c >= '0' && c <= '9') {
+                    code |= c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    code |= c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    code |= c - 'A' + 10;
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // skips the whitespace at position
+        void skip_space(const std::string &line, std::size_t &position) {
+            while (position < line.size() && (line[position] == ' ' || line[position] == '\t' ||
+                                              line[position] == '\r' || line[position] == '\n')) {
+                position++;
+            }
+        }
+
+        // reads the JSON string at position, moving past it
+        bool read_string(const std::string &line, std::size_t &position, std::string &out) {
+            out.clear();
+            if (position >= line.size() || line[position] != '"') {
+                return false;
+            }
+            position++;
+            while (position < line.size()) {
+                const char c = line[position++];
+                if (c == '"') {
+                    return true;
+                }
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+                if (position >= line.size()) {
+                    return false;
+                }
+                const char escape = line[position++];
+                switch (escape) {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        out += escape;
+                        break;
+                    case 'b':
+                        out += '\b';
+                        break;
+                    case 'f':
+                        out += '\f';
+                        break;
+                    case 'n':
+                        out += '\n';
+                        break;
+                    case 'r':
+                        out += '\r';
+                        break;
+                    case 't':
+                        out += '\t';
+                        break;
+                    case 'u': {
+                        uint32_t code;
+                        if (!read_hex(line, position, code)) {
+                            return false;
+                        }
+
+                        // a surrogate pair encodes a code point outside the basic plane
+                        if (code >= 0xd800 && code < 0xdc00) {
+                            uint32_t low;
+                            if (line.compare(position, 2, "\\u") != 0) {
+                                return false;
+                            }
+                            position += 2;
+                            if (!read_hex(line, position, low) || low < 0xdc00 || low >= 0xe000) {
+                                return false;
+                            }
+                            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                        append_utf8(out, code);
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+            return false;
+        }
+
+    } // namespace
+
+    Control::~Control() {
+        close();
+    }
+
+    bool Control::open(const std::string &path) {
+        close();
+        if (sqlite3_open_v2(path.c_str(), &_db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+            std::clog << "[bankctl] can not open database " << path << ": " << sqlite3_errmsg(_db) << std::endl;
+            close();
+            return false;
+        }
+        _path = path;
+
+        // wait for a server still finishing its writes, and keep index builds in memory
+        sqlite3_busy_timeout(_db, 5000);
+        return _exec("PRAGMA cache_size = -65536; PRAGMA temp_store = MEMORY;");
+    }
+
+    void Control::close() {
+        if (_db != nullptr) {
+            sqlite3_close(_db);
+            _db = nullptr;
+        }
+    }
+
+    bool Control::import_table(const std::string &table, std::istream &input, FORMAT format) {
+        const std::vector<Column> *columns = _columns(table);
+        if (columns == nullptr) {
+            std::clog << "[bankctl] can not import table " << table << std::endl;
+            return false;
+        }
+
+        // prepare the insert once for all rows
+        std::string sql = "INSERT INTO " + table + " (";
+        for (std::size_t i = 0; i < columns->size(); i++) {
+            sql += (i > 0 ? ", " : "") + std::string((*columns)[i].name);
+        }
+        sql += ") VALUES (";
+        for (std::size_t i = 0; i < columns->size(); i++) {
+            sql += i > 0 ? ", ?" : "?";
+        }
+        sql += ")";
+        sqlite3_stmt *insert;
+        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &insert, nullptr) != SQLITE_OK) {
+            std::clog << "[bankctl] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+
+        // the indexes are built once after the rows are in
+        std::vector<std::string> indexes;
+        if (!_drop_indexes(table, indexes) || !_exec("BEGIN")) {
+            sqlite3_finalize(insert);
+            return false;
+        }
+
+        // the fields of a CSV file are in the order of its header, or in the order of the columns without one
+        std::vector<std::size_t> order(columns->size());
+        for (std::size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::vector<Field> fields(columns->size());
+        std::vector<Field> row;
+        std::string line;
+        std::size_t line_number = 0;
+        std::size_t imported = 0;
+        bool error = false;
+        bool first = true;
+        while (!error) {
+
+            // read the next row
+            if (format == FORMAT::CSV) {
+                if (!_read_csv(input, line, row, error)) {
+                    break;
+                }
+                line_number++;
+                if (first) {
+                    first = false;
+                    std::vector<std::size_t> header;
+                    for (const Field &field: row) {
+                        for (std::size_t i = 0; i < columns->size(); i++) {
+                            if (field.value == (*columns)[i].name) {
+                                header.push_back(i);
+                            }
+                        }
+                    }
+                    if (header.size() == row.size()) {
+                        order = header;
+                        continue;
+                    }
+                }
+                if (row.size() != order.size()) {
+                    std::clog << "[bankctl] row " << line_number << " has " << row.size() << " fields, expected "
+                              << order.size() << std::endl;
+                    error = true;
+                    break;
+                }
+                for (Field &field: fields) {
+                    field.null = true;
+                }
+                for (std::size_t i = 0; i < row.size(); i++) {
+                    std::swap(fields[order[i]], row[i]);
+                }
+            } else {
+                if (!std::getline(input, line)) {
+                    break;
+                }
+                line_number++;
+                if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                    continue;
+                }
+                if (!_parse_ndjson(line, *columns, fields)) {
+                    std::clog << "[bankctl] line " << line_number << " is not a JSON object" << std::endl;
+                    error = true;
+                    break;
+                }
+            }
+
+            // insert it
+            for (std::size_t i = 0; i < fields.size(); i++) {
+                if (fields[i].null) {
+                    sqlite3_bind_null(insert, (int) i + 1);
+                } else {
+                    sqlite3_bind_text(insert, (int) i + 1, fields[i].value.data(), (int) fields[i].value.size(),
+                                      SQLITE_STATIC);
+                }
+            }
+            if (sqlite3_step(insert) != SQLITE_DONE) {
+                std::clog << "[bankctl] can not import row " << line_number << ": " << sqlite3_errmsg(_db)
+                          << std::endl;
+                error = true;
+            }
+            sqlite3_reset(insert);
+
+            // commit a batch
+            if (!error && ++imported % batch_rows == 0) {
+                error = !_exec("COMMIT; BEGIN");
+                std::clog << "[bankctl] imported " << imported << " rows into " << table << std::endl;
+            }
+        }
+        sqlite3_finalize(insert);
+        if (input.bad()) {
+            std::clog << "[bankctl] can not read input" << std::endl;
+            error = true;
+        }
+
+        // keep the batches before a bad row, then build the indexes again
+        if (error) {
+            _exec("ROLLBACK");
+            imported -= imported % batch_rows;
+        } else {
+            error = !_exec("COMMIT");
+        }
+        for (const std::string &index: indexes) {
+            error = !_exec(index) || error;
+        }
+
+        // the server loads its accounts from the latest snapshot, it must read the imported ones instead
+        if (table == "accounts" && imported > 0) {
+            const std::size_t slash = _path.find_last_of('/');
+            const std::string snapshot = (slash == std::string::npos ? "" : _path.substr(0, slash + 1)) +
+                                         "banking.snapshot";
+            if (std::remove(snapshot.c_str()) == 0) {
+                std::clog << "[bankctl] removed " << snapshot << ", the server loads the accounts from the database"
+                          << std::endl;
+            }
+        }
+        std::clog << "[bankctl] imported " << imported << " rows into " << table << std::endl;
+        return !error;
+    }
+
+    bool Control::export_table(const std::string &table, std::ostream &output, FORMAT format) {
+        const std::vector<Column> *columns = _columns(table);
+        if (columns == nullptr) {
+            std::clog << "[bankctl] can not export table " << table << std::endl;
+            return false;
+        }
+
+        // select all columns in their order
+        std::string sql = "SELECT ";
+        for (std::size_t i = 0; i < columns->size(); i++) {
+            sql += (i > 0 ? ", " : "") + std::string((*columns)[i].name);
+        }
+        sql += " FROM " + table;
+        sqlite3_stmt *select;
+        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &select, nullptr) != SQLITE_OK) {
+            std::clog << "[bankctl] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+
+        // a CSV file starts with the names of the columns
+        std::string buffer;
+        buffer.reserve(export_buffer + 4096);
+        if (format == FORMAT::CSV) {
+            for (std::size_t i = 0; i < columns->size(); i++) {
+                buffer += (i > 0 ? "," : "") + std::string((*columns)[i].name);
+            }
+            buffer += '\n';
+        }
+
+        // write the rows, a buffer at a time
+        std::size_t exported = 0;
+        char number[32];
+        int result;
+        while ((result = sqlite3_step(select)) == SQLITE_ROW) {
+            if (format == FORMAT::NDJSON) {
+                buffer += '{';
+            }
+            for (std::size_t i = 0; i < columns->size(); i++) {
+                const int type = sqlite3_column_type(select, (int) i);
+                const auto *value = reinterpret_cast<const char *>(sqlite3_column_text(select, (int) i));
+                auto size = static_cast<std::size_t>(sqlite3_column_bytes(select, (int) i));
+
+                // the text of a real is rounded, write the shortest one that reads back the same
+                if (type == SQLITE_FLOAT) {
+                    value = number;
+                    size = std::to_chars(number, number + sizeof(number), sqlite3_column_double(select, (int) i)).ptr -
+                           number;
+                }
+                if (format == FORMAT::CSV) {
+                    if (i > 0) {
+                        buffer += ',';
+                    }
+                    if (type != SQLITE_NULL) {
+                        _write_csv(buffer, value, size);
+                    }
+                } else {
+                    if (i > 0) {
+                        buffer += ',';
+                    }
+                    _write_json(buffer, (*columns)[i].name, std::strlen((*columns)[i].name));
+                    buffer += ':';
+                    if (type == SQLITE_NULL) {
+                        buffer += "null";
+                    } else if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+                        buffer.append(value, size);
+                    } else {
+                        _write_json(buffer, value, size);
+                    }
+                }
+            }
+            buffer += format == FORMAT::NDJSON ? "}\n" : "\n";
+            exported++;
+            if (buffer.size() >= export_buffer) {
+                output.write(buffer.data(), (std::streamsize) buffer.size());
+                buffer.clear();
+            }
+        }
+        sqlite3_finalize(select);
+        output.write(buffer.data(), (std::streamsize) buffer.size());
+        output.flush();
+        if (result != SQLITE_DONE || !output) {
+            std::clog << "[bankctl] can not export table " << table << ": " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        std::clog << "[bankctl] exported " << exported << " rows from " << table << std::endl;
+        return true;
+    }
+
+    FORMAT Control::format(const std::string &path) {
+        auto ends_with = [&path](const std::string &extension) {
+            return path.size() >= extension.size() &&
+                   path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+        };
+        return ends_with(".ndjson") || ends_with(".jsonl") ? FORMAT::NDJSON : FORMAT::CSV;
+    }
+
+    const std::vector<Control::Column> *Control::_columns(const std::string &table) {
+        static const std::vector<Column> users = {{"id",      true},
+                                                  {"citizen", true},
+                                                  {"name",    false},
+                                                  {"user",    false},
+                                                  {"pass",    false}};
+        static const std::vector<Column> accounts = {{"iban",    false},
+                                                     {"user",    true},
+                                                     {"bank",    true},
+                                                     {"balance", true}};
+        static const std::vector<Column> transactions = {{"token",       false},
+                                                         {"source",      false},
+                                                         {"destination", false},
+                                                         {"amount",      true},
+                                                         {"fee",         true}};
+        if (table == "users") {
+            return &users;
+        }
+        if (table == "accounts") {
+            return &accounts;
+        }
+        if (table == "transactions") {
+            return &transactions;
+        }
+        return nullptr;
+    }
+
+    bool Control::_exec(const std::string &sql) {
+        char *error = nullptr;
+        if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+            std::clog << "[bankctl] can not execute " << sql << ": " << error << std::endl;
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+    bool Control::_drop_indexes(const std::string &table, std::vector<std::string> &indexes) {
+
+        // the indexes created for constraints can not be dropped, only the others are deferred
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(_db, "SELECT name, sql FROM sqlite_master WHERE type = 'index' AND tbl_name = ? "
+                                    "AND sql IS NOT NULL", -1, &stmt, nullptr) != SQLITE_OK) {
+            std::clog << "[bankctl] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, table.data(), (int) table.size(), SQLITE_STATIC);
+        std::vector<std::string> names;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            names.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+            indexes.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+        }
+        sqlite3_finalize(stmt);
+        for (const std::string &name: names) {
+            if (!_exec("DROP INDEX \"" + name + "\"")) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Control::_read_csv(std::istream &input, std::string &line, std::vector<Field> &fields, bool &error) {
+        if (!std::getline(input, line)) {
+            return false;
+        }
+        std::size_t count = 0;
+        std::size_t position = 0;
+        while (true) {
+            if (fields.size() <= count) {
+                fields.resize(count + 1);
+            }
+            Field &field = fields[count++];
+            field.value.clear();
+            field.null = true;
+
+            // a quoted field may hold separators, doubled quotes and line breaks
+            if (position < line.size() && line[position] == '"') {
+                field.null = false;
+                position++;
+                while (true) {
+                    const std::size_t quote = line.find('"', position);
+                    if (quote == std::string::npos) {
+                        field.value.append(line, position);
+                        field.value += '\n';
+                        if (!std::getline(input, line)) {
+                            error = true;
+                            return true;
+                        }
+                        position = 0;
+                        continue;
+                    }
+                    field.value.append(line, position, quote - position);
+                    position = quote + 1;
+                    if (position < line.size() && line[position] == '"') {
+                        field.value += '"';
+                        position++;
+                        continue;
+                    }
+                    break;
+                }
+            } else {
+                std::size_t end = line.find(',', position);
+                if (end == std::string::npos) {
+                    end = line.size();
+                }
+                field.value.assign(line, position, end - position);
+                position = end;
+                if (!field.value.empty() && field.value.back() == '\r' && position == line.size()) {
+                    field.value.pop_back();
+                }
+
+                // an empty field is NULL, an empty string is quoted
+                field.null = field.value.empty();
+            }
+
+            // move on to the next field
+            if (position < line.size() && line[position] == '\r' && position + 1 == line.size()) {
+                position++;
+            }
+            if (position >= line.size()) {
+                break;
+            }
+            if (line[position] != ',') {
+                error = true;
+                break;
+            }
+            position++;
+        }
+        fields.resize(count);
+        return true;
+    }
+
+    bool Control::_parse_ndjson(const std::string &line, const std::vector<Column> &columns,
+                                std::vector<Field> &fields) {
+        for (Field &field: fields) {
+            field.null = true;
+        }
+        std::size_t position = 0;
+        skip_space(line, position);
+        if (position >= line.size() || line[position++] != '{') {
+            return false;
+        }
+        skip_space(line, position);
+        if (position < line.size() && line[position] == '}') {
+            return true;
+        }
+        std::string key;
+        std::string ignored;
+        while (true) {
+
+            // the key
+            skip_space(line, position);
+            if (!read_string(line, position, key)) {
+                return false;
+            }
+            skip_space(line, position);
+            if (position >= line.size() || line[position++] != ':') {
+                return false;
+            }
+            skip_space(line, position);
+            std::size_t column = 0;
+            while (column < columns.size() && key != columns[column].name) {
+                column++;
+            }
+            Field *field = column < columns.size() ? &fields[column] : nullptr;
+            std::string &value = field != nullptr ? field->value : ignored;
+
+            // the value, a string or a literal like a number
+            if (position < line.size() && line[position] == '"') {
+                if (!read_string(line, position, value)) {
+                    return false;
+                }
+                if (field != nullptr) {
+                    field->null = false;
+                }
+            } else {
+                const std::size_t end = line.find_first_of(",} \t\r", position);
+                if (end == std::string::npos || end == position || line[position] == '{' || line[position] == '[') {
+                    return false;
+                }
+                value.assign(line, position, end - position);
+                position = end;
+                if (field != nullptr) {
+                    field->null = value == "null";
+                    if (value == "true" || value == "false") {
+                        value = value == "true" ? "1" : "0";
+                    }
+                }
+            }
+
+            // the next pair or the end of the object
+            skip_space(line, position);
+            if (position >= line.size()) {
+                return false;
+            }
+            if (line[position] == '}') {
+                position++;
+                skip_space(line, position);
+                return position == line.size();
+            }
+            if (line[position++] != ',') {
+                return false;
+            }
+        }
+    }
+
+    void Control::_write_csv(std::string &line, const char *value, std::size_t size) {
+        bool quote = size == 0;
+        for (std::size_t i = 0; i < size && !quote; i++) {
+            quote = value[i] == ',' || value[i] == '"' || value[i] == '\n' || value[i] == '\r';
+        }
+        if (!quote) {
+            line.append(value, size);
+            return;
+        }
+        line += '"';
+        for (std::size_t i = 0; i < size; i++) {
+            if (value[i] == '"') {
+                line += '"';
+            }
+            line += value[i];
+        }
+        line += '"';
+    }
+
+    void Control::_write_json(std::string &line, const char *value, std::size_t size) {
+        static const char hex[] = "0123456789abcdef";
+        line += '"';
+        for (std::size_t i = 0; i < size; i++) {
+            const auto c = static_cast<unsigned char>(value[i]);
+            if (c == '"' || c == '\\') {
+                line += '\\';
+                line += static_cast<char>(c);
+            } else if (c == '\n') {
+                line += "\\n";
+            } else if (c == '\r') {
+                line += "\\r";
+            } else if (c == '\t') {
+                line += "\\t";
+            } else if (c < 0x20) {
+                line += "\\u00";
+                line += hex[c >> 4];
+                line += hex[c & 0xf];
+            } else {
+                line += static_cast<char>(c);
+            }
+        }
+        line += '"';
+    }
+
+} // Control
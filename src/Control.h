@@ -0,0 +1,126 @@
+#ifndef BANKING_CONTROL_H
+#define BANKING_CONTROL_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#include <sqlite3.h>
+
+namespace Control {
+
+    /*
+     * This is a list of all the file formats rows can be imported from and exported to.
+     * CSV has one row per line, optionally after a header line naming the columns.
+     * NDJSON has one JSON object per line, keyed by column name.
+     */
+    enum class FORMAT : uint8_t {
+        CSV = 0,
+        NDJSON = 1,
+    };
+
+    /*
+     * This is the control class, moving users, accounts and transactions between files and the database in bulk.
+     * Rows are streamed one at a time, so memory stays the same however large the file is.
+     * Imports write in large transactions with a single prepared statement, and rebuild the indexes of the table
+     * once at the end instead of on every row. The server must not be running while rows are imported.
+     */
+    class Control {
+
+    public:
+
+        /*
+         * Closes the database.
+         */
+        ~Control();
+
+        /*
+         * Opens the database at path.
+         */
+        bool open(const std::string &path);
+
+        /*
+         * Closes the database.
+         */
+        void close();
+
+        /*
+         * Imports the rows in the input into the table.
+         * Rows are committed in batches, a bad row stops the import and leaves the batches before it in the table.
+         */
+        bool import_table(const std::string &table, std::istream &input, FORMAT format);
+
+        /*
+         * Exports all rows of the table to the output.
+         */
+        bool export_table(const std::string &table, std::ostream &output, FORMAT format);
+
+        /*
+         * Returns the format of a file by its extension, CSV unless it is .ndjson or .jsonl.
+         */
+        static FORMAT format(const std::string &path);
+
+    private:
+        sqlite3 *_db{}; // the database
+        std::string _path{}; // path of the database
+
+        /*
+         * This is a column of a table that can be imported and exported.
+         */
+        struct Column {
+            const char *name; // name of the column
+            bool numeric; // whether the column holds numbers, written to NDJSON without quotes
+        };
+
+        /*
+         * This is one field of a row being imported.
+         */
+        struct Field {
+            std::string value{}; // the value, without quotes and escapes
+            bool null{true}; // whether the field is missing or NULL
+        };
+
+        /*
+         * Returns the columns of the table, or nullptr if it can not be imported or exported.
+         */
+        static const std::vector<Column> *_columns(const std::string &table);
+
+        /*
+         * Runs statements that return no rows.
+         */
+        bool _exec(const std::string &sql);
+
+        /*
+         * Drops the indexes of the table and returns the statements creating them again.
+         */
+        bool _drop_indexes(const std::string &table, std::vector<std::string> &indexes);
+
+        /*
+         * Reads the next CSV row into the fields, which may span lines if a quoted field holds line breaks.
+         * Returns false at the end of the input, and sets error if the row is malformed.
+         */
+        static bool _read_csv(std::istream &input, std::string &line, std::vector<Field> &fields, bool &error);
+
+        /*
+         * Parses a line holding a JSON object into the fields of the columns, by name.
+         * Keys that are not columns are ignored. Returns false if the line is not a flat JSON object.
+         */
+        static bool _parse_ndjson(const std::string &line, const std::vector<Column> &columns,
+                                  std::vector<Field> &fields);
+
+        /*
+         * Appends a value to a CSV line, quoted if needed.
+         */
+        static void _write_csv(std::string &line, const char *value, std::size_t size);
+
+        /*
+         * Appends a value to a JSON line as a string.
+         */
+        static void _write_json(std::string &line, const char *value, std::size_t size);
+    };
+
+} // Control
+
+#endif //BANKING_CONTROL_H
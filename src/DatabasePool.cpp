@@ -0,0 +1,149 @@
+#include <iostream>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "DatabasePool.h"
+#include "Trace.h"
+
+namespace Server {
+
+    DatabasePool::~DatabasePool() {
+        close();
+        if (_event >= 0) {
+            ::close(_event);
+        }
+    }
+
+    bool DatabasePool::open(const std::string &path, std::size_t threads) {
+        close();
+
+        // the finished work is signalled to the server thread through an eventfd
+        if (_event < 0) {
+            _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        if (_event < 0) {
+            std::cout << "[server] can not create database pool event" << std::endl;
+            return false;
+        }
+
+        // open a connection for every thread, waiting for the lock when another connection is writing
+        for (std::size_t i = 0; i < threads; i++) {
+            sqlite3 *db = nullptr;
+            if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+                std::cout << "[server] can not open database pool connection: " << sqlite3_errmsg(db) << std::endl;
+                sqlite3_close(db);
+                close();
+                return false;
+            }
+            sqlite3_busy_timeout(db, 5000);
+
+            // a commit is on disk once it returns, the journal drops the records the database has
+            sqlite3_exec(db, "PRAGMA synchronous = FULL", nullptr, nullptr, nullptr);
+            Tools::Trace::watch(db);
+            _connections.push_back(db);
+        }
+
+        // start the threads
+        _stopping = false;
+        for (sqlite3 *db: _connections) {
+            _threads.emplace_back(&DatabasePool::_run, this, db);
+        }
+        std::cout << "[server] started " << threads << " database threads" << std::endl;
+        return true;
+    }
+
+    void DatabasePool::close() {
+
+        // let the threads finish the queue and stop
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        for (std::thread &thread: _threads) {
+            thread.join();
+        }
+        _threads.clear();
+
+        // close the connections
+        for (sqlite3 *db: _connections) {
+            sqlite3_close(db);
+        }
+        _connections.clear();
+    }
+
+    bool DatabasePool::running() const {
+        return !_threads.empty();
+    }
+
+    void DatabasePool::submit(std::function<void(sqlite3 *)> work, std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(Job{std::move(work), handle});
+            _pending++;
+        }
+        _condition.notify_one();
+    }
+
+    std::size_t DatabasePool::resume() {
+
+        // clear the signal and take the finished coroutines
+        uint64_t count;
+        if (_event >= 0 && read(_event, &count, sizeof(count)) < 0) {
+            count = 0;
+        }
+        std::vector<std::coroutine_handle<>> finished;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            finished.swap(_finished);
+            _pending -= finished.size();
+        }
+
+        // resume them on this thread
+        for (std::coroutine_handle<> handle: finished) {
+            handle.resume();
+        }
+        return finished.size();
+    }
+
+    int DatabasePool::fd() const {
+        return running() ? _event : -1;
+    }
+
+    std::size_t DatabasePool::pending() const {
+        return _pending;
+    }
+
+    void DatabasePool::_run(sqlite3 *db) {
+        Tools::Trace::name("database");
+        while (true) {
+
+            // wait for work
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+                if (_jobs.empty()) {
+                    return;
+                }
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+
+            // run it and hand the coroutine back to the server thread
+            {
+                Tools::Span span("database", "query");
+                job.work(db);
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _finished.push_back(job.handle);
+            }
+            const uint64_t one = 1;
+            if (write(_event, &one, sizeof(one)) < 0) {
+                std::cout << "[server] can not signal finished database work" << std::endl;
+            }
+        }
+    }
+
+} // Server
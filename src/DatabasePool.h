@@ -0,0 +1,96 @@
+#ifndef BANKING_DATABASEPOOL_H
+#define BANKING_DATABASEPOOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <coroutine>
+#include <cstddef>
+#include <sqlite3.h>
+
+namespace Server {
+
+    /*
+     * This is a pool of threads running database work for suspended coroutines, each thread with its own connection.
+     * Coroutines are not resumed by the threads: finished work is queued and signalled on fd,
+     * and the server resumes the coroutines on its own thread with resume, so its state needs no locks.
+     * Work is queued without limit, the number of coroutines waiting does not depend on the number of threads.
+     */
+    class DatabasePool {
+
+    public:
+
+        /*
+         * Stops the threads and closes the event.
+         */
+        ~DatabasePool();
+
+        /*
+         * Opens threads connections to the database at path and starts a thread for each.
+         */
+        bool open(const std::string &path, std::size_t threads);
+
+        /*
+         * Lets the threads finish the queued work and stops them.
+         * Coroutines whose work finished are still resumed by the next resume.
+         */
+        void close();
+
+        /*
+         * Returns whether the threads are running.
+         */
+        bool running() const;
+
+        /*
+         * Queues work to run on one of the threads, after which handle is resumed by resume.
+         */
+        void submit(std::function<void(sqlite3 *)> work, std::coroutine_handle<> handle);
+
+        /*
+         * Resumes the coroutines whose work finished and returns how many there were.
+         */
+        std::size_t resume();
+
+        /*
+         * Returns a descriptor that is readable while there are coroutines to resume, -1 if the pool is not open.
+         */
+        int fd() const;
+
+        /*
+         * Returns the number of coroutines waiting for their work to finish.
+         */
+        std::size_t pending() const;
+
+    private:
+
+        /*
+         * This is work waiting for a thread.
+         */
+        struct Job {
+            std::function<void(sqlite3 *)> work;
+            std::coroutine_handle<> handle;
+        };
+
+        std::vector<std::thread> _threads{}; // threads running the work
+        std::vector<sqlite3 *> _connections{}; // connection of each thread
+        std::mutex _mutex; // guards the queues
+        std::condition_variable _condition; // wakes the threads when there is work or when they have to stop
+        std::deque<Job> _jobs{}; // work waiting for a thread
+        std::vector<std::coroutine_handle<>> _finished{}; // coroutines whose work finished, to be resumed
+        bool _stopping{}; // whether the threads have to stop once the queue is empty
+        int _event{-1}; // eventfd signalling finished work
+        std::size_t _pending{}; // coroutines waiting for their work to finish
+
+        /*
+         * Runs the queued work on the connection until the pool is closed.
+         */
+        void _run(sqlite3 *db);
+    };
+
+} // Server
+
+#endif //BANKING_DATABASEPOOL_H
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include "EndOfDay.h"
+
+namespace Server {
+
+    namespace {
+
+        // accounts per chunk, small enough to journal a chunk between two requests
+        constexpr uint32_t chunk_size = 8192;
+
+        // accounts per thread, fewer are not worth a thread
+        constexpr std::size_t thread_share = 1024;
+
+    } // namespace
+
+    EndOfDay::~EndOfDay() {
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    void EndOfDay::begin(uint32_t day, uint32_t days, uint32_t position, uint32_t count,
+                         std::unordered_map<uint16_t, Rate> rates) {
+        _day = day;
+        _days = days;
+        _position = position;
+        _count = count;
+        _rates = std::move(rates);
+        _running = position < count;
+        _computing = false;
+    }
+
+    bool EndOfDay::running() const {
+        return _running;
+    }
+
+    uint32_t EndOfDay::day() const {
+        return _day;
+    }
+
+    void EndOfDay::compute(const Ledger &ledger) {
+        if (!_running || _computing || _position >= _count) {
+            return;
+        }
+
+        // copy the balances and rates of the chunk, the ledger keeps changing while it is computed
+        _end = std::min<uint32_t>(_position + chunk_size, std::min<std::size_t>(_count, ledger.accounts().size()));
+        const std::size_t size = _end - _position;
+        _balances.resize(size);
+        _interest_rates.resize(size);
+        _fees.resize(size);
+        _interest.resize(size);
+        _fee.resize(size);
+        for (std::size_t i = 0; i < size; i++) {
+            const LedgerAccount &account = ledger.accounts()[_position + i];
+            auto rate = _rates.find(account.bank);
+            _balances[i] = account.balance;
+            _interest_rates[i] = rate == _rates.end() ? 0 : rate->second.interest / 365;
+            _fees[i] = rate == _rates.end() ? 0 : rate->second.fee;
+        }
+
+        // compute the chunk in the background, split over the cores
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        _computing = true;
+        _ready = false;
+        _thread = std::thread([this, size] {
+            const std::size_t threads = std::clamp<std::size_t>(size / thread_share, 1,
+                                                                std::max(1u, std::thread::hardware_concurrency()));
+            std::vector<std::thread> workers;
+            for (std::size_t t = 1; t < threads; t++) {
+                workers.emplace_back(&EndOfDay::_accrue, this, size * t / threads, size * (t + 1) / threads);
+            }
+            _accrue(0, size / threads);
+            for (std::thread &worker: workers) {
+                worker.join();
+            }
+            _ready = true;
+        });
+    }
+
+    bool EndOfDay::take(std::vector<Posting> &postings, uint32_t &position) {
+        if (!_computing || !_ready) {
+            return false;
+        }
+
+        // hand out the postings that move a balance by at least a cent
+        postings.clear();
+        for (std::size_t i = 0; i < _interest.size(); i++) {
+            if (_interest[i] >= 0.005 || _fee[i] >= 0.005) {
+                postings.push_back(Posting{_position + (uint32_t) i, _interest[i], _fee[i]});
+            }
+        }
+
+        // move on to the next chunk
+        _position = _end;
+        position = _position;
+        _computing = false;
+        _running = _position < _count;
+        return true;
+    }
+
+    void EndOfDay::_accrue(std::size_t begin, std::size_t end) {
+
+        // plain loops over contiguous arrays, which the compiler vectorizes
+        const double_t days = _days;
+        for (std::size_t i = begin; i < end; i++) {
+            _interest[i] = std::max(_balances[i], 0.0) * _interest_rates[i] * days;
+        }
+        for (std::size_t i = begin; i < end; i++) {
+            _fee[i] = _fees[i] * days;
+        }
+    }
+
+} // Server
@@ -0,0 +1,100 @@
+#ifndef BANKING_ENDOFDAY_H
+#define BANKING_ENDOFDAY_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <unordered_map>
+#include "Ledger.h"
+
+namespace Server {
+
+    /*
+     * This is the end-of-day batch engine, accruing interest and charging maintenance fees on every account once a day.
+     * Accounts are processed in chunks, in ledger order, so an interrupted day resumes after its last journaled chunk.
+     * The postings of a chunk are computed by a background thread, split over all cores, while the server keeps
+     * answering requests; the server then journals the whole chunk at once and starts the next one.
+     */
+    class EndOfDay {
+
+    public:
+
+        /*
+         * These are the end-of-day rates of a bank.
+         */
+        struct Rate {
+            double_t interest{}; // yearly interest on positive balances, 0.05 for 5%
+            double_t fee{}; // maintenance fee per account per day
+        };
+
+        /*
+         * This is what the batch posts to one account, not yet rounded to cents.
+         */
+        struct Posting {
+            uint32_t account{}; // index in the ledger
+            double_t interest{};
+            double_t fee{};
+        };
+
+        /*
+         * Waits for the chunk being computed.
+         */
+        ~EndOfDay();
+
+        /*
+         * Starts the batch of day, covering days days, over count accounts from position on.
+         */
+        void begin(uint32_t day, uint32_t days, uint32_t position, uint32_t count,
+                   std::unordered_map<uint16_t, Rate> rates);
+
+        /*
+         * Returns whether a batch is running.
+         */
+        bool running() const;
+
+        /*
+         * Returns the day of the running batch.
+         */
+        uint32_t day() const;
+
+        /*
+         * Copies the balances of the next chunk from the ledger and computes its postings in the background.
+         * Does nothing while a chunk is being computed or waits to be taken, or when there are no accounts left.
+         */
+        void compute(const Ledger &ledger);
+
+        /*
+         * Takes the postings of the computed chunk and the position after it.
+         * Returns false if no chunk is ready. The batch stops running when the last chunk is taken.
+         */
+        bool take(std::vector<Posting> &postings, uint32_t &position);
+
+    private:
+        uint32_t _day{}; // day of the batch, in days since the epoch
+        uint32_t _days{}; // days the batch covers, more than one if days were missed
+        uint32_t _position{}; // first account of the next chunk
+        uint32_t _end{}; // account after the chunk being computed
+        uint32_t _count{}; // number of accounts
+        bool _running{}; // whether a batch is running
+        bool _computing{}; // whether a chunk was handed to the background thread and not taken yet
+        std::unordered_map<uint16_t, Rate> _rates{}; // rates by bank
+        std::thread _thread; // computes the postings of a chunk
+        std::atomic<bool> _ready{false}; // whether the background thread is done with the chunk
+        std::vector<double_t> _balances{}; // balance of every account of the chunk
+        std::vector<double_t> _interest_rates{}; // daily interest rate of every account of the chunk
+        std::vector<double_t> _fees{}; // daily fee of every account of the chunk
+        std::vector<double_t> _interest{}; // interest of every account of the chunk
+        std::vector<double_t> _fee{}; // fee of every account of the chunk
+
+        /*
+         * Computes the interest and fee of the accounts of the chunk from begin to end.
+         */
+        void _accrue(std::size_t begin, std::size_t end);
+    };
+
+} // Server
+
+#endif //BANKING_ENDOFDAY_H
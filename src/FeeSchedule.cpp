@@ -0,0 +1,174 @@
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include "FeeSchedule.h"
+
+namespace Server {
+
+    namespace {
+
+        // index of a bank id that is not a bank
+        constexpr uint16_t no_bank = UINT16_MAX;
+
+        // banks the dense table is built for, it holds a cell for every pair of them
+        constexpr std::size_t max_banks = 2048;
+
+    } // namespace
+
+    bool FeeSchedule::load(sqlite3 *db) {
+
+        // the flat fees of the banks
+        std::vector<std::pair<uint16_t, double_t>> banks;
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, "SELECT id, fee FROM banks", -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            banks.emplace_back((uint16_t) sqlite3_column_int(stmt, 0), sqlite3_column_double(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+
+        // the rules, a missing bank is any bank
+        std::vector<Rule> rules;
+        if (sqlite3_prepare_v2(db, "SELECT from_bank, to_bank, amount, flat, percent, minimum, maximum FROM fee_rules",
+                               -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            Rule rule;
+            rule.from = sqlite3_column_type(stmt, 0) == SQLITE_NULL ? -1 : sqlite3_column_int(stmt, 0);
+            rule.to = sqlite3_column_type(stmt, 1) == SQLITE_NULL ? -1 : sqlite3_column_int(stmt, 1);
+            rule.amount = sqlite3_column_double(stmt, 2);
+            rule.flat = sqlite3_column_double(stmt, 3);
+            rule.percent = sqlite3_column_double(stmt, 4);
+            rule.minimum = sqlite3_column_double(stmt, 5);
+            rule.maximum = sqlite3_column_double(stmt, 6);
+            rules.push_back(rule);
+        }
+        sqlite3_finalize(stmt);
+        return compile(banks, rules);
+    }
+
+    bool FeeSchedule::compile(const std::vector<std::pair<uint16_t, double_t>> &banks, const std::vector<Rule> &rules) {
+        if (banks.size() > max_banks) {
+            std::cout << "[server] can not compile fees of more than " << max_banks << " banks" << std::endl;
+            return false;
+        }
+
+        // number the banks densely
+        std::vector<uint16_t> indexes;
+        for (std::size_t i = 0; i < banks.size(); i++) {
+            const uint16_t id = banks[i].first;
+            if (id == no_bank) {
+                continue;
+            }
+            if (indexes.size() <= id) {
+                indexes.resize(id + 1, no_bank);
+            }
+            indexes[id] = static_cast<uint16_t>(i);
+        }
+
+        // group the rules by how specific they are, as tiers sorted by amount
+        // 0 names both banks, 1 the from bank, 2 the to bank, 3 neither, 4 is the flat fee of the bank
+        const std::size_t count = banks.size();
+        auto index = [&indexes](int32_t bank) {
+            return bank >= 0 && (std::size_t) bank < indexes.size() ? indexes[bank] : no_bank;
+        };
+        std::vector<std::vector<std::pair<std::size_t, Tier>>> levels(4);
+        for (const Rule &rule: rules) {
+            const Tier tier{rule.amount, rule.flat, rule.percent, rule.minimum,
+                            rule.maximum > 0 ? rule.maximum : std::numeric_limits<double_t>::infinity()};
+            const uint16_t from = index(rule.from);
+            const uint16_t to = index(rule.to);
+            if ((rule.from >= 0 && from == no_bank) || (rule.to >= 0 && to == no_bank)) {
+                std::cout << "[server] fee rule names an unknown bank" << std::endl;
+                continue;
+            }
+            const std::size_t level = rule.from >= 0 ? (rule.to >= 0 ? 0 : 1) : (rule.to >= 0 ? 2 : 3);
+            const std::size_t key = level == 0 ? from * count + to : level == 1 ? from : level == 2 ? to : 0;
+            levels[level].emplace_back(key, tier);
+        }
+        for (auto &level: levels) {
+            std::stable_sort(level.begin(), level.end(), [](const auto &a, const auto &b) {
+                return a.first != b.first ? a.first < b.first : a.second.amount < b.second.amount;
+            });
+        }
+
+        // fill every cell with the tiers of the most specific rules for the pair of banks
+        std::vector<uint32_t> cells(count * count + 1);
+        std::vector<Tier> tiers;
+        auto find = [](const std::vector<std::pair<std::size_t, Tier>> &level, std::size_t key) {
+            auto begin = std::lower_bound(level.begin(), level.end(), key,
+                                          [](const auto &entry, std::size_t k) { return entry.first < k; });
+            auto end = begin;
+            while (end != level.end() && end->first == key) {
+                ++end;
+            }
+            return std::make_pair(begin, end);
+        };
+        for (std::size_t from = 0; from < count; from++) {
+            for (std::size_t to = 0; to < count; to++) {
+                cells[from * count + to] = static_cast<uint32_t>(tiers.size());
+                const std::size_t keys[] = {from * count + to, from, to, 0};
+                bool found = false;
+                for (std::size_t level = 0; level < levels.size() && !found; level++) {
+
+                    // within a bank only the rules naming both banks apply
+                    if (from == to && level > 0) {
+                        break;
+                    }
+                    auto [begin, end] = find(levels[level], keys[level]);
+                    for (auto it = begin; it != end; ++it) {
+                        tiers.push_back(it->second);
+                    }
+                    found = begin != end;
+                }
+                if (!found && from != to) {
+                    tiers.push_back(Tier{0, banks[from].second, 0, 0, std::numeric_limits<double_t>::infinity()});
+                }
+            }
+        }
+        cells[count * count] = static_cast<uint32_t>(tiers.size());
+
+        _indexes = std::move(indexes);
+        _banks = count;
+        _cells = std::move(cells);
+        _tiers = std::move(tiers);
+        _rules = rules.size();
+        std::cout << "[server] compiled " << _rules << " fee rules for " << _banks << " banks" << std::endl;
+        return true;
+    }
+
+    bool FeeSchedule::fee(uint16_t from, uint16_t to, double_t amount, float_t &fee) const {
+        const uint16_t from_index = from < _indexes.size() ? _indexes[from] : no_bank;
+        const uint16_t to_index = to < _indexes.size() ? _indexes[to] : no_bank;
+        if (from_index == no_bank || to_index == no_bank) {
+            return false;
+        }
+
+        // the tier with the highest amount not above the amount, a pair has only a few
+        const std::size_t cell = from_index * _banks + to_index;
+        const Tier *begin = _tiers.data() + _cells[cell];
+        const Tier *end = _tiers.data() + _cells[cell + 1];
+        const Tier *tier = std::upper_bound(begin, end, amount,
+                                            [](double_t value, const Tier &t) { return value < t.amount; });
+        if (tier == begin) {
+            fee = 0;
+            return true;
+        }
+        --tier;
+
+        // charged in whole cents
+        const double_t charge = std::clamp(tier->flat + tier->percent / 100 * amount, tier->minimum,
+                                           std::max(tier->minimum, tier->maximum));
+        fee = static_cast<float_t>(std::round(charge * 100) / 100);
+        return true;
+    }
+
+    std::size_t FeeSchedule::size() const {
+        return _rules;
+    }
+
+} // Server
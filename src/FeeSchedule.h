@@ -0,0 +1,82 @@
+#ifndef BANKING_FEESCHEDULE_H
+#define BANKING_FEESCHEDULE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <sqlite3.h>
+
+namespace Server {
+
+    /*
+     * This is the fee schedule of transactions, compiled from the fee rules so that no fee is read from the database.
+     * A rule applies to transactions from a bank to a bank, either of which may be any bank, from an amount on.
+     * The most specific rules win: from and to bank, then from bank, then to bank, then neither.
+     * Among them the tier with the highest amount not above the transaction amount applies, below the lowest one
+     * nothing is charged. The fee is flat plus percent of the amount, kept between minimum and maximum.
+     * Without any rule the flat fee of the bank in the banks table applies.
+     * Rules that do not name both banks apply only between different banks, like the flat fee of the bank.
+     */
+    class FeeSchedule {
+
+    public:
+
+        /*
+         * This is a row of the fee rules.
+         */
+        struct Rule {
+            int32_t from{-1}; // bank the money leaves, -1 for any
+            int32_t to{-1}; // bank the money goes to, -1 for any
+            double_t amount{}; // lowest amount the rule applies to
+            double_t flat{};
+            double_t percent{}; // 1.5 for 1.5% of the amount
+            double_t minimum{};
+            double_t maximum{}; // 0 for no maximum
+        };
+
+        /*
+         * Loads the fees of the banks and the fee rules from the database and compiles them.
+         * The schedule is left as it was if they can not be loaded.
+         */
+        bool load(sqlite3 *db);
+
+        /*
+         * Compiles the flat fees of the banks, by bank id, and the rules.
+         */
+        bool compile(const std::vector<std::pair<uint16_t, double_t>> &banks, const std::vector<Rule> &rules);
+
+        /*
+         * Sets fee to the fee of a transaction of amount from a bank to a bank.
+         * Returns false if either bank is unknown.
+         */
+        bool fee(uint16_t from, uint16_t to, double_t amount, float_t &fee) const;
+
+        /*
+         * Returns the number of rules compiled.
+         */
+        std::size_t size() const;
+
+    private:
+
+        /*
+         * This is a compiled rule, the fee of transactions from amount on.
+         */
+        struct Tier {
+            double_t amount{};
+            double_t flat{};
+            double_t percent{};
+            double_t minimum{};
+            double_t maximum{};
+        };
+
+        std::vector<uint16_t> _indexes{}; // dense index of every bank id, no_bank for unknown ids
+        std::size_t _banks{}; // number of banks
+        std::vector<uint32_t> _cells{}; // first tier of every pair of banks in _tiers, by from * _banks + to
+        std::vector<Tier> _tiers{}; // tiers of every pair of banks by amount, one pair after the other
+        std::size_t _rules{}; // number of rules compiled
+    };
+
+} // Server
+
+#endif //BANKING_FEESCHEDULE_H
@@ -0,0 +1,375 @@
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <sys/stat.h>
+#include "Generator.h"
+
+namespace Control {
+
+    namespace {
+
+        // rows per transaction
+        constexpr uint64_t batch_rows = 100000;
+
+        // alphabet of tokens and passwords
+        constexpr char alphabet[] = "0123456789"
+                                    "abcdefghijklmnopqrstuvwxyz"
+                                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+        // parts of the generated names, each with the ASCII spelling used in addresses
+        constexpr const char *first_names[][2] = {
+                {"Aylin",  "aylin"},  {"Burak",   "burak"},   {"Deniz",  "deniz"},  {"Elif",   "elif"},
+                {"Emre",   "emre"},   {"Zeynep",  "zeynep"},  {"Can",    "can"},    {"Selin",  "selin"},
+                {"Mert",   "mert"},   {"Ayşe",    "ayse"},    {"Mehmet", "mehmet"}, {"Fatma",  "fatma"},
+                {"Ahmet",  "ahmet"},  {"Gizem",   "gizem"},   {"Oğuz",   "oguz"},   {"Ebru",   "ebru"},
+                {"Kerem",  "kerem"},  {"Derya",   "derya"},   {"Baran",  "baran"},  {"Şule",   "sule"},
+                {"Tolga",  "tolga"},  {"İrem",    "irem"},    {"Umut",   "umut"},   {"Özge",   "ozge"},
+        };
+        constexpr const char *last_names[][2] = {
+                {"Yılmaz", "yilmaz"}, {"Kaya",    "kaya"},    {"Demir",  "demir"},  {"Şahin",  "sahin"},
+                {"Çelik",  "celik"},  {"Yıldız",  "yildiz"},  {"Aydın",  "aydin"},  {"Öztürk", "ozturk"},
+                {"Arslan", "arslan"}, {"Doğan",   "dogan"},   {"Kılıç",  "kilic"},  {"Aslan",  "aslan"},
+                {"Çetin",  "cetin"},  {"Kara",    "kara"},    {"Koç",    "koc"},    {"Kurt",   "kurt"},
+                {"Özdemir", "ozdemir"}, {"Aksoy", "aksoy"},   {"Duman",  "duman"},  {"Karaman", "karaman"},
+        };
+        constexpr const char *domains[] = {"gmail.com", "yahoo.com", "outlook.com", "hotmail.com", "icloud.com"};
+        constexpr const char *bank_names[] = {"Türkiye", "Anadolu", "Akdeniz", "Marmara", "Ege", "Karadeniz",
+                                              "Birleşik", "Vizyon", "İdeal", "Güven", "Hızlı", "Yatırım"};
+        constexpr const char *bank_kinds[] = {"Bankası", "Finans Bankası", "Kalkınma Bankası", "Katılım Bankası",
+                                              "Yatırım Bankası"};
+
+        /*
+         * Draws ranks 1 to n with probability proportional to rank^-exponent, in constant time and memory.
+         * This is the rejection-inversion method of Hörmann and Derflinger, so millions of ranks need no table.
+         */
+        class Zipf {
+
+        public:
+
+            Zipf(uint64_t n, double exponent) : _n(n), _exponent(exponent) {
+                _integral_x1 = _integral(1.5) - 1;
+                _integral_n = _integral(static_cast<double>(n) + 0.5);
+                _s = 2 - _integral_inverse(_integral(2.5) - _h(2));
+            }
+
+            /*
+             * Returns a rank, given a source of uniform random numbers in [0, 1).
+             */
+            template<typename Uniform>
+            uint64_t operator()(Uniform &&uniform) const {
+                while (true) {
+                    const double u = _integral_n + uniform() * (_integral_x1 - _integral_n);
+                    const double x = _integral_inverse(u);
+                    auto k = static_cast<uint64_t>(x + 0.5);
+                    k = std::clamp<uint64_t>(k, 1, _n);
+                    if (static_cast<double>(k) - x <= _s ||
+                        u >= _integral(static_cast<double>(k) + 0.5) - _h(static_cast<double>(k))) {
+                        return k;
+                    }
+                }
+            }
+
+        private:
+            uint64_t _n;
+            double _exponent;
+            double _integral_x1{};
+            double _integral_n{};
+            double _s{};
+
+            double _h(double x) const {
+                return std::exp(-_exponent * std::log(x));
+            }
+
+            double _integral(double x) const {
+                const double log_x = std::log(x);
+                return _helper2((1 - _exponent) * log_x) * log_x;
+            }
+
+            double _integral_inverse(double x) const {
+                const double t = std::max(-1.0, x * (1 - _exponent));
+                return std::exp(_helper1(t) * x);
+            }
+
+            // log1p(x) / x, also near 0
+            static double _helper1(double x) {
+                return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+            }
+
+            // expm1(x) / x, also near 0
+            static double _helper2(double x) {
+                return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+            }
+        };
+
+        /*
+         * Maps ranks 0 to n - 1 onto indexes 0 to n - 1 one to one, so the hottest ranks are spread over the table.
+         */
+        class Permutation {
+
+        public:
+
+            Permutation(uint64_t n, uint64_t offset) : _n(std::max<uint64_t>(n, 1)), _offset(offset % _n) {
+                _multiplier = static_cast<uint64_t>(static_cast<double>(_n) * 0.6180339887) | 1;
+                while (std::gcd(_multiplier, _n) != 1) {
+                    _multiplier += 2;
+                }
+                _multiplier %= _n;
+                if (_multiplier == 0) {
+                    _multiplier = 1;
+                }
+            }
+
+            uint64_t operator()(uint64_t rank) const {
+                return static_cast<uint64_t>(
+                        (static_cast<unsigned __int128>(rank) * _multiplier + _offset) % _n);
+            }
+
+        private:
+            uint64_t _n;
+            uint64_t _offset;
+            uint64_t _multiplier{};
+        };
+
+    } // namespace
+
+    Generator::~Generator() {
+        if (_db != nullptr) {
+            sqlite3_close(_db);
+        }
+    }
+
+    bool Generator::generate(const std::string &path, const GeneratorParameters &parameters) {
+        _parameters = parameters;
+        _parameters.accounts = std::max(_parameters.accounts, _parameters.users);
+        _random.seed(parameters.seed);
+        if (_parameters.banks == 0 || _parameters.banks > UINT16_MAX || _parameters.users == 0 ||
+            !(_parameters.skew > 0)) {
+            std::cout << "[generate] need between 1 and " << UINT16_MAX << " banks, a user and a positive skew"
+                      << std::endl;
+            return false;
+        }
+
+        // never overwrite a database
+        struct stat st{};
+        if (stat(path.c_str(), &st) == 0) {
+            std::cout << "[generate] " << path << " exists already" << std::endl;
+            return false;
+        }
+        if (sqlite3_open_v2(path.c_str(), &_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+            std::cout << "[generate] can not create database " << path << ": " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+
+        // the tables of the shipped database, written without a rollback journal since a failed run is thrown away
+        const char *schema = "PRAGMA journal_mode = OFF;"
+                             "PRAGMA synchronous = OFF;"
+                             "PRAGMA cache_size = -65536;"
+                             "CREATE TABLE banks (id integer not null, name TEXT not null, fee REAL);"
+                             "CREATE TABLE users (id integer not null, citizen integer not null, name TEXT not null, "
+                             "user TEXT not null, pass TEXT not null);"
+                             "CREATE TABLE accounts (iban TEXT not null, user integer not null, bank REAL not null, "
+                             "balance REAL);"
+                             "CREATE TABLE transactions (token TEXT, source TEXT, destination TEXT, amount REAL, "
+                             "fee REAL);";
+        if (!_exec(schema) || !_exec("BEGIN") || !_generate_banks() || !_generate_users() || !_generate_accounts() ||
+            !_generate_transactions() || !_exec("COMMIT") || !_exec("PRAGMA journal_mode = DELETE")) {
+            return false;
+        }
+        std::cout << "[generate] generated " << _parameters.banks << " banks, " << _parameters.users << " users, "
+                  << _parameters.accounts << " accounts and " << _parameters.transactions << " transactions in "
+                  << path << std::endl;
+        return true;
+    }
+
+    double Generator::_uniform() {
+        return static_cast<double>(_random() >> 11) * 0x1.0p-53;
+    }
+
+    uint64_t Generator::_below(uint64_t n) {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(_random()) * n) >> 64);
+    }
+
+    double Generator::_amount(double median, double sigma) {
+
+        // a normal number by the Box-Muller transform, then log-normal around the median
+        const double u = 1 - _uniform();
+        const double normal = std::sqrt(-2 * std::log(u)) * std::cos(2 * M_PI * _uniform());
+        return std::round(median * std::exp(sigma * normal) * 100) / 100;
+    }
+
+    std::string Generator::_iban(uint64_t index) const {
+
+        // 16 digits, one to one with the index but scattered like real account numbers
+        constexpr uint64_t digits = 10000000000000000;
+        const auto number = static_cast<uint64_t>(
+                (static_cast<unsigned __int128>(index) * 3141592653589793 + _parameters.seed * 7919) % digits);
+        std::string iban = std::to_string(number);
+        return "TR" + std::string(16 - iban.size(), '0') + iban;
+    }
+
+    bool Generator::_exec(const char *sql) {
+        char *error = nullptr;
+        if (sqlite3_exec(_db, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+            std::cout << "[generate] can not execute " << sql << ": " << error << std::endl;
+            sqlite3_free(error);
+            return false;
+        }
+        return true;
+    }
+
+    sqlite3_stmt *Generator::_prepare(const char *sql) {
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(_db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[generate] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return nullptr;
+        }
+        return stmt;
+    }
+
+    bool Generator::_insert(sqlite3_stmt *stmt, uint64_t row, const char *table) {
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            std::cout << "[generate] can not insert into " << table << ": " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        sqlite3_reset(stmt);
+        if ((row + 1) % batch_rows == 0) {
+            if (!_exec("COMMIT; BEGIN")) {
+                return false;
+            }
+            if ((row + 1) % (10 * batch_rows) == 0) {
+                std::cout << "[generate] " << row + 1 << " " << table << std::endl;
+            }
+        }
+        return true;
+    }
+
+    bool Generator::_generate_banks() {
+        sqlite3_stmt *stmt = _prepare("INSERT INTO banks (id, name, fee) VALUES (?, ?, ?)");
+        if (stmt == nullptr) {
+            return false;
+        }
+        bool ok = true;
+        for (uint32_t id = 1; id <= _parameters.banks && ok; id++) {
+
+            // every name once before they repeat with a number
+            const uint32_t i = id - 1;
+            std::string name = std::string(bank_names[i % std::size(bank_names)]) + " " +
+                               bank_kinds[i / std::size(bank_names) % std::size(bank_kinds)];
+            if (i >= std::size(bank_names) * std::size(bank_kinds)) {
+                name += " " + std::to_string(i / (std::size(bank_names) * std::size(bank_kinds)) + 1);
+            }
+
+            // the server reads the fee as a float
+            _fees.push_back(static_cast<float>(std::round((1 + _uniform() * 99) * 100) / 100));
+            sqlite3_bind_int(stmt, 1, (int) id);
+            sqlite3_bind_text(stmt, 2, name.data(), (int) name.size(), SQLITE_TRANSIENT);
+            sqlite3_bind_double(stmt, 3, _fees.back());
+            ok = _insert(stmt, id - 1, "banks");
+        }
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+    bool Generator::_generate_users() {
+        sqlite3_stmt *stmt = _prepare("INSERT INTO users (id, citizen, name, user, pass) VALUES (?, ?, ?, ?, ?)");
+        if (stmt == nullptr) {
+            return false;
+        }
+
+        // citizen numbers have 11 digits and are unique, the multiplier shares no factor with their range
+        constexpr uint64_t citizens = 90000000000;
+        bool ok = true;
+        std::string name;
+        std::string user;
+        std::string pass(12, '\0');
+        for (uint64_t id = 1; id <= _parameters.users && ok; id++) {
+            const auto &first = first_names[_below(std::size(first_names))];
+            const auto &last = last_names[_below(std::size(last_names))];
+            name.assign(first[0]).append(" ").append(last[0]);
+            user.assign(first[1]).append(".").append(last[1]).append(std::to_string(id)).append("@")
+                    .append(domains[_below(std::size(domains))]);
+            for (char &c: pass) {
+                c = alphabet[_below(sizeof(alphabet) - 1)];
+            }
+            const auto citizen = static_cast<uint64_t>(
+                    10000000000 + (static_cast<unsigned __int128>(id) * 7777777771 + _parameters.seed) % citizens);
+            sqlite3_bind_int64(stmt, 1, (sqlite3_int64) id);
+            sqlite3_bind_int64(stmt, 2, (sqlite3_int64) citizen);
+            sqlite3_bind_text(stmt, 3, name.data(), (int) name.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 4, user.data(), (int) user.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 5, pass.data(), (int) pass.size(), SQLITE_STATIC);
+            ok = _insert(stmt, id - 1, "users");
+        }
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+    bool Generator::_generate_accounts() {
+        sqlite3_stmt *stmt = _prepare("INSERT INTO accounts (iban, user, bank, balance) VALUES (?, ?, ?, ?)");
+        if (stmt == nullptr) {
+            return false;
+        }
+
+        // large banks hold more accounts than small ones
+        const Zipf bank_sizes(_parameters.banks, 0.8);
+        const Permutation bank_order(_parameters.banks, _parameters.seed);
+        _banks.resize(_parameters.accounts);
+        bool ok = true;
+        for (uint64_t index = 0; index < _parameters.accounts && ok; index++) {
+
+            // every user gets an account, the others go to random users
+            const uint64_t user = index < _parameters.users ? index + 1 : _below(_parameters.users) + 1;
+            _banks[index] = static_cast<uint16_t>(bank_order(bank_sizes([this] { return _uniform(); }) - 1) + 1);
+            const std::string iban = _iban(index);
+            sqlite3_bind_text(stmt, 1, iban.data(), (int) iban.size(), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 2, (sqlite3_int64) user);
+            sqlite3_bind_double(stmt, 3, _banks[index]);
+            sqlite3_bind_double(stmt, 4, _amount(5000, 1.5));
+            ok = _insert(stmt, index, "accounts");
+        }
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+    bool Generator::_generate_transactions() {
+        sqlite3_stmt *stmt = _prepare(
+                "INSERT INTO transactions (token, source, destination, amount, fee) VALUES (?, ?, ?, ?, ?)");
+        if (stmt == nullptr) {
+            return false;
+        }
+
+        // hot accounts send and receive most transactions, the ones receiving are mostly not the ones sending
+        const uint64_t accounts = _parameters.accounts;
+        const Zipf activity(accounts, _parameters.skew);
+        const Permutation senders(accounts, _parameters.seed);
+        const Permutation receivers(accounts, _parameters.seed * 31 + accounts / 2);
+        auto uniform = [this] { return _uniform(); };
+        bool ok = accounts > 1 || _parameters.transactions == 0;
+        std::string token(32, '\0');
+        for (uint64_t row = 0; row < _parameters.transactions && ok; row++) {
+            const uint64_t source = senders(activity(uniform) - 1);
+            uint64_t destination = _uniform() < 0.7 ? receivers(activity(uniform) - 1) : _below(accounts);
+            if (destination == source) {
+                destination = (destination + 1) % accounts;
+            }
+
+            // the fee of the bank of the source, charged when the money leaves the bank
+            const double fee = _banks[source] != _banks[destination] ? _fees[_banks[source] - 1] : 0;
+            for (char &c: token) {
+                c = alphabet[_below(sizeof(alphabet) - 1)];
+            }
+            const std::string from = _iban(source);
+            const std::string to = _iban(destination);
+            sqlite3_bind_text(stmt, 1, token.data(), (int) token.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 2, from.data(), (int) from.size(), SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 3, to.data(), (int) to.size(), SQLITE_STATIC);
+            sqlite3_bind_double(stmt, 4, _amount(200, 1.2));
+            sqlite3_bind_double(stmt, 5, fee);
+            ok = _insert(stmt, row, "transactions");
+        }
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+} // Control
@@ -0,0 +1,110 @@
+#ifndef BANKING_GENERATOR_H
+#define BANKING_GENERATOR_H
+
+#include <string>
+#include <random>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <sqlite3.h>
+
+namespace Control {
+
+    /*
+     * This is how much synthetic data to generate, and how skewed it is.
+     */
+    struct GeneratorParameters {
+        uint32_t banks{10};
+        uint64_t users{1000000};
+        uint64_t accounts{2500000}; // at least one per user, the rest spread evenly over the users
+        uint64_t transactions{10000000};
+        double skew{1.1}; // Zipf exponent of how often accounts send and receive transactions
+        uint64_t seed{1}; // the same seed and parameters give the same database
+    };
+
+    /*
+     * This is the generator class, filling a new database with synthetic banks, users, accounts and transactions.
+     * A few hot accounts take part in most transactions, ranked by a Zipf distribution, like in production.
+     * All randomness comes from a single seeded engine, converted without the standard distributions, whose
+     * results differ between standard libraries.
+     */
+    class Generator {
+
+    public:
+
+        /*
+         * Closes the database.
+         */
+        ~Generator();
+
+        /*
+         * Creates the database at path, which must not exist yet, and fills it.
+         */
+        bool generate(const std::string &path, const GeneratorParameters &parameters);
+
+    private:
+        sqlite3 *_db{}; // the database being generated
+        std::mt19937_64 _random; // source of all randomness
+        GeneratorParameters _parameters{}; // what to generate
+        std::vector<float> _fees{}; // fee of every bank, by id - 1
+        std::vector<uint16_t> _banks{}; // bank of every account, by index
+
+        /*
+         * Returns a uniform random number in [0, 1).
+         */
+        double _uniform();
+
+        /*
+         * Returns a uniform random number below n.
+         */
+        uint64_t _below(uint64_t n);
+
+        /*
+         * Returns a random amount in cents, log-normally distributed around median.
+         */
+        double _amount(double median, double sigma);
+
+        /*
+         * Returns the IBAN of the account with the index.
+         */
+        std::string _iban(uint64_t index) const;
+
+        /*
+         * Runs statements that return no rows.
+         */
+        bool _exec(const char *sql);
+
+        /*
+         * Prepares a statement, or returns nullptr.
+         */
+        sqlite3_stmt *_prepare(const char *sql);
+
+        /*
+         * Steps an insert and resets it, committing every so many rows.
+         */
+        bool _insert(sqlite3_stmt *stmt, uint64_t row, const char *table);
+
+        /*
+         * Generates the banks.
+         */
+        bool _generate_banks();
+
+        /*
+         * Generates the users.
+         */
+        bool _generate_users();
+
+        /*
+         * Generates the accounts.
+         */
+        bool _generate_accounts();
+
+        /*
+         * Generates the transactions.
+         */
+        bool _generate_transactions();
+    };
+
+} // Control
+
+#endif //BANKING_GENERATOR_H
@@ -0,0 +1,60 @@
+#include "IdempotencyCache.h"
+
+namespace Server {
+
+    IdempotencyCache::IdempotencyCache(std::size_t capacity, uint64_t window)
+            : _capacity(capacity), _window(window) {
+        _entries.reserve(capacity);
+    }
+
+    const IdempotentResponse *IdempotencyCache::find(JOURNAL_RECORD_TYPE type, uint32_t user, const Token &key) const {
+        auto it = _entries.find(Key{type, user, key});
+        return it == _entries.end() ? nullptr : &it->second.response;
+    }
+
+    void IdempotencyCache::insert(const JournalRecord &record) {
+        if (record.key.empty()) {
+            return;
+        }
+
+        // make room for the entry
+        while (_entries.size() >= _capacity && !_order.empty()) {
+            _pop();
+        }
+
+        // cache the response
+        Key key{idempotency_type(record.type), record.user, record.key};
+        Entry &entry = _entries[key];
+        entry.response.token = record.token;
+        entry.response.fee = record.fee;
+        entry.response.balance = record.balance;
+        entry.time = record.time;
+        _order.emplace_back(record.time, key);
+    }
+
+    void IdempotencyCache::expire(uint64_t now) {
+        while (!_order.empty() && _order.front().first + _window < now) {
+            _pop();
+        }
+    }
+
+    uint64_t IdempotencyCache::window() const {
+        return _window;
+    }
+
+    std::size_t IdempotencyCache::size() const {
+        return _entries.size();
+    }
+
+    void IdempotencyCache::_pop() {
+
+        // an entry cached again later has a newer time and stays
+        auto &[time, key] = _order.front();
+        auto it = _entries.find(key);
+        if (it != _entries.end() && it->second.time == time) {
+            _entries.erase(it);
+        }
+        _order.pop_front();
+    }
+
+} // Server
@@ -0,0 +1,100 @@
+#ifndef BANKING_IDEMPOTENCYCACHE_H
+#define BANKING_IDEMPOTENCYCACHE_H
+
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include "Messages.h"
+#include "Journal.h"
+
+namespace Server {
+
+    /*
+     * This is the part of a response that has to be repeated when a request is retried with the same key.
+     */
+    struct IdempotentResponse {
+        Token token{}; // token of the transaction
+        float_t fee{}; // fee of the transaction
+        double_t balance{}; // balance of the account after adding balance
+    };
+
+    /*
+     * This is a bounded cache of the responses to the recent requests that carried an idempotency key.
+     * Keys are scoped by user and request type.
+     * Entries leave the cache once they are older than the window, or oldest first once it holds capacity entries.
+     */
+    class IdempotencyCache {
+
+    public:
+
+        /*
+         * Creates a cache of at most capacity entries, kept for window milliseconds.
+         */
+        IdempotencyCache(std::size_t capacity, uint64_t window);
+
+        /*
+         * Returns the response to the request of the user with the key, or nullptr if it is not cached.
+         */
+        const IdempotentResponse *find(JOURNAL_RECORD_TYPE type, uint32_t user, const Token &key) const;
+
+        /*
+         * Caches the response to the journaled request, if it carried a key.
+         */
+        void insert(const JournalRecord &record);
+
+        /*
+         * Drops the entries that are older than the window at the system time now.
+         */
+        void expire(uint64_t now);
+
+        /*
+         * Returns the window in milliseconds.
+         */
+        uint64_t window() const;
+
+        /*
+         * Returns the number of cached responses.
+         */
+        std::size_t size() const;
+
+    private:
+
+        /*
+         * This identifies a request by its type, its user and its key.
+         */
+        struct Key {
+            JOURNAL_RECORD_TYPE type{};
+            uint32_t user{};
+            Token key{};
+
+            bool operator==(const Key &other) const {
+                return type == other.type && user == other.user && key == other.key;
+            }
+        };
+
+        struct KeyHash {
+            std::size_t operator()(const Key &key) const {
+                return std::hash<Token>{}(key.key) ^ (static_cast<std::size_t>(key.user) << 8 | (std::size_t) key.type);
+            }
+        };
+
+        struct Entry {
+            IdempotentResponse response{};
+            uint64_t time{}; // system time of the request in milliseconds
+        };
+
+        std::size_t _capacity; // maximum number of entries
+        uint64_t _window; // milliseconds an entry is kept
+        std::unordered_map<Key, Entry, KeyHash> _entries{}; // responses by request
+        std::deque<std::pair<uint64_t, Key>> _order{}; // requests in the order they were cached, with their time
+
+        /*
+         * Drops the oldest entry.
+         */
+        void _pop();
+    };
+
+} // Server
+
+#endif //BANKING_IDEMPOTENCYCACHE_H
@@ -0,0 +1,251 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Journal.h"
+#include "Tools.h"
+
+namespace Server {
+
+    namespace {
+
+        // the journal file grows in steps of this many bytes
+        constexpr std::size_t journal_chunk = 16 << 20;
+
+        // checksum of a record, covering everything but the checksum itself
+        uint32_t journal_crc(const char *record) {
+            return Tools::Tools::crc32c(record + sizeof(uint32_t), sizeof(JournalRecord) - sizeof(uint32_t));
+        }
+
+    } // namespace
+
+    Journal::~Journal() {
+        close();
+    }
+
+    bool Journal::open(const std::string &path, uint64_t sequence) {
+        close();
+        _path = path;
+
+        // open the journal file
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (_fd < 0) {
+            std::cout << "[server] can not open journal " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st{};
+        if (fstat(_fd, &st) != 0) {
+            std::cout << "[server] can not stat journal " << path << ": " << std::strerror(errno) << std::endl;
+            close();
+            return false;
+        }
+
+        // map the whole file, rounded up to the next chunk
+        const auto file_size = static_cast<std::size_t>(st.st_size);
+        if (!_grow(std::max(journal_chunk, (file_size + journal_chunk - 1) / journal_chunk * journal_chunk))) {
+            close();
+            return false;
+        }
+
+        // accept records as long as they are intact and numbered consecutively
+        _size = 0;
+        while (_size + sizeof(JournalRecord) <= file_size) {
+            const char *data = _map + _size;
+            JournalRecord record;
+            std::memcpy(&record, data, sizeof(record));
+            if (record.crc != journal_crc(data) || (_size > 0 && record.sequence != _sequence + 1)) {
+                break;
+            }
+            if (_size == 0) {
+                _first = record.sequence;
+            }
+            _sequence = record.sequence;
+            _size += sizeof(JournalRecord);
+        }
+        if (_size < file_size) {
+            std::cout << "[server] discarded " << file_size - _size << " bytes of torn journal tail" << std::endl;
+        }
+
+        // a journal that ends before the requested sequence has been superseded, start over after it
+        if (_size == 0 || _sequence < sequence) {
+            if (_size > 0) {
+                std::cout << "[server] journal ends at " << _sequence << ", restarting it after " << sequence
+                          << std::endl;
+            }
+            _size = 0;
+            _first = sequence + 1;
+            _sequence = sequence;
+        }
+
+        std::cout << "[server] opened journal " << path << " at sequence " << _sequence << std::endl;
+        return true;
+    }
+
+    void Journal::close() {
+        if (_map != nullptr) {
+            munmap(_map, _capacity);
+            _map = nullptr;
+
+            // drop the preallocated space past the last record
+            if (ftruncate(_fd, static_cast<off_t>(_size)) != 0) {
+                std::cout << "[server] can not truncate journal: " << std::strerror(errno) << std::endl;
+            }
+        }
+        if (_fd >= 0) {
+            ::close(_fd);
+            _fd = -1;
+        }
+        _capacity = 0;
+    }
+
+    uint64_t Journal::append(JournalRecord &record) {
+
+        // number and timestamp the record
+        record.sequence = _sequence + 1;
+        record.time = Tools::Tools::system_time();
+        return _write(&record, 1);
+    }
+
+    uint64_t Journal::append(JournalRecord *records, std::size_t count) {
+
+        // number and timestamp the records
+        const uint64_t time = Tools::Tools::system_time();
+        for (std::size_t i = 0; i < count; i++) {
+            records[i].sequence = _sequence + 1 + i;
+            records[i].time = time;
+        }
+        return _write(records, count);
+    }
+
+    uint64_t Journal::replicate(const JournalRecord &record) {
+        if (record.crc != journal_crc(reinterpret_cast<const char *>(&record)) || record.sequence != _sequence + 1) {
+            return 0;
+        }
+        JournalRecord copy = record;
+        return _write(&copy, 1);
+    }
+
+    uint64_t Journal::_write(JournalRecord *records, std::size_t count) {
+        if (_map == nullptr || count == 0) {
+            return 0;
+        }
+
+        // make room for the records
+        const std::size_t size = count * sizeof(JournalRecord);
+        while (_size + size > _capacity) {
+            if (!_grow(_capacity + journal_chunk)) {
+                return 0;
+            }
+        }
+
+        // write the records together with their checksums
+        for (std::size_t i = 0; i < count; i++) {
+            char *data = _map + _size + i * sizeof(JournalRecord);
+            std::memcpy(data, &records[i], sizeof(JournalRecord));
+            records[i].crc = journal_crc(data);
+            std::memcpy(data, &records[i].crc, sizeof(records[i].crc));
+        }
+
+        // flush the pages holding the records
+        static const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const std::size_t begin = _size / page_size * page_size;
+        if (msync(_map + begin, _size + size - begin, MS_SYNC) != 0) {
+            std::cout << "[server] can not flush journal: " << std::strerror(errno) << std::endl;
+            return 0;
+        }
+
+        _size += size;
+        _sequence = records[count - 1].sequence;
+        return _sequence;
+    }
+
+    const JournalRecord *Journal::record(uint64_t sequence) const {
+        if (sequence < _first || sequence > _sequence) {
+            return nullptr;
+        }
+        return reinterpret_cast<const JournalRecord *>(_map + (sequence - _first) * sizeof(JournalRecord));
+    }
+
+    uint64_t Journal::sequence() const {
+        return _sequence;
+    }
+
+    uint64_t Journal::first() const {
+        return _first;
+    }
+
+    bool Journal::compact(uint64_t sequence) {
+        sequence = std::min(sequence, _sequence);
+        if (_map == nullptr || sequence < _first) {
+            return true;
+        }
+
+        // write the records to keep to a temporary file first
+        const std::string temporary = _path + ".tmp";
+        const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cout << "[server] can not create journal " << temporary << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        const char *data = _map + (sequence + 1 - _first) * sizeof(JournalRecord);
+        std::size_t size = (_sequence - sequence) * sizeof(JournalRecord);
+        bool written = true;
+        while (written && size > 0) {
+            const ssize_t count = ::write(fd, data, size);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            written = count > 0;
+            data += written ? count : 0;
+            size -= written ? count : 0;
+        }
+        written = written && fsync(fd) == 0;
+        ::close(fd);
+        if (!written) {
+            std::cout << "[server] can not write journal " << temporary << ": " << std::strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+
+        // then replace the journal in one step, and map the new one
+        if (rename(temporary.c_str(), _path.c_str()) != 0) {
+            std::cout << "[server] can not rename journal " << temporary << ": " << std::strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+        const std::string path = _path;
+        const uint64_t last = _sequence;
+        close();
+        if (!open(path, last)) {
+            return false;
+        }
+        std::cout << "[server] compacted journal up to sequence " << sequence << std::endl;
+        return true;
+    }
+
+    bool Journal::_grow(std::size_t capacity) {
+
+        // extend the file and make sure its new size survives a crash
+        if (ftruncate(_fd, static_cast<off_t>(capacity)) != 0 || fsync(_fd) != 0) {
+            std::cout << "[server] can not grow journal: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        // extend the mapping
+        void *map = _map == nullptr
+                    ? mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0)
+                    : mremap(_map, _capacity, capacity, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            std::cout << "[server] can not map journal: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        _map = static_cast<char *>(map);
+        _capacity = capacity;
+        return true;
+    }
+
+} // Server
@@ -0,0 +1,178 @@
+#ifndef BANKING_JOURNAL_H
+#define BANKING_JOURNAL_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include "Messages.h"
+
+namespace Server {
+
+    /*
+     * This is a list of all the balance mutations that can be journaled.
+     */
+    enum class JOURNAL_RECORD_TYPE : uint8_t {
+        NONE = 0,
+        ADD_BALANCE = 1,
+        TRANSACTION = 2,
+        TRANSFER_OUT = 3,
+        TRANSFER_IN = 4,
+        TRANSFER_DONE = 5,
+        INTEREST = 6,
+        FEE = 7,
+        BATCH = 8,
+        ORDER = 9,
+        ORDER_DELETE = 10,
+    };
+
+    /*
+     * This is one balance mutation as it is stored in the journal.
+     * ADD_BALANCE adds amount to the to account of user in bank.
+     * TRANSACTION moves amount plus fee out of the from account of user in bank and amount into the to account.
+     * TRANSFER_OUT takes amount plus fee out of the from account like a TRANSACTION, the to account is on another
+     * shard.
+     * TRANSFER_IN adds amount to the to account, sent by the shard that journaled the TRANSFER_OUT with the token.
+     * TRANSFER_DONE marks the TRANSFER_OUT with the token as credited by the other shard.
+     * INTEREST adds the end-of-day interest amount to the to account.
+     * FEE takes the end-of-day maintenance fee out of the from account, its amount is 0.
+     * BATCH marks the end-of-day batch of day, covering days, as posted up to account position, or finished if position
+     * is batch_done. It moves no money, and its money fields stay 0.
+     * ORDER registers the standing order with the token of user in bank, transferring amount from the from account to
+     * the to account next at due, then every period days, or every -period months if period is negative.
+     * The transfers of a monthly ORDER fall on day of the month, or on the last day of the months shorter than that.
+     * An ORDER replaces the earlier one with the token. Its balance and fee stay 0.
+     * ORDER_DELETE removes the standing order with the token.
+     * The key is the idempotency key of the request, if it had one.
+     */
+    struct JournalRecord {
+        uint32_t crc{}; // CRC32C of the rest of the record
+        uint32_t user{};
+        uint64_t sequence{}; // position of the record in the journal, starting from 1
+        uint64_t time{}; // system time of the mutation in milliseconds
+        double_t amount{};
+        double_t balance{}; // balance of the account paid from, or added to, after the mutation
+        float_t fee{};
+        uint16_t bank{};
+        JOURNAL_RECORD_TYPE type{JOURNAL_RECORD_TYPE::NONE};
+        Token token{};
+        Token key{};
+        IBAN from{};
+        IBAN to{};
+        uint32_t day{}; // day of a BATCH, in days since the epoch, or day of the month of a monthly ORDER
+        uint32_t days{}; // days a BATCH covers
+        uint32_t position{}; // account a BATCH is posted up to, batch_done once its day is finished
+        float_t period{}; // days between the transfers of an ORDER, or months if negative, 0 for a single transfer
+        uint64_t due{}; // system time of the next transfer of an ORDER in milliseconds
+    };
+    static_assert(std::is_trivially_copyable_v<JournalRecord>, "JournalRecord is written to disk as is");
+
+    /*
+     * This is the position of a BATCH record whose day is finished.
+     */
+    constexpr uint32_t batch_done = UINT32_MAX;
+
+    /*
+     * Returns the record type the idempotent response of a record of type is kept under.
+     * A transaction to another shard answers retries of the transaction, and a cancellation the ones of the order.
+     */
+    constexpr JOURNAL_RECORD_TYPE idempotency_type(JOURNAL_RECORD_TYPE type) {
+        switch (type) {
+            case JOURNAL_RECORD_TYPE::TRANSFER_OUT:
+                return JOURNAL_RECORD_TYPE::TRANSACTION;
+            case JOURNAL_RECORD_TYPE::ORDER_DELETE:
+                return JOURNAL_RECORD_TYPE::ORDER;
+            default:
+                return type;
+        }
+    }
+
+    /*
+     * This is the append-only journal of balance mutations, the durable record of the ledger.
+     * Records have a fixed size and are appended to a memory-mapped file, then flushed to disk before append returns.
+     * A torn or corrupt tail, detected by its checksum, is discarded when the journal is opened.
+     */
+    class Journal {
+
+    public:
+
+        /*
+         * Closes the journal.
+         */
+        ~Journal();
+
+        /*
+         * Opens or creates the journal at path.
+         * If the journal holds no record after sequence, numbering continues from sequence.
+         */
+        bool open(const std::string &path, uint64_t sequence);
+
+        /*
+         * Closes the journal.
+         */
+        void close();
+
+        /*
+         * Numbers, timestamps and checksums the record, then appends it durably.
+         * Returns the sequence of the record, or 0 if it could not be written.
+         */
+        uint64_t append(JournalRecord &record);
+
+        /*
+         * Numbers, timestamps and checksums count records, then appends them durably with a single flush.
+         * Returns the sequence of the last record, or 0 if they could not be written.
+         */
+        uint64_t append(JournalRecord *records, std::size_t count);
+
+        /*
+         * Appends a record journaled elsewhere, keeping its sequence and time.
+         * Returns the sequence of the record, or 0 if it is corrupt, does not follow the last record or could not be
+         * written.
+         */
+        uint64_t replicate(const JournalRecord &record);
+
+        /*
+         * Returns the record with the sequence, or nullptr if the journal does not hold it.
+         */
+        const JournalRecord *record(uint64_t sequence) const;
+
+        /*
+         * Returns the sequence of the last record, 0 if nothing was ever journaled.
+         */
+        uint64_t sequence() const;
+
+        /*
+         * Returns the sequence of the first record the journal holds.
+         */
+        uint64_t first() const;
+
+        /*
+         * Drops the records up to sequence, which must be in the database and in the latest snapshot already.
+         * The records after it are written to a new file replacing the journal, numbering goes on as before.
+         * A backup further behind than sequence can no longer be sent the records it missed.
+         */
+        bool compact(uint64_t sequence);
+
+    private:
+        std::string _path{}; // path of the journal file
+        int _fd{-1}; // journal file
+        char *_map{}; // mapping of the journal file
+        std::size_t _capacity{}; // size of the journal file and its mapping
+        std::size_t _size{}; // bytes of the journal file holding records
+        uint64_t _first{1}; // sequence of the first record in the file
+        uint64_t _sequence{}; // sequence of the last record
+
+        /*
+         * Checksums count numbered records and appends them durably.
+         */
+        uint64_t _write(JournalRecord *records, std::size_t count);
+
+        /*
+         * Grows the journal file and its mapping to at least capacity bytes.
+         */
+        bool _grow(std::size_t capacity);
+    };
+
+} // Server
+
+#endif //BANKING_JOURNAL_H
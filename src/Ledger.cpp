@@ -0,0 +1,181 @@
+#include <iostream>
+#include <algorithm>
+#include "Ledger.h"
+
+namespace Server {
+
+    bool Ledger::load(sqlite3 *db, uint64_t sequence) {
+        _accounts.clear();
+
+        // load the accounts
+        sqlite3_stmt *stmt;
+        std::string sql = "SELECT iban, user, bank, balance FROM accounts";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            LedgerAccount account{};
+            account.iban = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+            account.user = sqlite3_column_int(stmt, 1);
+            account.bank = sqlite3_column_int(stmt, 2);
+            account.balance = sqlite3_column_double(stmt, 3);
+            _accounts.push_back(account);
+        }
+        sqlite3_finalize(stmt);
+
+        _sequence = sequence;
+        _index();
+        std::cout << "[server] loaded " << _accounts.size() << " accounts from database" << std::endl;
+        return true;
+    }
+
+    void Ledger::assign(const LedgerAccount *accounts, std::size_t count, uint64_t sequence) {
+        _accounts.assign(accounts, accounts + count);
+        _sequence = sequence;
+        _index();
+    }
+
+    void Ledger::retain(const std::function<bool(const LedgerAccount &)> &keep) {
+        _accounts.erase(std::remove_if(_accounts.begin(), _accounts.end(),
+                                       [&keep](const LedgerAccount &account) { return !keep(account); }),
+                        _accounts.end());
+        _index();
+    }
+
+    const LedgerAccount *Ledger::find(const IBAN &iban) const {
+        auto it = _ibans.find(iban);
+        return it == _ibans.end() ? nullptr : &_accounts[it->second];
+    }
+
+    const std::vector<uint32_t> &Ledger::user_accounts(uint32_t user) const {
+        static const std::vector<uint32_t> none;
+        auto it = _users.find(user);
+        return it == _users.end() ? none : it->second;
+    }
+
+    const std::vector<LedgerAccount> &Ledger::accounts() const {
+        return _accounts;
+    }
+
+    void Ledger::apply(const JournalRecord &record) {
+        auto to = _ibans.find(record.to);
+        if (record.type == JOURNAL_RECORD_TYPE::TRANSACTION || record.type == JOURNAL_RECORD_TYPE::TRANSFER_OUT ||
+            record.type == JOURNAL_RECORD_TYPE::FEE) {
+            auto from = _ibans.find(record.from);
+            const bool credited = to != _ibans.end() && record.type == JOURNAL_RECORD_TYPE::TRANSACTION;
+
+            // both sides first, so that an account on both sides gets one version of its net balance
+            if (from != _ibans.end()) {
+                _accounts[from->second].balance -= record.amount + record.fee;
+            }
+            if (credited) {
+                _accounts[to->second].balance += record.amount;
+            }
+            if (from != _ibans.end()) {
+                _store.set(from->second, _accounts[from->second].balance);
+                _version(from->second, record.sequence);
+            }
+            if (credited && (from == _ibans.end() || from->second != to->second)) {
+                _store.set(to->second, _accounts[to->second].balance);
+                _version(to->second, record.sequence);
+            }
+        } else if (record.type == JOURNAL_RECORD_TYPE::ADD_BALANCE || record.type == JOURNAL_RECORD_TYPE::TRANSFER_IN ||
+                   record.type == JOURNAL_RECORD_TYPE::INTEREST) {
+            if (to != _ibans.end()) {
+                _accounts[to->second].balance += record.amount;
+                _store.set(to->second, _accounts[to->second].balance);
+                _version(to->second, record.sequence);
+            }
+        }
+        _sequence = record.sequence;
+
+        // the readers see the record once all of its versions are written
+        _visible.store(record.sequence, std::memory_order_release);
+    }
+
+    const AccountStore &Ledger::store() const {
+        return _store;
+    }
+
+    uint64_t Ledger::sequence() const {
+        return _sequence;
+    }
+
+    template<typename Index>
+    uint64_t Ledger::_read(Index index, std::size_t count, double_t *balances) const {
+        while (true) {
+            const uint64_t visible = _visible.load(std::memory_order_acquire);
+
+            // the newest version of every account that is not newer than the record visible
+            bool complete = true;
+            for (std::size_t i = 0; i < count && complete; i++) {
+                const Versions &versions = _versions[index(i)];
+                uint64_t written;
+                do {
+                    written = versions.written.load(std::memory_order_acquire);
+                    uint64_t newest = 0;
+                    complete = false;
+                    for (const Version &version: versions.versions) {
+                        const uint64_t sequence = version.sequence.load(std::memory_order_acquire);
+                        const double_t balance = version.balance.load(std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        if (sequence == busy || sequence > visible || sequence < newest ||
+                            version.sequence.load(std::memory_order_relaxed) != sequence) {
+                            continue;
+                        }
+                        newest = sequence;
+                        balances[i] = balance;
+                        complete = true;
+                    }
+                } while (versions.written.load(std::memory_order_acquire) - written >= 2);
+            }
+
+            // an account changed so often that its versions are all newer, read again as of a later record
+            if (complete) {
+                return visible;
+            }
+        }
+    }
+
+    uint64_t Ledger::read(const uint32_t *indexes, std::size_t count, double_t *balances) const {
+        return _read([indexes](std::size_t i) { return indexes[i]; }, count, balances);
+    }
+
+    uint64_t Ledger::read(double_t *balances) const {
+        return _read([](std::size_t i) { return i; }, _accounts.size(), balances);
+    }
+
+    void Ledger::_version(uint32_t index, uint64_t sequence) {
+        Versions &versions = _versions[index];
+        const uint64_t written = versions.written.load(std::memory_order_relaxed) + 1;
+        Version &version = versions.versions[written % versions.versions.size()];
+        version.sequence.store(busy, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        version.balance.store(_accounts[index].balance, std::memory_order_relaxed);
+        version.sequence.store(sequence, std::memory_order_release);
+        versions.written.store(written, std::memory_order_release);
+    }
+
+    void Ledger::_index() {
+        _ibans.clear();
+        _users.clear();
+        _ibans.reserve(_accounts.size());
+        for (uint32_t i = 0; i < _accounts.size(); i++) {
+            _ibans[_accounts[i].iban] = i;
+            _users[_accounts[i].user].push_back(i);
+        }
+        _store.assign(_accounts);
+
+        // every version starts as the balance the accounts were loaded with
+        _versions = std::make_unique<Versions[]>(_accounts.size());
+        for (uint32_t i = 0; i < _accounts.size(); i++) {
+            for (Version &version: _versions[i].versions) {
+                version.sequence.store(_sequence, std::memory_order_relaxed);
+                version.balance.store(_accounts[i].balance, std::memory_order_relaxed);
+            }
+        }
+        _visible.store(_sequence, std::memory_order_release);
+    }
+
+} // Server
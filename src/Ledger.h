@@ -0,0 +1,152 @@
+#ifndef BANKING_LEDGER_H
+#define BANKING_LEDGER_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <type_traits>
+#include <sqlite3.h>
+#include "Messages.h"
+#include "Journal.h"
+#include "AccountStore.h"
+
+namespace Server {
+
+    /*
+     * This is an account as held by the ledger.
+     */
+    struct LedgerAccount {
+        IBAN iban{};
+        uint32_t user{};
+        uint16_t bank{};
+        double_t balance{};
+    };
+    static_assert(std::is_trivially_copyable_v<LedgerAccount>, "LedgerAccount is written to snapshots as is");
+
+    /*
+     * This is the in-memory ledger of all accounts, the state the journal records are applied to.
+     * Requests read balances from here, the database only catches up with the journal in the background.
+     * Threads other than the one applying the records read the balances through versions, like a database does with
+     * multiversion concurrency control: every account keeps its latest balances, each tagged with the journal record
+     * that made it, and a reader takes the newest version of every account that is not newer than the last record
+     * applied when it started. Both sides of a transaction are one record, so a reader sees both or neither.
+     * Neither side takes a lock, a reader only reads again when the writer got ahead of it.
+     */
+    class Ledger {
+
+    public:
+
+        /*
+         * Loads all accounts from the database, which must be up to date with the journal until sequence.
+         */
+        bool load(sqlite3 *db, uint64_t sequence);
+
+        /*
+         * Replaces all accounts, as they were after the journal record sequence.
+         */
+        void assign(const LedgerAccount *accounts, std::size_t count, uint64_t sequence);
+
+        /*
+         * Keeps only the accounts keep returns true for.
+         */
+        void retain(const std::function<bool(const LedgerAccount &)> &keep);
+
+        /*
+         * Returns the account with the IBAN or nullptr if there is none.
+         */
+        const LedgerAccount *find(const IBAN &iban) const;
+
+        /*
+         * Returns the indexes in accounts() of the accounts of the user.
+         */
+        const std::vector<uint32_t> &user_accounts(uint32_t user) const;
+
+        /*
+         * Returns all accounts.
+         */
+        const std::vector<LedgerAccount> &accounts() const;
+
+        /*
+         * Returns the columnar copy of the accounts, for bulk aggregations.
+         */
+        const AccountStore &store() const;
+
+        /*
+         * Applies a journal record to the balances.
+         */
+        void apply(const JournalRecord &record);
+
+        /*
+         * Returns the sequence of the last journal record applied.
+         */
+        uint64_t sequence() const;
+
+        /*
+         * Reads the balances of the count accounts at the indexes into balances, all as they were after the same
+         * journal record, on any thread and while records are applied.
+         * Returns the sequence of that record, the last one applied when the read started, or a later one if an
+         * account changed more often than its versions can hold while it was read.
+         * The accounts must not be replaced by load, assign or retain while reads run.
+         */
+        uint64_t read(const uint32_t *indexes, std::size_t count, double_t *balances) const;
+
+        /*
+         * Reads the balances of all accounts into balances in the order of accounts(), like read.
+         */
+        uint64_t read(double_t *balances) const;
+
+    private:
+
+        /*
+         * This is a balance of an account as of a journal record.
+         * The sequence is busy while the balance is written, a reader seeing it change reads the version again.
+         */
+        struct Version {
+            std::atomic<uint64_t> sequence{}; // journal record that made the balance
+            std::atomic<double_t> balance{}; // the balance
+        };
+
+        /*
+         * These are the latest versions of an account, overwritten oldest first.
+         * A reader scans them again if two were written while it scanned, the one it needed may have been overwritten.
+         */
+        struct Versions {
+            std::array<Version, 4> versions{}; // the versions, by slot
+            std::atomic<uint64_t> written{}; // number of versions written, the latest is in slot written modulo 4
+        };
+
+        static constexpr uint64_t busy = UINT64_MAX; // sequence of a version being written
+
+        std::vector<LedgerAccount> _accounts{}; // all accounts
+        std::unordered_map<IBAN, uint32_t> _ibans{}; // account indexes by IBAN
+        std::unordered_map<uint32_t, std::vector<uint32_t>> _users{}; // account indexes by user id
+        AccountStore _store{}; // columnar copy of the accounts
+        uint64_t _sequence{}; // last journal record applied
+        std::unique_ptr<Versions[]> _versions{}; // latest versions of the balances, by account index
+        std::atomic<uint64_t> _visible{}; // last journal record whose versions are all written
+
+        /*
+         * Reads the balances of the count accounts whose indexes index returns for 0 to count - 1, like read.
+         */
+        template<typename Index>
+        uint64_t _read(Index index, std::size_t count, double_t *balances) const;
+
+        /*
+         * Writes the balance of the account at index as a new version made by the journal record sequence.
+         */
+        void _version(uint32_t index, uint64_t sequence);
+
+        /*
+         * Rebuilds the indexes after the accounts were replaced.
+         */
+        void _index();
+    };
+
+} // Server
+
+#endif //BANKING_LEDGER_H
@@ -1,8 +1,199 @@
 #ifndef BANKING_MESSAGES_H
 #define BANKING_MESSAGES_H
 
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <cstring>
 #include <msgpack.hpp>
 
+/*
+ * This is a fixed capacity string stored inline in the message, used for tokens and IBANs.
+ * Unused bytes are kept zero so that two strings can be compared over the whole capacity in constant time.
+ * Strings longer than the capacity are truncated.
+ */
+template<std::size_t N>
+class FixedString {
+    static_assert(N <= UINT8_MAX, "FixedString length must fit in a byte");
+
+public:
+    FixedString() = default;
+
+    FixedString(const char *str) { assign(str, std::strlen(str)); }
+
+    FixedString(const std::string &str) { assign(str.data(), str.size()); }
+
+    FixedString(std::string_view str) { assign(str.data(), str.size()); }
+
+    void assign(const char *str, std::size_t size) {
+        _size = static_cast<uint8_t>(std::min(size, N));
+        std::memcpy(_data.data(), str, _size);
+        std::memset(_data.data() + _size, 0, N - _size);
+    }
+
+    void resize(std::size_t size) {
+        size = std::min(size, N);
+        if (size < _size) {
+            std::memset(_data.data() + size, 0, _size - size);
+        }
+        _size = static_cast<uint8_t>(size);
+    }
+
+    static constexpr std::size_t capacity() { return N; }
+
+    std::size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    char *data() { return _data.data(); }
+
+    const char *data() const { return _data.data(); }
+
+    std::string_view view() const { return {_data.data(), _size}; }
+
+    std::string str() const { return {_data.data(), _size}; }
+
+    /*
+     * Compares the whole capacity without an early exit, so the time taken does not leak how many bytes matched.
+     */
+    bool operator==(const FixedString &other) const {
+        unsigned char difference = _size ^ other._size;
+        for (std::size_t i = 0; i < N; i++) {
+            difference |= _data[i] ^ other._data[i];
+        }
+        return difference == 0;
+    }
+
+    bool operator!=(const FixedString &other) const { return !(*this == other); }
+
+    friend std::ostream &operator<<(std::ostream &os, const FixedString &str) { return os << str.view(); }
+
+private:
+    std::array<char, N> _data{};
+    uint8_t _size{};
+};
+
+/*
+ * FixedString hashes like the string it holds, so it can key unordered containers.
+ */
+namespace std {
+    template<std::size_t N>
+    struct hash<FixedString<N>> {
+        std::size_t operator()(const FixedString<N> &str) const noexcept {
+            return std::hash<std::string_view>{}(str.view());
+        }
+    };
+} // std
+
+/*
+ * Session and transaction tokens are 32 alphanumeric characters.
+ */
+using Token = FixedString<32>;
+
+/*
+ * IBANs are at most 34 characters long.
+ */
+using IBAN = FixedString<34>;
+
+/*
+ * FixedString is packed as msgpack bin, and accepts str as well when unpacking.
+ */
+namespace msgpack {
+    MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+        namespace adaptor {
+
+            template<std::size_t N>
+            struct convert<FixedString<N>> {
+                msgpack::object const &operator()(msgpack::object const &o, FixedString<N> &v) const {
+                    if (o.type == msgpack::type::BIN && o.via.bin.size <= N) {
+                        v.assign(o.via.bin.ptr, o.via.bin.size);
+                    } else if (o.type == msgpack::type::STR && o.via.str.size <= N) {
+                        v.assign(o.via.str.ptr, o.via.str.size);
+                    } else {
+                        throw msgpack::type_error();
+                    }
+                    return o;
+                }
+            };
+
+            template<std::size_t N>
+            struct pack<FixedString<N>> {
+                template<typename Stream>
+                msgpack::packer<Stream> &operator()(msgpack::packer<Stream> &o, const FixedString<N> &v) const {
+                    o.pack_bin(static_cast<uint32_t>(v.size()));
+                    o.pack_bin_body(v.data(), static_cast<uint32_t>(v.size()));
+                    return o;
+                }
+            };
+
+            template<std::size_t N>
+            struct object_with_zone<FixedString<N>> {
+                void operator()(msgpack::object::with_zone &o, const FixedString<N> &v) const {
+                    char *ptr = static_cast<char *>(o.zone.allocate_align(v.size(), MSGPACK_ZONE_ALIGNOF(char)));
+                    std::memcpy(ptr, v.data(), v.size());
+                    o.type = msgpack::type::BIN;
+                    o.via.bin.ptr = ptr;
+                    o.via.bin.size = static_cast<uint32_t>(v.size());
+                }
+            };
+
+        } // adaptor
+    } // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+} // msgpack
+
+/*
+ * std::pmr::string is packed as msgpack str like std::string, and accepts bin as well when unpacking.
+ * Unpacking allocates from the memory resource of the string.
+ */
+namespace msgpack {
+    MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+        namespace adaptor {
+
+            template<>
+            struct convert<std::pmr::string> {
+                msgpack::object const &operator()(msgpack::object const &o, std::pmr::string &v) const {
+                    if (o.type == msgpack::type::STR) {
+                        v.assign(o.via.str.ptr, o.via.str.size);
+                    } else if (o.type == msgpack::type::BIN) {
+                        v.assign(o.via.bin.ptr, o.via.bin.size);
+                    } else {
+                        throw msgpack::type_error();
+                    }
+                    return o;
+                }
+            };
+
+            template<>
+            struct pack<std::pmr::string> {
+                template<typename Stream>
+                msgpack::packer<Stream> &operator()(msgpack::packer<Stream> &o, const std::pmr::string &v) const {
+                    o.pack_str(static_cast<uint32_t>(v.size()));
+                    o.pack_str_body(v.data(), static_cast<uint32_t>(v.size()));
+                    return o;
+                }
+            };
+
+            template<>
+            struct object_with_zone<std::pmr::string> {
+                void operator()(msgpack::object::with_zone &o, const std::pmr::string &v) const {
+                    char *ptr = static_cast<char *>(o.zone.allocate_align(v.size(), MSGPACK_ZONE_ALIGNOF(char)));
+                    std::memcpy(ptr, v.data(), v.size());
+                    o.type = msgpack::type::STR;
+                    o.via.str.ptr = ptr;
+                    o.via.str.size = static_cast<uint32_t>(v.size());
+                }
+            };
+
+        } // adaptor
+    } // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+} // msgpack
+
 /*
  * This is a list of all the messages that can be sent between the client and the server.
  */
@@ -21,18 +212,32 @@ enum class MSG_ID : uint16_t {
     ADD_BALANCE_RESPONSE = 11,
     TRANSACTION_REQUEST = 12,
     TRANSACTION_RESPONSE = 13,
+    SERVER_BUSY = 14,
+    REPLICATION_REQUEST = 15,
+    REPLICATION = 16,
+    TRANSFER_PREPARE = 17,
+    TRANSFER_COMMIT = 18,
+    TRANSFER_RESPONSE = 19,
+    BANK_SUMMARY_REQUEST = 20,
+    BANK_SUMMARY_RESPONSE = 21,
+    HANDOFF_REQUEST = 22,
+    HANDOFF = 23,
+    STANDING_ORDER_REQUEST = 24,
+    STANDING_ORDER_RESPONSE = 25,
 };
 MSGPACK_ADD_ENUM(MSG_ID)
 
 /*
  * This is the base class for all messages.
  * It contains the message ID and the message itself.
+ * A request may carry a deadline, the system time in milliseconds after which the client no longer waits for it.
  */
 class MSG {
 public:
     MSG_ID id{MSG_ID::NONE};
     msgpack::object msg{};
-    MSGPACK_DEFINE (id, msg);
+    uint64_t deadline{};
+    MSGPACK_DEFINE (id, msg, deadline);
 };
 
 /*
@@ -51,7 +256,7 @@ MSGPACK_ADD_ENUM(PING_TYPE)
 class PING {
 public:
     PING_TYPE type{PING_TYPE::NONE};
-    std::string token{};
+    Token token{};
     uint64_t client_time{};
     uint64_t server_time{};
     MSGPACK_DEFINE (type, token, client_time, server_time);
@@ -92,7 +297,7 @@ public:
     uint32_t citizen{};
     std::string name{};
     std::string user{};
-    std::string token{};
+    Token token{};
     MSGPACK_DEFINE (type, id, bank, citizen, name, user, token);
 };
 
@@ -102,7 +307,7 @@ public:
 class LOGOUT_REQUEST {
 public:
     std::string user{};
-    std::string token{};
+    Token token{};
     MSGPACK_DEFINE (user, token);
 };
 
@@ -137,20 +342,45 @@ public:
 
 /*
  * This is the message sub-object that is sent from the server to the client in response to a BANK_LIST_REQUEST.
+ * The name is allocated from the memory resource of the list holding the bank.
  */
 class Bank {
 public:
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
     uint16_t id{};
-    std::string name{};
+    std::pmr::string name{};
+
+    Bank() = default;
+
+    Bank(const Bank &) = default;
+
+    Bank(Bank &&) = default;
+
+    explicit Bank(const allocator_type &allocator) : name(allocator) {}
+
+    Bank(const Bank &other, const allocator_type &allocator) : id(other.id), name(other.name, allocator) {}
+
+    Bank(Bank &&other, const allocator_type &allocator) : id(other.id), name(std::move(other.name), allocator) {}
+
+    Bank &operator=(const Bank &) = default;
+
+    Bank &operator=(Bank &&) = default;
+
     MSGPACK_DEFINE (id, name);
 };
 
 /*
  * This is the message that is sent from the server to the client in response to a BANK_LIST_REQUEST.
+ * The banks are allocated from the memory resource given, the heap by default.
  */
 class BANK_LIST_RESPONSE {
 public:
-    std::vector<Bank> banks{};
+    std::pmr::vector<Bank> banks{};
+
+    BANK_LIST_RESPONSE() = default;
+
+    explicit BANK_LIST_RESPONSE(std::pmr::memory_resource *resource) : banks(resource) {}
+
     MSGPACK_DEFINE (banks);
 };
 
@@ -160,7 +390,7 @@ public:
 class ACCOUNT_LIST_REQUEST {
 public:
     uint32_t user{};
-    std::string token{};
+    Token token{};
     uint16_t bank{};
     MSGPACK_DEFINE (user, token, bank);
 };
@@ -170,7 +400,7 @@ public:
  */
 class Account {
 public:
-    std::string iban{};
+    IBAN iban{};
     uint32_t user{};
     uint16_t bank{};
     double_t balance{};
@@ -179,24 +409,72 @@ public:
 
 /*
  * This is the message that is sent from the server to the client in response to a ACCOUNT_LIST_REQUEST.
+ * The accounts are allocated from the memory resource given, the heap by default.
  */
 class ACCOUNT_LIST_RESPONSE {
 public:
-    std::vector<Account> accounts{};
+    std::pmr::vector<Account> accounts{};
+
+    ACCOUNT_LIST_RESPONSE() = default;
+
+    explicit ACCOUNT_LIST_RESPONSE(std::pmr::memory_resource *resource) : accounts(resource) {}
+
     MSGPACK_DEFINE (accounts);
 };
 
+/*
+ * This is the message that is sent from the client to the server to request the totals of the banks.
+ */
+class BANK_SUMMARY_REQUEST {
+public:
+    uint32_t user{};
+    Token token{};
+    MSGPACK_DEFINE (user, token);
+};
+
+/*
+ * This is the message sub-object that is sent from the server to the client in response to a BANK_SUMMARY_REQUEST.
+ * The total is the sum of the balances of the accounts in the bank, overdrawn the number of them below zero.
+ */
+class BankSummary {
+public:
+    uint16_t id{};
+    uint32_t accounts{};
+    double_t total{};
+    uint32_t overdrawn{};
+    MSGPACK_DEFINE (id, accounts, total, overdrawn);
+};
+
+/*
+ * This is the message that is sent from the server to the client in response to a BANK_SUMMARY_REQUEST.
+ * The net worth is the sum of the balances of all accounts of the user.
+ * The banks are allocated from the memory resource given, the heap by default.
+ */
+class BANK_SUMMARY_RESPONSE {
+public:
+    std::pmr::vector<BankSummary> banks{};
+    double_t net_worth{};
+
+    BANK_SUMMARY_RESPONSE() = default;
+
+    explicit BANK_SUMMARY_RESPONSE(std::pmr::memory_resource *resource) : banks(resource) {}
+
+    MSGPACK_DEFINE (banks, net_worth);
+};
+
 /*
  * This is the message that is sent from the client to the server to add balance to an IBAN as a superuser.
+ * The key is optional, a retry carrying the key of an earlier request gets its response without adding again.
  */
 class ADD_BALANCE_REQUEST {
 public:
     uint32_t user{};
-    std::string token{};
+    Token token{};
     uint16_t bank{};
-    std::string iban{};
+    IBAN iban{};
     double_t amount{};
-    MSGPACK_DEFINE (user, token, bank, iban, amount);
+    Token key{};
+    MSGPACK_DEFINE (user, token, bank, iban, amount, key);
 };
 
 /*
@@ -209,16 +487,18 @@ class ADD_BALANCE_RESPONSE : public ADD_BALANCE_REQUEST {
 
 /*
  * This is the message that is sent from the client to the server to request a transaction.
+ * The key is optional, a retry carrying the key of an earlier request gets its response without transferring again.
  */
 class TRANSACTION_REQUEST {
 public:
     uint32_t user{};
-    std::string token{};
+    Token token{};
     uint16_t bank{};
-    std::string from{};
-    std::string to{};
+    IBAN from{};
+    IBAN to{};
     double_t amount{};
-    MSGPACK_DEFINE (user, token, bank, from, to, amount);
+    Token key{};
+    MSGPACK_DEFINE (user, token, bank, from, to, amount, key);
 };
 
 /*
@@ -233,6 +513,7 @@ enum class TRANSACTION_RESPONSE_TYPE : uint8_t {
     INVALID_TO_IBAN = 5,
     INVALID_AMOUNT = 6,
     INSUFFICIENT_FUNDS = 7,
+    LIMIT_EXCEEDED = 8,
     UNKNOWN = 255,
 };
 MSGPACK_ADD_ENUM(TRANSACTION_RESPONSE_TYPE)
@@ -243,9 +524,146 @@ MSGPACK_ADD_ENUM(TRANSACTION_RESPONSE_TYPE)
 class TRANSACTION_RESPONSE {
 public:
     TRANSACTION_RESPONSE_TYPE type{TRANSACTION_RESPONSE_TYPE::UNKNOWN};
-    std::string token{};
+    Token token{};
     float_t fee{};
     MSGPACK_DEFINE (type, token, fee);
 };
 
+/*
+ * This is the message that is sent from the client to the server to register a standing order, or to cancel one.
+ * The order transfers amount from the from account to the to account at first, a system time in milliseconds,
+ * then every period days, or every period months if monthly, until it is cancelled. A period of 0 transfers once.
+ * A request with the token of an earlier order of the user in order cancels that order, the other fields are ignored.
+ * The key is optional, a retry carrying the key of an earlier request gets its response without registering again.
+ */
+class STANDING_ORDER_REQUEST {
+public:
+    uint32_t user{};
+    Token token{};
+    uint16_t bank{};
+    Token order{};
+    IBAN from{};
+    IBAN to{};
+    double_t amount{};
+    uint64_t first{};
+    uint16_t period{};
+    bool monthly{};
+    Token key{};
+    MSGPACK_DEFINE (user, token, bank, order, from, to, amount, first, period, monthly, key);
+};
+
+/*
+ * This is a list of all the standing order response types.
+ */
+enum class STANDING_ORDER_RESPONSE_TYPE : uint8_t {
+    ORDER_SUCCESS = 0,
+    SERVER_ERROR = 1,
+    NOT_LOGGED_IN = 2,
+    INVALID_TOKEN = 3,
+    INVALID_FROM_IBAN = 4,
+    INVALID_TO_IBAN = 5,
+    INVALID_AMOUNT = 6,
+    INVALID_ORDER = 7,
+    UNKNOWN = 255,
+};
+MSGPACK_ADD_ENUM(STANDING_ORDER_RESPONSE_TYPE)
+
+/*
+ * This is the message that is sent from the server to the client in response to a STANDING_ORDER_REQUEST.
+ * The order is the token of the order registered or cancelled.
+ */
+class STANDING_ORDER_RESPONSE {
+public:
+    STANDING_ORDER_RESPONSE_TYPE type{STANDING_ORDER_RESPONSE_TYPE::UNKNOWN};
+    Token order{};
+    MSGPACK_DEFINE (type, order);
+};
+
+/*
+ * This is a list of the reasons the server can turn a request away.
+ */
+enum class SERVER_BUSY_TYPE : uint8_t {
+    RATE_LIMITED = 0,
+    DEADLINE_EXCEEDED = 1,
+    READ_ONLY = 2,
+    INVALID_REQUEST = 3,
+    UNKNOWN = 255,
+};
+MSGPACK_ADD_ENUM(SERVER_BUSY_TYPE)
+
+/*
+ * This is the message that is sent from the server to the client instead of a response when the request was not
+ * handled.
+ * The client may retry the request after retry_after milliseconds.
+ */
+class SERVER_BUSY {
+public:
+    SERVER_BUSY_TYPE type{SERVER_BUSY_TYPE::UNKNOWN};
+    uint32_t retry_after{};
+    MSGPACK_DEFINE (type, retry_after);
+};
+
+/*
+ * This is the message that is sent from a backup server to its primary to ask for the changes it missed.
+ * The primary answers with a REPLICATION holding the journal records from the sequence on, and all its sessions if
+ * asked.
+ */
+class REPLICATION_REQUEST {
+public:
+    uint64_t from{};
+    bool sessions{};
+    MSGPACK_DEFINE (from, sessions);
+};
+
+/*
+ * This is the message that is sent from a new server process to the running one on its handoff address to take over.
+ * The mac signs time, the system time of the request in milliseconds, with the secret the servers share.
+ * The running server refuses a request that is not signed or older than ten seconds.
+ */
+class HANDOFF_REQUEST {
+public:
+    uint64_t time{};
+    Token mac{};
+    MSGPACK_DEFINE (time, mac);
+};
+
+/*
+ * This is the message that is published from a primary server to its backups for every change of its state.
+ * The records are journal records exactly as the primary journaled them, sequence is the last one the primary has.
+ */
+class REPLICATION {
+public:
+    uint64_t sequence{};
+    std::vector<char> records{};
+    std::vector<LOGIN_RESPONSE> logins{};
+    std::vector<uint32_t> logouts{};
+    MSGPACK_DEFINE (sequence, records, logins, logouts);
+};
+
+/*
+ * This is the message that is sent from the shard of the paying account to the shard of the receiving account of a
+ * transaction between shards.
+ * As a TRANSFER_PREPARE it asks whether the receiving shard can take the amount, as a TRANSFER_COMMIT it credits it.
+ * A TRANSFER_COMMIT is repeated until it is confirmed, the receiving shard credits each token only once.
+ * Shards exchange them only on their peer addresses, and the mac signs them with the secret the shards share.
+ */
+class TRANSFER {
+public:
+    Token token{};
+    IBAN from{};
+    IBAN to{};
+    double_t amount{};
+    Token mac{};
+    MSGPACK_DEFINE (token, from, to, amount, mac);
+};
+
+/*
+ * This is the message that is sent from the receiving shard back in response to a TRANSFER_PREPARE or TRANSFER_COMMIT.
+ */
+class TRANSFER_RESPONSE {
+public:
+    bool ok{};
+    MSGPACK_DEFINE (ok);
+};
+
 #endif //BANKING_MESSAGES_H
@@ -0,0 +1,270 @@
+#include <iostream>
+#include <sstream>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "Pipeline.h"
+#include "Tools.h"
+#include "Trace.h"
+
+namespace Server {
+
+    Pipeline::Pipeline(std::size_t capacity)
+            : _received(capacity), _decoded(capacity), _handled(capacity), _encoded(capacity) {
+    }
+
+    Pipeline::~Pipeline() {
+        stop();
+    }
+
+    bool Pipeline::start(zmq::socket_t &socket, int io_core, int decode_core, int encode_core) {
+        if (running()) {
+            return false;
+        }
+
+        // every stage sleeps on an eventfd of its own
+        for (int *event: {&_io_event, &_decode_event, &_writer_event, &_encode_event}) {
+            *event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (*event < 0) {
+                std::cout << "[server] can not create eventfd for the pipeline" << std::endl;
+                stop();
+                return false;
+            }
+        }
+        _socket = &socket;
+        _stopping = false;
+        _closing = false;
+        _io_thread = std::thread(&Pipeline::_io, this, io_core);
+        _decode_thread = std::thread(&Pipeline::_decode, this, decode_core);
+        _encode_thread = std::thread(&Pipeline::_encode, this, encode_core);
+        std::cout << "[server] started the pipeline" << std::endl;
+        return true;
+    }
+
+    void Pipeline::stop() {
+
+        // the encode stage finishes the responses handed over, then the I/O stage sends them
+        if (_io_thread.joinable()) {
+            _stopping = true;
+            _signal(_decode_event);
+            _signal(_encode_event);
+            _decode_thread.join();
+            _encode_thread.join();
+            _closing = true;
+            _signal(_io_event);
+            _io_thread.join();
+            std::cout << "[server] stopped the pipeline" << std::endl;
+        }
+        for (int *event: {&_io_event, &_decode_event, &_writer_event, &_encode_event}) {
+            if (*event >= 0) {
+                close(*event);
+                *event = -1;
+            }
+        }
+
+        // drop what was left in the queues
+        Frames frames;
+        Request request;
+        Response response;
+        while (_received.pop(frames)) {
+        }
+        while (_decoded.pop(request)) {
+        }
+        while (_handled.pop(response)) {
+        }
+        while (_encoded.pop(frames)) {
+        }
+        _socket = nullptr;
+    }
+
+    bool Pipeline::running() const {
+        return _socket != nullptr;
+    }
+
+    int Pipeline::fd() const {
+        return _writer_event;
+    }
+
+    void Pipeline::reset() {
+        _consume(_writer_event);
+    }
+
+    bool Pipeline::waiting() const {
+        return !_decoded.empty();
+    }
+
+    bool Pipeline::empty() const {
+        return _received.empty() && _decoded.empty();
+    }
+
+    bool Pipeline::pop(Request &request) {
+        return _decoded.pop(request);
+    }
+
+    void Pipeline::push(Response &&response) {
+        while (!_handled.push(std::move(response))) {
+            std::this_thread::yield();
+        }
+        _signal(_encode_event);
+    }
+
+    void Pipeline::_io(int core) {
+        Tools::Trace::name("io");
+        if (!Tools::Tools::pin(core)) {
+            std::cout << "[server] can not pin the I/O stage to core " << core << std::endl;
+        }
+        Frames frames;
+        while (true) {
+
+            // send the encoded responses, all of them before stopping
+            const bool closing = _closing;
+            while (_encoded.pop(frames)) {
+                Tools::Span span("pipeline", "send");
+                for (const std::string &frame: frames.envelope) {
+                    _socket->send(zmq::buffer(frame), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+                }
+                _socket->send(zmq::buffer(frames.payload), zmq::send_flags::dontwait);
+            }
+            if (closing) {
+                break;
+            }
+
+            // wait for requests while there is room for them, or for responses
+            const bool full = _received.full();
+            zmq::pollitem_t items[2] = {{_socket->handle(), 0, (short) (full ? 0 : ZMQ_POLLIN), 0},
+                                        {nullptr, _io_event, ZMQ_POLLIN, 0}};
+            zmq::poll(items, 2, std::chrono::milliseconds(full ? 1 : 100));
+            if (items[1].revents & ZMQ_POLLIN) {
+                _consume(_io_event);
+            }
+
+            // take the requests waiting in the socket, the decode stage is woken up once for all of them
+            bool received = false;
+            while (!_received.full() && _receive(frames)) {
+                _received.push(std::move(frames));
+                received = true;
+            }
+            if (received) {
+                _signal(_decode_event);
+            }
+        }
+    }
+
+    void Pipeline::_decode(int core) {
+        Tools::Trace::name("decode");
+        if (!Tools::Tools::pin(core)) {
+            std::cout << "[server] can not pin the decode stage to core " << core << std::endl;
+        }
+        Frames frames;
+        while (!_stopping) {
+            _wait(_decode_event);
+
+            // unpack the requests received, waking the server thread up for every batch of them
+            std::size_t decoded = 0;
+            while (!_stopping && _received.pop(frames)) {
+                Tools::Span span("pipeline", "decode");
+                Request request;
+                request.envelope = std::move(frames.envelope);
+                try {
+                    request.handle = msgpack::unpack(frames.payload.data(), frames.payload.size());
+                    request.handle.get().convert(request.msg);
+                } catch (const msgpack::unpack_error &) {
+                    request.malformed = true;
+                } catch (const msgpack::type_error &) {
+                    request.malformed = true;
+                }
+                while (!_stopping && !_decoded.push(std::move(request))) {
+                    std::this_thread::yield();
+                }
+                if (++decoded % 64 == 0) {
+                    _signal(_writer_event);
+                }
+            }
+            if (decoded % 64 != 0) {
+                _signal(_writer_event);
+            }
+        }
+    }
+
+    void Pipeline::_encode(int core) {
+        Tools::Trace::name("encode");
+        if (!Tools::Tools::pin(core)) {
+            std::cout << "[server] can not pin the encode stage to core " << core << std::endl;
+        }
+        Response response;
+        Frames frames;
+        while (true) {
+            const bool stopping = _stopping;
+            if (!stopping) {
+                _wait(_encode_event);
+            }
+
+            // pack the responses handed over, the I/O stage is woken up once for all of them
+            bool encoded = false;
+            while (_handled.pop(response)) {
+                Tools::Span span("pipeline", "encode");
+                if (response.payload.empty()) {
+                    std::stringstream buffer;
+                    msgpack::pack(buffer, response.msg);
+                    frames.payload = buffer.str();
+                } else {
+                    frames.payload = std::move(response.payload);
+                }
+                frames.envelope = std::move(response.envelope);
+                response = Response{};
+                while (!_encoded.push(std::move(frames))) {
+                    std::this_thread::yield();
+                }
+                encoded = true;
+            }
+            if (encoded) {
+                _signal(_io_event);
+            }
+            if (stopping) {
+                break;
+            }
+        }
+    }
+
+    bool Pipeline::_receive(Frames &frames) {
+
+        // the frames before the payload tell where the request came from
+        zmq::message_t message;
+        if (!_socket->recv(message, zmq::recv_flags::dontwait)) {
+            return false;
+        }
+        frames.envelope.clear();
+        while (message.more()) {
+            frames.envelope.push_back(message.to_string());
+            if (!_socket->recv(message, zmq::recv_flags::dontwait)) {
+                return false;
+            }
+        }
+        frames.payload = message.to_string();
+        return true;
+    }
+
+    void Pipeline::_wait(int event) {
+        pollfd item{event, POLLIN, 0};
+        if (poll(&item, 1, 100) > 0) {
+            _consume(event);
+        }
+    }
+
+    void Pipeline::_signal(int event) {
+        const uint64_t one = 1;
+        if (event >= 0 && write(event, &one, sizeof(one)) < 0) {
+            std::cout << "[server] can not signal a stage of the pipeline" << std::endl;
+        }
+    }
+
+    void Pipeline::_consume(int event) {
+        uint64_t count;
+        if (event >= 0 && read(event, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            std::cout << "[server] can not read an eventfd of the pipeline" << std::endl;
+        }
+    }
+
+} // Server
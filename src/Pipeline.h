@@ -0,0 +1,170 @@
+#ifndef BANKING_PIPELINE_H
+#define BANKING_PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <zmq.hpp>
+#include "Messages.h"
+#include "RingBuffer.h"
+
+namespace Server {
+
+    /*
+     * This is the pipeline of stages between the socket of the clients and the server thread, which writes the ledger.
+     * The I/O stage receives the requests and sends the responses, the decode stage unpacks the requests,
+     * and the encode stage packs the responses, each on a thread of its own that can be pinned to a core,
+     * so that a slow commit on the server thread does not stop requests from being received and unpacked.
+     * The stages are connected by bounded lock-free queues with one producer and one consumer each,
+     * and a stage with nothing to do sleeps on an eventfd the stage before it signals.
+     * A full queue holds the stage before it back, the I/O stage then leaves requests in the socket.
+     */
+    class Pipeline {
+
+    public:
+
+        /*
+         * This is a request unpacked by the decode stage, msg points into the memory of handle.
+         * A request that could not be unpacked is handed over as malformed, for the server thread to answer.
+         */
+        struct Request {
+            std::vector<std::string> envelope{}; // routing frames of the client
+            msgpack::object_handle handle{}; // unpacked payload
+            MSG msg{}; // the message
+            bool malformed{}; // whether the payload could not be unpacked
+        };
+
+        /*
+         * This is a response of the server thread for the encode stage, msg points into the memory of zone.
+         * A response the server thread packed already comes as its payload instead.
+         */
+        struct Response {
+            std::vector<std::string> envelope{}; // routing frames of the client
+            std::unique_ptr<msgpack::zone> zone{}; // memory of the message
+            MSG msg{}; // the message
+            std::string payload{}; // the packed message, if it was packed already
+        };
+
+        /*
+         * Creates the pipeline, every queue holding at least capacity messages.
+         */
+        explicit Pipeline(std::size_t capacity);
+
+        /*
+         * Stops the pipeline.
+         */
+        ~Pipeline();
+
+        /*
+         * Starts the stages on the socket, which only the I/O stage uses until stop.
+         * Every stage is pinned to its core, or left to the scheduler if its core is negative.
+         */
+        bool start(zmq::socket_t &socket, int io_core, int decode_core, int encode_core);
+
+        /*
+         * Sends the responses pushed so far and stops the stages, the requests not popped yet are dropped.
+         */
+        void stop();
+
+        /*
+         * Returns whether the stages are running.
+         */
+        bool running() const;
+
+        /*
+         * Returns the eventfd that is readable once requests were decoded, for the server thread to poll.
+         */
+        int fd() const;
+
+        /*
+         * Takes the signal of fd, before popping the requests it signalled.
+         */
+        void reset();
+
+        /*
+         * Returns whether decoded requests are waiting to be popped, on the server thread.
+         */
+        bool waiting() const;
+
+        /*
+         * Returns whether no request is received but not popped yet.
+         */
+        bool empty() const;
+
+        /*
+         * Takes the next decoded request, on the server thread.
+         * Returns false if there is none.
+         */
+        bool pop(Request &request);
+
+        /*
+         * Hands a response over to the encode stage, on the server thread, waiting while its queue is full.
+         */
+        void push(Response &&response);
+
+    private:
+
+        /*
+         * These are the frames of a message as they are received or sent.
+         */
+        struct Frames {
+            std::vector<std::string> envelope{}; // routing frames of the client
+            std::string payload{}; // packed message
+        };
+
+        zmq::socket_t *_socket{}; // socket of the clients
+        Tools::RingBuffer<Frames> _received; // requests from the I/O stage to the decode stage
+        Tools::RingBuffer<Request> _decoded; // requests from the decode stage to the server thread
+        Tools::RingBuffer<Response> _handled; // responses from the server thread to the encode stage
+        Tools::RingBuffer<Frames> _encoded; // responses from the encode stage to the I/O stage
+        int _io_event{-1}; // wakes the I/O stage up when responses are encoded
+        int _decode_event{-1}; // wakes the decode stage up when requests are received
+        int _writer_event{-1}; // wakes the server thread up when requests are decoded
+        int _encode_event{-1}; // wakes the encode stage up when responses are handled
+        std::thread _io_thread; // runs the I/O stage
+        std::thread _decode_thread; // runs the decode stage
+        std::thread _encode_thread; // runs the encode stage
+        std::atomic<bool> _stopping{false}; // whether the decode and encode stages must stop
+        std::atomic<bool> _closing{false}; // whether the I/O stage must stop, once the encode stage did
+
+        /*
+         * Runs the I/O stage.
+         */
+        void _io(int core);
+
+        /*
+         * Runs the decode stage.
+         */
+        void _decode(int core);
+
+        /*
+         * Runs the encode stage.
+         */
+        void _encode(int core);
+
+        /*
+         * Receives the frames of a request waiting in the socket.
+         */
+        bool _receive(Frames &frames);
+
+        /*
+         * Waits up to a tenth of a second for the eventfd to be signalled, and takes the signal.
+         */
+        static void _wait(int event);
+
+        /*
+         * Signals the eventfd.
+         */
+        static void _signal(int event);
+
+        /*
+         * Takes the signal of the eventfd, if it was signalled.
+         */
+        static void _consume(int event);
+    };
+
+} // Server
+
+#endif //BANKING_PIPELINE_H
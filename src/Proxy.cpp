@@ -0,0 +1,311 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <msgpack.hpp>
+#include "Proxy.h"
+
+namespace Proxy {
+
+    namespace {
+
+        /*
+         * Receives all frames of a message.
+         */
+        bool receive_frames(zmq::socket_t &socket, std::vector<zmq::message_t> &frames) {
+            frames.clear();
+            do {
+                frames.emplace_back();
+                if (!socket.recv(frames.back(), zmq::recv_flags::dontwait)) {
+                    return false;
+                }
+            } while (frames.back().more());
+            return true;
+        }
+
+        /*
+         * Sends all frames of a message without waiting.
+         * Returns false if the socket could not take the message, the frames are left as they were then.
+         */
+        bool send_frames(zmq::socket_t &socket, std::vector<zmq::message_t> &frames) {
+            for (std::size_t i = 0; i < frames.size(); i++) {
+                const zmq::send_flags flags = i + 1 < frames.size() ? zmq::send_flags::sndmore : zmq::send_flags::none;
+                if (!socket.send(frames[i], flags | zmq::send_flags::dontwait) && i == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /*
+         * Returns the time of a steady clock in milliseconds.
+         */
+        uint64_t monotonic_time() {
+            const auto now = std::chrono::steady_clock::now().time_since_epoch();
+            return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+        }
+
+        const uint64_t SESSION_IDLE_TIMEOUT = 15 * 60 * 1000; // shards forget sessions idle for this long
+        const uint64_t SWEEP_INTERVAL = 60 * 1000; // idle sessions are evicted this often
+
+    } // namespace
+
+    Proxy::Proxy() {
+        std::cout << "[proxy] proxy created." << std::endl;
+    }
+
+    Proxy::~Proxy() {
+        terminate();
+        std::cout << "[proxy] proxy destroyed." << std::endl;
+    }
+
+    bool Proxy::initialize(const std::string &address, const Tools::ShardMap &shard_map) {
+        if (shard_map.size() == 0) {
+            std::cout << "[proxy] there are no shards" << std::endl;
+            return false;
+        }
+        _shard_map = shard_map;
+
+        // receive the requests of the clients, keeping track of who sent them
+        _frontend = zmq::socket_t(_ctx, ZMQ_ROUTER);
+        _frontend.set(zmq::sockopt::rcvhwm, 1000);
+        _frontend.bind(address);
+
+        // connect to every shard
+        for (std::size_t shard = 0; shard < _shard_map.size(); shard++) {
+            _backends.emplace_back(_ctx, ZMQ_DEALER);
+            _backends.back().set(zmq::sockopt::linger, 0);
+            _backends.back().connect(_shard_map.address(shard));
+            std::cout << "[proxy] connected to shard " << shard << " at " << _shard_map.address(shard) << std::endl;
+        }
+
+        // wait for a second for ZMQ to properly initialize
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        std::cout << "[proxy] listening on " << address << std::endl;
+        return true;
+    }
+
+    void Proxy::terminate() {
+        for (zmq::socket_t &backend: _backends) {
+            backend.close();
+        }
+        _backends.clear();
+        if (_frontend) {
+            _frontend.close();
+        }
+        _ctx.close();
+    }
+
+    bool Proxy::forward() {
+
+        // wait for a request or a response
+        std::vector<zmq::pollitem_t> items{{_frontend.handle(), 0, ZMQ_POLLIN, 0}};
+        for (zmq::socket_t &backend: _backends) {
+            items.push_back({backend.handle(), 0, ZMQ_POLLIN, 0});
+        }
+        zmq::poll(items.data(), items.size(), std::chrono::milliseconds(1000));
+        bool forwarded = false;
+
+        const uint64_t now = monotonic_time();
+
+        // forward a request to its shard, the frames are the client identity, an empty delimiter and the request
+        std::vector<zmq::message_t> frames;
+        if (items[0].revents & ZMQ_POLLIN && receive_frames(_frontend, frames) && frames.size() > 1) {
+            std::size_t shard = 0;
+            Token token;
+            const std::string client = frames.front().to_string();
+            if (!_route(frames.back(), shard, token)) {
+                _refuse(frames, SERVER_BUSY_TYPE::INVALID_REQUEST, 0);
+                std::cout << "[proxy] turned away a malformed request" << std::endl;
+            } else if (!send_frames(_backends[shard], frames)) {
+                _refuse(frames, SERVER_BUSY_TYPE::RATE_LIMITED, 1000);
+                std::cout << "[proxy] shard " << shard << " is not keeping up, turned away a request" << std::endl;
+            } else if (!token.empty()) {
+                _waiting[client] = Waiting{token, now};
+            }
+            forwarded = true;
+        }
+
+        // forward the responses of the shards back to their clients
+        for (std::size_t shard = 0; shard < _backends.size(); shard++) {
+            if (items[shard + 1].revents & ZMQ_POLLIN && receive_frames(_backends[shard], frames) &&
+                frames.size() > 1) {
+                Token token;
+                auto it = _waiting.find(frames.front().to_string());
+                if (it != _waiting.end()) {
+                    token = it->second.token;
+                    _waiting.erase(it);
+                }
+                _learn(shard, frames.back(), token);
+                send_frames(_frontend, frames);
+                forwarded = true;
+            }
+        }
+
+        // forget the sessions the shards have forgotten by now
+        if (now >= _swept + SWEEP_INTERVAL) {
+            _sweep(now);
+        }
+        return forwarded;
+    }
+
+    bool Proxy::_route(const zmq::message_t &request, std::size_t &shard, Token &token) {
+        MSG msg;
+        try {
+            msgpack::object_handle result = msgpack::unpack(static_cast<const char *>(request.data()), request.size());
+            result.get().convert(msg);
+
+            // requests about a bank go to the shard owning it
+            switch (msg.id) {
+                case MSG_ID::LOGIN_REQUEST: {
+                    LOGIN_REQUEST login_request;
+                    msg.msg.convert(login_request);
+                    shard = _shard_map.shard(login_request.bank);
+                    return true;
+                }
+                case MSG_ID::ACCOUNT_LIST_REQUEST: {
+                    ACCOUNT_LIST_REQUEST account_list_request;
+                    msg.msg.convert(account_list_request);
+                    shard = _shard_map.shard(account_list_request.bank);
+                    token = account_list_request.token;
+                    break;
+                }
+                case MSG_ID::ADD_BALANCE_REQUEST: {
+                    ADD_BALANCE_REQUEST add_balance_request;
+                    msg.msg.convert(add_balance_request);
+                    shard = _shard_map.shard(add_balance_request.bank);
+                    token = add_balance_request.token;
+                    break;
+                }
+                case MSG_ID::TRANSACTION_REQUEST: {
+                    TRANSACTION_REQUEST transaction_request;
+                    msg.msg.convert(transaction_request);
+                    shard = _shard_map.shard(transaction_request.bank);
+                    token = transaction_request.token;
+                    break;
+                }
+                case MSG_ID::STANDING_ORDER_REQUEST: {
+                    STANDING_ORDER_REQUEST standing_order_request;
+                    msg.msg.convert(standing_order_request);
+                    shard = _shard_map.shard(standing_order_request.bank);
+                    token = standing_order_request.token;
+                    break;
+                }
+
+                // requests of a session go to the shard the session logged in to
+                case MSG_ID::LOGOUT_REQUEST: {
+                    LOGOUT_REQUEST logout_request;
+                    msg.msg.convert(logout_request);
+                    auto it = _sessions.find(logout_request.token);
+                    shard = it == _sessions.end() ? 0 : it->second.shard;
+                    if (it != _sessions.end()) {
+                        _sessions.erase(it);
+                    }
+                    return true;
+                }
+                case MSG_ID::PING: {
+                    PING ping;
+                    msg.msg.convert(ping);
+                    auto it = _sessions.find(ping.token);
+                    shard = it == _sessions.end() ? 0 : it->second.shard;
+                    token = ping.token;
+                    break;
+                }
+                case MSG_ID::BANK_SUMMARY_REQUEST: {
+                    BANK_SUMMARY_REQUEST bank_summary_request;
+                    msg.msg.convert(bank_summary_request);
+                    auto it = _sessions.find(bank_summary_request.token);
+                    shard = it == _sessions.end() ? 0 : it->second.shard;
+                    token = bank_summary_request.token;
+                    break;
+                }
+
+                // everything else is the same on every shard
+                default: {
+                    shard = 0;
+                    return true;
+                }
+            }
+        } catch (const msgpack::unpack_error &) {
+            return false;
+        } catch (const msgpack::type_error &) {
+            return false;
+        }
+
+        // a request sent in a session keeps it from going idle
+        auto it = _sessions.find(token);
+        if (it != _sessions.end()) {
+            it->second.used = monotonic_time();
+        }
+        return true;
+    }
+
+    void Proxy::_learn(std::size_t shard, const zmq::message_t &response, const Token &token) {
+        MSG msg;
+        bool expired = false;
+        try {
+            const char *data = static_cast<const char *>(response.data());
+            msgpack::object_handle result = msgpack::unpack(data, response.size());
+            result.get().convert(msg);
+
+            // remember the shard of every new session
+            if (msg.id == MSG_ID::LOGIN_RESPONSE) {
+                LOGIN_RESPONSE login_response;
+                msg.msg.convert(login_response);
+                if (login_response.type == LOGIN_RESPONSE_TYPE::LOGIN_SUCCESS) {
+                    _sessions[login_response.token] = Session{shard, monotonic_time()};
+                }
+            }
+
+            // the shard no longer knows the session the request was sent in
+            if (msg.id == MSG_ID::TRANSACTION_RESPONSE) {
+                TRANSACTION_RESPONSE transaction_response;
+                msg.msg.convert(transaction_response);
+                expired = transaction_response.type == TRANSACTION_RESPONSE_TYPE::NOT_LOGGED_IN ||
+                          transaction_response.type == TRANSACTION_RESPONSE_TYPE::INVALID_TOKEN;
+            }
+            if (msg.id == MSG_ID::STANDING_ORDER_RESPONSE) {
+                STANDING_ORDER_RESPONSE standing_order_response;
+                msg.msg.convert(standing_order_response);
+                expired = standing_order_response.type == STANDING_ORDER_RESPONSE_TYPE::NOT_LOGGED_IN ||
+                          standing_order_response.type == STANDING_ORDER_RESPONSE_TYPE::INVALID_TOKEN;
+            }
+        } catch (const msgpack::unpack_error &) {
+            std::cout << "[proxy] shard " << shard << " sent a malformed response" << std::endl;
+        } catch (const msgpack::type_error &) {
+            std::cout << "[proxy] shard " << shard << " sent a malformed response" << std::endl;
+        }
+        if (expired && !token.empty()) {
+            _sessions.erase(token);
+        }
+    }
+
+    void Proxy::_refuse(std::vector<zmq::message_t> &frames, SERVER_BUSY_TYPE type, uint32_t retry_after) {
+
+        // pack the SERVER_BUSY message in place of the request
+        msgpack::zone zone;
+        std::stringstream buffer;
+        SERVER_BUSY server_busy{type, retry_after};
+        msgpack::pack(buffer, MSG{MSG_ID::SERVER_BUSY, msgpack::object(server_busy, zone), 0});
+        const std::string payload = buffer.str();
+        frames.back() = zmq::message_t(payload.data(), payload.size());
+
+        // send it back to the client
+        send_frames(_frontend, frames);
+    }
+
+    void Proxy::_sweep(uint64_t now) {
+        _swept = now;
+
+        // sessions idle for this long are gone on their shard too
+        for (auto it = _sessions.begin(); it != _sessions.end();) {
+            it = now > it->second.used + SESSION_IDLE_TIMEOUT ? _sessions.erase(it) : std::next(it);
+        }
+
+        // requests the shards never answered
+        for (auto it = _waiting.begin(); it != _waiting.end();) {
+            it = now > it->second.sent + SESSION_IDLE_TIMEOUT ? _waiting.erase(it) : std::next(it);
+        }
+    }
+
+} // Proxy
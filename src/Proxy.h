@@ -0,0 +1,99 @@
+#ifndef BANKING_PROXY_H
+#define BANKING_PROXY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <zmq.hpp>
+#include "Messages.h"
+#include "ShardMap.h"
+
+namespace Proxy {
+
+    /*
+     * This is the proxy class, the address clients connect to in a sharded deployment.
+     * Requests are forwarded to the shard owning the bank they are about, clients do not know about the shards.
+     * Requests without a bank go by the session token, learned from the login responses, or else to the first shard.
+     */
+    class Proxy {
+
+    public:
+
+        /*
+         * Creates the proxy.
+         */
+        Proxy();
+
+        /*
+         * Destroys the proxy.
+         */
+        ~Proxy();
+
+        /*
+         * Initializes the proxy.
+         * The address is the address of the proxy, the shard map holds the addresses of the shards.
+         */
+        bool initialize(const std::string &address, const Tools::ShardMap &shard_map);
+
+        /*
+         * Terminates the proxy.
+         */
+        void terminate();
+
+        /*
+         * Forwards the requests and responses waiting, waiting up to a second for one.
+         * Returns false if there was nothing to forward.
+         */
+        bool forward();
+
+    private:
+
+        /*
+         * This is a session the proxy forwards the requests of.
+         */
+        struct Session {
+            std::size_t shard{}; // shard the session logged in to
+            uint64_t used{}; // when the session was last used, in milliseconds
+        };
+
+        /*
+         * This is a request forwarded to a shard, waiting for its response.
+         */
+        struct Waiting {
+            Token token{}; // session of the request
+            uint64_t sent{}; // when the request was forwarded, in milliseconds
+        };
+
+        Tools::ShardMap _shard_map; // shards the requests are forwarded to
+        zmq::context_t _ctx; // create a zmq context
+        zmq::socket_t _frontend; // receives the requests of the clients
+        std::vector<zmq::socket_t> _backends; // forwards the requests to the shards, by shard
+        std::unordered_map<Token, Session> _sessions; // every logged in session, by token
+        std::unordered_map<std::string, Waiting> _waiting; // last request of every client with a session, by identity
+        uint64_t _swept{}; // when the idle sessions were last evicted
+
+        /*
+         * Finds the shard a request is forwarded to, and the session it is sent in if any.
+         * Returns false if the request is malformed.
+         */
+        bool _route(const zmq::message_t &request, std::size_t &shard, Token &token);
+
+        /*
+         * Learns the shard of a session from a response of the shard, or forgets a session the shard no longer knows.
+         */
+        void _learn(std::size_t shard, const zmq::message_t &response, const Token &token);
+
+        /*
+         * Answers a request with a SERVER_BUSY instead of forwarding it.
+         */
+        void _refuse(std::vector<zmq::message_t> &frames, SERVER_BUSY_TYPE type, uint32_t retry_after);
+
+        /*
+         * Evicts the sessions idle for longer than the shards keep them.
+         */
+        void _sweep(uint64_t now);
+    };
+
+} // Proxy
+
+#endif //BANKING_PROXY_H
@@ -0,0 +1,97 @@
+#ifndef BANKING_RINGBUFFER_H
+#define BANKING_RINGBUFFER_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+namespace Tools {
+
+    /*
+     * This is a bounded lock-free queue between one producer thread and one consumer thread.
+     * The producer only writes the tail and the consumer only writes the head, each on a cache line of its own,
+     * and each keeps a copy of the other index so that it reads the shared one only when the queue looks full or empty.
+     * The capacity is rounded up to a power of two, values are moved in and out of slots allocated once.
+     */
+    template<typename T>
+    class RingBuffer {
+
+    public:
+
+        /*
+         * Creates a queue holding at least capacity values.
+         */
+        explicit RingBuffer(std::size_t capacity) {
+            std::size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            _slots.resize(size);
+            _mask = size - 1;
+        }
+
+        RingBuffer(const RingBuffer &) = delete;
+
+        RingBuffer &operator=(const RingBuffer &) = delete;
+
+        /*
+         * Moves value into the queue, on the producer thread.
+         * Returns false, leaving value as it was, if the queue is full.
+         */
+        bool push(T &&value) {
+            const std::size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head_copy > _mask) {
+                _head_copy = _head.load(std::memory_order_acquire);
+                if (tail - _head_copy > _mask) {
+                    return false;
+                }
+            }
+            _slots[tail & _mask] = std::move(value);
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+         * Moves the oldest value out of the queue into value, on the consumer thread.
+         * Returns false if the queue is empty.
+         */
+        bool pop(T &value) {
+            const std::size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail_copy) {
+                _tail_copy = _tail.load(std::memory_order_acquire);
+                if (head == _tail_copy) {
+                    return false;
+                }
+            }
+            value = std::move(_slots[head & _mask]);
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+         * Returns whether the queue is empty, exact on the consumer thread and a hint on any other.
+         */
+        bool empty() const {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+
+        /*
+         * Returns whether the queue is full, exact on the producer thread and a hint on any other.
+         */
+        bool full() const {
+            return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire) > _mask;
+        }
+
+    private:
+        std::vector<T> _slots{}; // values, by index modulo the capacity
+        std::size_t _mask{}; // capacity minus one
+        alignas(64) std::atomic<std::size_t> _head{0}; // index of the next value to pop, written by the consumer
+        std::size_t _tail_copy{0}; // tail as the consumer last read it
+        alignas(64) std::atomic<std::size_t> _tail{0}; // index of the next value to push, written by the producer
+        std::size_t _head_copy{0}; // head as the producer last read it
+    };
+
+} // Tools
+
+#endif //BANKING_RINGBUFFER_H
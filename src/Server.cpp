@@ -1,10 +1,22 @@
 #include <iostream>
+#include <cstring>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
 #include <thread>
 #include <chrono>
 #include <sstream>
+#include <optional>
 #include <msgpack.hpp>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #include "Server.h"
+#include "Snapshot.h"
 #include "Tools.h"
+#include "Trace.h"
 
 namespace Server {
 
@@ -18,7 +30,12 @@ namespace Server {
     }
 
     bool Server::initialize(const std::string &address) {
+        return initialize(address, _own_ctx);
+    }
+
+    bool Server::initialize(const std::string &address, zmq::context_t &context) {
         _address = address;
+        _ctx = &context;
 
         // open database banking.sqlite located in the same directory as the executable
         if (sqlite3_open("banking.sqlite", &_db)) {
@@ -28,12 +45,61 @@ namespace Server {
             std::cout << "[server] opened database successfully" << std::endl;
         }
 
-        // create a zmq context and socket
-        _sock = zmq::socket_t(_ctx, ZMQ_REP);
-        _sock.bind(_address);
+        // let the connections of the database pool read while the journal is applied
+        sqlite3_exec(_db, "PRAGMA journal_mode = WAL", nullptr, nullptr, nullptr);
+        sqlite3_busy_timeout(_db, 5000);
+        Tools::Trace::name("server");
+        Tools::Trace::watch(_db);
+
+        // open the journal and restore the ledger and the sessions
+        if (!_open_journal() || !_restore()) {
+            return false;
+        }
+
+        // keep the sessions of the server taken over from, its clients stay logged in
+        if (_taken_over) {
+            _user_sessions.restore(_handed_sessions, Tools::Tools::monotonic_time());
+            std::cout << "[server] took over " << _handed_sessions.size() << " sessions" << std::endl;
+            _handed_sessions.clear();
+        }
+
+        // index the users for logins
+        if (!_users.load(_db)) {
+            return false;
+        }
+
+        // compile the fees of transactions
+        if (!_fees.load(_db)) {
+            return false;
+        }
+
+        // requests without a session share one rate limit
+        _anonymous = Tools::TokenBucket(200, 400, Tools::Tools::monotonic_time());
+
+        // run the queries of the handlers on their own threads
+        if (!_database.open("banking.sqlite", 4)) {
+            return false;
+        }
+
+        // create a zmq context and socket, with a bounded queue of incoming requests
+        // a ROUTER socket answers requests in any order, so handlers waiting for the database do not hold up others
+        _sock = zmq::socket_t(*_ctx, ZMQ_ROUTER);
+        _sock.set(zmq::sockopt::rcvhwm, 1000);
+
+        // the server taken over from may still be letting go of the address
+        for (int attempt = 0; zmq_bind(_sock.handle(), _address.c_str()) != 0; attempt++) {
+            if (!_taken_over || attempt >= 100) {
+                std::cout << "[server] can not listen on " << _address << ": " << zmq_strerror(zmq_errno())
+                          << std::endl;
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
 
-        // wait for a second for ZMQ to properly initialize
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        // wait for a second for ZMQ to properly initialize, ipc:// and inproc:// sockets are ready once bound
+        if (_address.rfind("tcp://", 0) == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        }
 
         // check if the socket is properly bound
         if (_sock.handle() != nullptr) {
@@ -46,48 +112,575 @@ namespace Server {
         return true;
     }
 
+    bool Server::publish(const std::string &address, const std::string &sync) {
+
+        // create a zmq socket for the backups to subscribe to
+        _publisher = zmq::socket_t(*_ctx, ZMQ_PUB);
+        _publisher.bind(address);
+
+        // and one for the backups to ask for what they missed, apart from the clients since it hands out the sessions
+        _replicas = zmq::socket_t(*_ctx, ZMQ_ROUTER);
+        _replicas.bind(sync);
+        std::cout << "[server] publishing changes on " << address << " and syncing backups on " << sync << std::endl;
+        return true;
+    }
+
+    bool Server::follow(const std::string &sync, const std::string &replication) {
+
+        // subscribe to everything the primary publishes
+        _subscriber = zmq::socket_t(*_ctx, ZMQ_SUB);
+        _subscriber.set(zmq::sockopt::subscribe, "");
+        _subscriber.connect(replication);
+
+        // ask the primary directly for what the subscription missed, the answers are numbered like the calls to shards
+        _primary = zmq::socket_t(*_ctx, ZMQ_DEALER);
+        _primary.set(zmq::sockopt::linger, 0);
+        _primary.connect(sync);
+
+        _backup = true;
+        _synced = false;
+        std::cout << "[server] following " << sync << " through " << replication << std::endl;
+        return true;
+    }
+
+    bool Server::shard(std::size_t shard, const Tools::ShardMap &shard_map, const std::string &secret) {
+        if (shard >= shard_map.size()) {
+            std::cout << "[server] there is no shard " << shard << std::endl;
+            return false;
+        }
+        if (shard_map.peer(shard).empty() || secret.empty()) {
+            std::cout << "[server] a shard needs the peer addresses of the shards and their secret" << std::endl;
+            return false;
+        }
+        _shard = shard;
+        _shard_map = shard_map;
+        _shard_sockets.resize(shard_map.size());
+        _secret = secret;
+
+        // take the transactions of the other shards on a socket of their own, which clients are not sent to
+        _peers = zmq::socket_t(*_ctx, ZMQ_ROUTER);
+        _peers.bind(shard_map.peer(shard));
+        std::cout << "[server] taking transactions of the other shards on " << shard_map.peer(shard) << std::endl;
+
+        // and ask the other shards on their peer addresses, the responses come back on the same socket
+        for (std::size_t other = 0; other < shard_map.size(); other++) {
+            if (other != shard && !shard_map.peer(other).empty()) {
+                _shard_sockets[other] = zmq::socket_t(*_ctx, ZMQ_DEALER);
+                _shard_sockets[other].set(zmq::sockopt::linger, 0);
+                _shard_sockets[other].connect(shard_map.peer(other));
+            }
+        }
+
+        // keep only the accounts of the banks of the shard
+        _ledger.retain([this](const LedgerAccount &account) { return _owns(account.bank); });
+        std::cout << "[server] shard " << shard << " of " << shard_map.size() << " with "
+                  << _ledger.accounts().size() << " accounts" << std::endl;
+        return true;
+    }
+
     void Server::terminate() {
+        stop();
+        _drain();
+        _close_database();
+        _close_sockets();
+        if (_handoff) {
+            _handoff.close();
+        }
+        if (_own_ctx.handle() != nullptr) {
+            _own_ctx.close();
+            std::cout << "[client] socket context closed" << std::endl;
+        }
+    }
+
+    void Server::_drain() {
+        if (_db == nullptr || !_sock) {
+            return;
+        }
+
+        // keep answering while requests are waiting or handlers are suspended, but not forever
+        const uint64_t until = Tools::Tools::monotonic_time() + 1000;
+        while (Tools::Tools::monotonic_time() < until) {
+            bool waiting = !_pipeline.empty();
+            if (!_pipeline.running()) {
+                zmq::pollitem_t item{_sock.handle(), 0, ZMQ_POLLIN, 0};
+                zmq::poll(&item, 1, std::chrono::milliseconds(0));
+                waiting = item.revents & ZMQ_POLLIN;
+            }
+            if (!waiting && _database.pending() == 0 && _shard_calls.empty()) {
+                break;
+            }
+            handle_request();
+        }
+
+        // the handlers still waiting for another shard give up, while they can still answer
+        _expire_shard_calls(UINT64_MAX);
+    }
+
+    void Server::_close_database() {
+        if (_db != nullptr) {
+
+            // finish the handlers waiting for the database, their remaining queries run right away
+            _database.close();
+            while (_database.resume() > 0) {
+            }
+
+            // keep the final state for the next start, unless it was never restored
+            if (_restored) {
+                _take_snapshot(true);
+            }
+            while (_apply_journal(1024) > 0) {
+            }
+            _journal.close();
+            sqlite3_close(_db);
+            _db = nullptr;
+            std::cout << "[server] database closed" << std::endl;
+        }
+    }
+
+    void Server::_close_sockets() {
+        for (zmq::socket_t *socket: {&_publisher, &_subscriber, &_primary, &_replicas, &_peers}) {
+            if (*socket) {
+                socket->close();
+            }
+        }
+        for (zmq::socket_t &socket: _shard_sockets) {
+            if (socket) {
+                socket.close();
+            }
+        }
+        _pipeline.stop();
         if (_sock) {
+
+            // let the last responses out before the socket goes
+            _sock.set(zmq::sockopt::linger, 1000);
             _sock.close();
             std::cout << "[client] socket connection closed" << std::endl;
         }
-        if (_ctx.handle() != nullptr) {
-            _ctx.close();
-            std::cout << "[client] socket context closed" << std::endl;
+    }
+
+    bool Server::start() {
+        if (_thread.joinable()) {
+            return false;
+        }
+        _wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_wake < 0) {
+            std::cout << "[server] can not create eventfd: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        // the same loop as a standalone server
+        _stopping = false;
+        _thread = std::thread([this] {
+            Tools::Trace::name("server");
+            Tools::Tools::pin(_writer_core);
+            while (!_stopping && !_handed_off) {
+                maintain();
+                handle_request();
+            }
+        });
+        std::cout << "[server] running on its own thread" << std::endl;
+        return true;
+    }
+
+    bool Server::pipeline(const std::vector<int> &cores) {
+        if (!_sock || cores.size() != 4) {
+            std::cout << "[server] the pipeline needs a listening server and the cores of its 4 stages" << std::endl;
+            return false;
+        }
+
+        // the thread handling the requests is the stage writing the ledger
+        _writer_core = cores[2];
+        if (!_thread.joinable() && !Tools::Tools::pin(_writer_core)) {
+            std::cout << "[server] can not pin the server thread to core " << _writer_core << std::endl;
+        }
+        return _pipeline.start(_sock, cores[0], cores[1], cores[3]);
+    }
+
+    void Server::stop() {
+        if (!_thread.joinable()) {
+            return;
+        }
+
+        // wake the thread up if it is waiting for a request
+        _stopping = true;
+        const uint64_t one = 1;
+        if (write(_wake, &one, sizeof(one)) != sizeof(one)) {
+            std::cout << "[server] can not wake the server thread: " << std::strerror(errno) << std::endl;
+        }
+        _thread.join();
+        ::close(_wake);
+        _wake = -1;
+        std::cout << "[server] stopped its thread" << std::endl;
+    }
+
+    void Server::reload() {
+        _reload = true;
+    }
+
+    bool Server::hand_off(const std::string &address, const std::string &secret) {
+        if (secret.empty()) {
+            std::cout << "[server] handing off needs the secret of the servers" << std::endl;
+            return false;
+        }
+        _secret = secret;
+        _handoff = zmq::socket_t(*_ctx, ZMQ_REP);
+        _handoff.set(zmq::sockopt::linger, 1000);
+        _handoff.bind(address);
+
+        // only the user of the server may connect to the file of an ipc:// address
+        if (address.rfind("ipc://", 0) == 0 && chmod(address.c_str() + 6, S_IRUSR | S_IWUSR) != 0) {
+            std::cout << "[server] can not restrict " << address << " to the user of the server" << std::endl;
+            _handoff.close();
+            return false;
+        }
+        std::cout << "[server] hands off on " << address << std::endl;
+        return true;
+    }
+
+    bool Server::take_over(const std::string &address, const std::string &secret) {
+
+        // only a running server has the file of its ipc:// address
+        struct stat status{};
+        if (address.rfind("ipc://", 0) == 0 && stat(address.c_str() + 6, &status) != 0) {
+            std::cout << "[server] no server to take over from on " << address << std::endl;
+            return false;
+        }
+
+        // ask the running server to hand off, it answers once its database is closed
+        _secret = secret;
+        HANDOFF_REQUEST handoff_request;
+        handoff_request.time = Tools::Tools::system_time();
+        handoff_request.mac = _sign(handoff_request);
+        zmq::socket_t socket(*_ctx, ZMQ_REQ);
+        socket.set(zmq::sockopt::linger, 0);
+        socket.connect(address);
+        msgpack::zone zone;
+        std::stringstream buffer;
+        msgpack::pack(buffer, MSG{MSG_ID::HANDOFF_REQUEST, msgpack::object(handoff_request, zone), 0});
+        const std::string payload = buffer.str();
+        zmq::pollitem_t item{socket.handle(), 0, ZMQ_POLLIN, 0};
+        zmq::message_t message;
+        if (!socket.send(zmq::buffer(payload), zmq::send_flags::dontwait) ||
+            zmq::poll(&item, 1, std::chrono::milliseconds(10000)) <= 0 ||
+            !socket.recv(message, zmq::recv_flags::dontwait)) {
+            std::cout << "[server] no server to take over from answered on " << address << std::endl;
+            socket.close();
+            return false;
+        }
+        socket.close();
+
+        // keep the sessions until the server is initialized
+        try {
+            msgpack::object_handle handle = msgpack::unpack(static_cast<const char *>(message.data()), message.size());
+            MSG msg;
+            handle.get().convert(msg);
+            if (msg.id != MSG_ID::HANDOFF) {
+                std::cout << "[server] the server on " << address << " refused to hand off" << std::endl;
+                return false;
+            }
+            msg.msg.convert(_handed_sessions);
+        } catch (const std::exception &) {
+            std::cout << "[server] can not unpack the sessions handed off on " << address << std::endl;
+            _handed_sessions.clear();
+            return false;
+        }
+        _taken_over = true;
+        std::cout << "[server] taking over with " << _handed_sessions.size() << " sessions" << std::endl;
+        return true;
+    }
+
+    bool Server::handed_off() const {
+        return _handed_off;
+    }
+
+    void Server::_hand_off() {
+        zmq::message_t message;
+        if (!_handoff.recv(message, zmq::recv_flags::dontwait)) {
+            return;
+        }
+
+        // hand off only to a server signing a recent request with the secret
+        HANDOFF_REQUEST handoff_request;
+        try {
+            msgpack::object_handle handle = msgpack::unpack(static_cast<const char *>(message.data()), message.size());
+            MSG msg;
+            handle.get().convert(msg);
+            if (msg.id == MSG_ID::HANDOFF_REQUEST) {
+                msg.msg.convert(handoff_request);
+            }
+        } catch (const std::exception &) {
+            handoff_request = HANDOFF_REQUEST{};
+        }
+        const uint64_t now = Tools::Tools::system_time();
+        if (handoff_request.mac.empty() || handoff_request.mac != _sign(handoff_request) ||
+            handoff_request.time + 10000 < now || handoff_request.time > now + 10000) {
+            msgpack::zone zone;
+            std::stringstream buffer;
+            SERVER_BUSY refusal{SERVER_BUSY_TYPE::INVALID_REQUEST, 0};
+            msgpack::pack(buffer, MSG{MSG_ID::SERVER_BUSY, msgpack::object(refusal, zone), 0});
+            const std::string payload = buffer.str();
+            _handoff.send(zmq::buffer(payload), zmq::send_flags::dontwait);
+            std::cout << "[server] refused to hand off to a request that is not signed" << std::endl;
+            return;
+        }
+        std::cout << "[server] handing off to a new server" << std::endl;
+
+        // stop only once the requests already sent are answered and everything is written
+        _drain();
+        _close_database();
+        _close_sockets();
+
+        // the sessions as of now, the new server restores them after the journal
+        msgpack::zone zone;
+        const std::vector<SessionState> sessions = _user_sessions.save(Tools::Tools::monotonic_time());
+        std::stringstream buffer;
+        msgpack::pack(buffer, MSG{MSG_ID::HANDOFF, msgpack::object(sessions, zone), 0});
+        const std::string payload = buffer.str();
+        _handoff.send(zmq::buffer(payload), zmq::send_flags::dontwait);
+        _handoff.close();
+        _handed_off = true;
+        std::cout << "[server] handed off " << sessions.size() << " sessions" << std::endl;
+    }
+
+    Server::Query::Query(Server &server, std::function<void(sqlite3 *)> work)
+            : _server(server), _work(std::move(work)) {
+    }
+
+    bool Server::Query::await_ready() {
+
+        // without the pool the query runs right away
+        if (!_server._database.running()) {
+            _work(_server._db);
+            return true;
+        }
+        return false;
+    }
+
+    void Server::Query::await_suspend(std::coroutine_handle<> handle) {
+        _envelope = _server._envelope;
+        _origin = _server._origin;
+        _server._database.submit(std::move(_work), handle);
+    }
+
+    void Server::Query::await_resume() {
+        if (!_envelope.empty()) {
+            _server._envelope = std::move(_envelope);
+            _server._origin = _origin;
+        }
+    }
+
+    Server::Query Server::_query(std::function<void(sqlite3 *)> work) {
+        return Query(*this, std::move(work));
+    }
+
+    Server::ShardCall::ShardCall(Server &server, std::size_t shard, MSG_ID id, TRANSFER transfer)
+            : _server(server), _shard(shard), _id(id), _transfer(std::move(transfer)) {
+    }
+
+    bool Server::ShardCall::await_ready() {
+
+        // number the call, the shard sends the number back with its response
+        _call = ++_server._shard_call;
+        _transfer.mac = _server._sign(_id, _transfer);
+        msgpack::zone zone;
+        std::stringstream buffer;
+        msgpack::pack(buffer, MSG{_id, msgpack::object(_transfer, zone)});
+        const std::string payload = buffer.str();
+
+        // a call that can not be sent fails right away
+        zmq::socket_t &socket = _server._shard_sockets[_shard];
+        if (!socket || !socket.send(zmq::buffer(&_call, sizeof(_call)), zmq::send_flags::sndmore |
+                                                                         zmq::send_flags::dontwait) ||
+            !socket.send(zmq::buffer(payload), zmq::send_flags::dontwait)) {
+            std::cout << "[server] can not ask shard " << _shard << std::endl;
+            return true;
+        }
+        return false;
+    }
+
+    void Server::ShardCall::await_suspend(std::coroutine_handle<> handle) {
+        _handle = handle;
+        _deadline = Tools::Tools::monotonic_time() + 1000;
+        _envelope = _server._envelope;
+        _origin = _server._origin;
+        _server._shard_calls.emplace(_call, this);
+    }
+
+    std::optional<TRANSFER_RESPONSE> Server::ShardCall::await_resume() {
+        if (!_envelope.empty()) {
+            _server._envelope = std::move(_envelope);
+            _server._origin = _origin;
         }
+        return std::move(_response);
+    }
+
+    void Server::ShardCall::answer(std::optional<TRANSFER_RESPONSE> response) {
+        _response = std::move(response);
+        _handle.resume();
+    }
+
+    uint64_t Server::ShardCall::deadline() const {
+        return _deadline;
     }
 
     void Server::_send_message() {
+        Tools::Span span("server", "send");
+
+        // the encode stage packs the message, with the memory it points into
+        // the answers to other servers leave on their own sockets, which the pipeline does not own
+        if (_pipeline.running() && _origin == nullptr) {
+            Pipeline::Response response;
+            response.envelope = _envelope;
+            response.zone = std::make_unique<msgpack::zone>();
+            response.zone->swap(_z);
+            response.msg = _msg;
+            _pipeline.push(std::move(response));
+            return;
+        }
         std::stringstream buffer;
         msgpack::pack(buffer, _msg);
         const std::string payload = buffer.str();
-        _sock.send(zmq::buffer(payload), zmq::send_flags::dontwait);
+
+        // the message is packed, the memory it points into is reused by the next one
+        _z.clear();
+        _send_payload(payload.data(), payload.size());
+    }
+
+    template<typename T>
+    void Server::_send_packed(MSG_ID id, const T &response, std::pmr::memory_resource *arena) {
+
+        // pack the fields of a MSG around the response, as if it were the msg of one
+        Packed packed{std::pmr::vector<char>(arena)};
+        msgpack::packer<Packed> packer(packed);
+        packer.pack_array(3);
+        packer.pack(id);
+        packer.pack(response);
+        packer.pack(uint64_t{0});
+        _send_payload(packed.bytes.data(), packed.bytes.size());
+    }
+
+    void Server::_send_payload(const char *data, std::size_t size) {
+
+        // the encode stage only passes a packed message on, it outlives the arena it was packed in
+        if (_pipeline.running() && _origin == nullptr) {
+            Pipeline::Response response;
+            response.envelope = _envelope;
+            response.payload.assign(data, size);
+            _pipeline.push(std::move(response));
+            return;
+        }
+
+        // address the response with the routing frames of the request
+        zmq::socket_t &socket = _origin != nullptr ? *_origin : _sock;
+        for (const std::string &frame: _envelope) {
+            socket.send(zmq::buffer(frame), zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+        }
+        socket.send(zmq::buffer(data, size), zmq::send_flags::dontwait);
     }
 
     bool Server::_receive_message() {
+        Tools::Span span("server", "receive");
+
+        // the decode stage unpacked the message already
+        _origin = nullptr;
+        if (_pipeline.running()) {
+            Pipeline::Request request;
+            if (!_pipeline.pop(request)) {
+                return false;
+            }
+            _envelope = std::move(request.envelope);
+            if (request.malformed) {
+                _send_invalid_request();
+                return false;
+            }
+            _handle = std::move(request.handle);
+            _msg = request.msg;
+            return true;
+        }
 
-        // receive a message
+        // receive a message, the frames before the payload tell where it came from
         zmq::message_t message;
         if (!_sock.recv(message, zmq::recv_flags::dontwait)) {
             return false;
         }
+        _envelope.clear();
+        while (message.more()) {
+            _envelope.push_back(message.to_string());
+            if (!_sock.recv(message, zmq::recv_flags::dontwait)) {
+                return false;
+            }
+        }
 
         // clear the message
         _msg = MSG{};
 
-        // unpack the message
-        msgpack::unpacked result;
-        std::stringstream sbuf;
-        sbuf << message.to_string();
-        std::size_t off = 0;
-        msgpack::unpack(result, sbuf.str().data(), sbuf.str().size(), off);
-
-        // convert msgpack::object to MSG
-        result.get().convert(_msg);
+        // unpack the message, kept until the next one since the MSG points into it
+        // a client can send anything, which is answered instead of taking the server down
+        try {
+            const std::string payload = message.to_string();
+            std::size_t off = 0;
+            msgpack::unpack(_handle, payload.data(), payload.size(), off);
+
+            // convert msgpack::object to MSG
+            _handle.get().convert(_msg);
+        } catch (const msgpack::unpack_error &) {
+            _send_invalid_request();
+            return false;
+        } catch (const msgpack::type_error &) {
+            _send_invalid_request();
+            return false;
+        }
 
         return true;
     }
 
+    bool Server::_admit(const Token &token) {
+        const uint64_t now = Tools::Tools::monotonic_time();
+
+        // take a token from the bucket of the session, or the shared one
+        LOGIN_RESPONSE *session = token.empty() ? nullptr : _user_sessions.find(token);
+        Tools::TokenBucket &bucket = session != nullptr ? *_user_sessions.bucket(session->id) : _anonymous;
+        if (bucket.take(now)) {
+            return true;
+        }
+
+        // turn the request away
+        SERVER_BUSY server_busy;
+        server_busy.type = SERVER_BUSY_TYPE::RATE_LIMITED;
+        server_busy.retry_after = (uint32_t) bucket.wait(now);
+        _send_server_busy(server_busy);
+        std::cout << "[server] rate limited " << (session != nullptr ? session->user : "requests without a session")
+                  << std::endl;
+        return false;
+    }
+
+    void Server::_send_server_busy(SERVER_BUSY &server_busy) {
+
+        // pack the SERVER_BUSY message
+        _msg = MSG{MSG_ID::SERVER_BUSY, msgpack::object(server_busy, _z)};
+
+        // send the SERVER_BUSY message
+        _send_message();
+    }
+
+    void Server::_send_invalid_request() {
+        SERVER_BUSY server_busy;
+        server_busy.type = SERVER_BUSY_TYPE::INVALID_REQUEST;
+        _send_server_busy(server_busy);
+        std::cout << "[server] turned away a malformed request" << std::endl;
+    }
+
+    template<typename T>
+    bool Server::_parse(T &request) {
+        try {
+            _msg.msg.convert(request);
+            return true;
+        } catch (const msgpack::type_error &) {
+            _send_invalid_request();
+            return false;
+        }
+    }
+
     void Server::_send_ping(PING &ping) {
 
         // pack the PING message
@@ -99,6 +692,12 @@ namespace Server {
 
     void Server::_handle_ping(PING &ping) {
 
+        // a PING carrying a session token keeps the session alive
+        LOGIN_RESPONSE *session = _user_sessions.find(ping.token);
+        if (session != nullptr) {
+            _user_sessions.renew(session->id, Tools::Tools::monotonic_time());
+        }
+
         // prepare the response PING
         ping.type = PING_TYPE::SERVER;
         ping.server_time = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -120,57 +719,32 @@ namespace Server {
 
     void Server::_handle_login_request(const LOGIN_REQUEST &login_request, LOGIN_RESPONSE &login_response) {
 
-        // get the user from the database
-        sqlite3_stmt *stmt;
-        std::string sql = "SELECT id, citizen, name, user FROM users WHERE user = ? AND pass = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            login_response.type = LOGIN_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
-        }
-
-        // check if the user exists
-        sqlite3_bind_text(stmt, 1, login_request.user.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, login_request.pass.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
+        // check the credentials against the user index
+        const UserIndex::User *user = _users.authenticate(login_request.user, login_request.pass);
+        if (user == nullptr) {
             login_response.type = LOGIN_RESPONSE_TYPE::INVALID_USERNAME_OR_PASSWORD;
             std::cout << "[server] user not found" << std::endl;
             return;
         }
 
         // fill the LOGIN_RESPONSE
-        login_response.id = sqlite3_column_int(stmt, 0);
-        login_response.citizen = sqlite3_column_int(stmt, 1);
-        login_response.name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
-        login_response.user = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
-        sqlite3_finalize(stmt);
-
-        // get IBANs from the database for the user
-        sql = "SELECT iban FROM accounts WHERE user = ? AND bank = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            login_response.type = LOGIN_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
-        }
+        login_response.id = user->id;
+        login_response.citizen = user->citizen;
+        login_response.name = user->name;
+        login_response.user = user->user;
 
-        // check user has at least one account in the bank
-        sqlite3_bind_int(stmt, 1, (int) login_response.id);
-        sqlite3_bind_int(stmt, 2, login_request.bank);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
+        // check user has at least one account in the bank, and the bank is on this shard
+        if (!_users.has_account(user->id, login_request.bank) || !_owns(login_request.bank)) {
             login_response.type = LOGIN_RESPONSE_TYPE::INVALID_BANK_ID;
             std::cout << "[server] user has no accounts in the bank" << std::endl;
             return;
         }
-        sqlite3_finalize(stmt);
 
         // fill the LOGIN_RESPONSE
         login_response.bank = login_request.bank;
 
-        // check if the user has already logged in using std::any_of algorithm
-        if (std::any_of(_user_sessions.begin(), _user_sessions.end(),
-                        [&login_response](const LOGIN_RESPONSE &login_response_) {
-                            return login_response_.user == login_response.user;
-                        })) {
+        // check if the user has already logged in
+        if (_user_sessions.find(login_response.id) != nullptr) {
             login_response.type = LOGIN_RESPONSE_TYPE::ALREADY_LOGGED_IN;
             std::cout << "[server] user has already logged in" << std::endl;
             return;
@@ -178,10 +752,17 @@ namespace Server {
 
         // fill the LOGIN_RESPONSE
         login_response.type = LOGIN_RESPONSE_TYPE::LOGIN_SUCCESS;
-        login_response.token = Tools::Tools::random_string(32);
+        login_response.token.resize(Token::capacity());
+        Tools::Tools::random_token(login_response.token.data(), login_response.token.size());
 
         // add the LOGIN_RESPONSE to the list of login responses
-        _user_sessions.push_back(login_response);
+        _user_sessions.add(login_response, Tools::Tools::monotonic_time());
+
+        // let the backups know about the session
+        REPLICATION replication;
+        replication.sequence = _journal.sequence();
+        replication.logins.push_back(login_response);
+        _publish(replication);
         std::cout << "[server] user " << login_response.user << " logged in successfully" << std::endl;
     }
 
@@ -200,22 +781,15 @@ namespace Server {
         LOGOUT_RESPONSE logout_response;
         logout_response.type = LOGOUT_RESPONSE_TYPE::LOGOUT_SUCCESS;
 
-        // check if the user has already logged in
-        int token_index = -1;
-        for (int i = 0; i < _user_sessions.size(); i++) {
-            if (_user_sessions[i].user == logout_request.user) {
-                token_index = i;
-                break;
-            }
-        }
-        if (token_index == -1) {
-            logout_response.type = LOGOUT_RESPONSE_TYPE::NOT_LOGGED_IN;
-            std::cout << "[server] user has not logged in" << std::endl;
-        }
+        // find the session by token
+        LOGIN_RESPONSE *session = _user_sessions.find(logout_request.token);
+        if (session == nullptr || session->user != logout_request.user) {
 
-        // check if token is valid
-        if (logout_response.type == LOGOUT_RESPONSE_TYPE::LOGOUT_SUCCESS) {
-            if (_user_sessions[token_index].token != logout_request.token) {
+            // check if the user has already logged in
+            if (_user_sessions.find(logout_request.user) == nullptr) {
+                logout_response.type = LOGOUT_RESPONSE_TYPE::NOT_LOGGED_IN;
+                std::cout << "[server] user has not logged in" << std::endl;
+            } else {
                 logout_response.type = LOGOUT_RESPONSE_TYPE::INVALID_TOKEN;
                 std::cout << "[server] invalid token" << std::endl;
             }
@@ -224,7 +798,11 @@ namespace Server {
         // remove the LOGIN_RESPONSE from the list of login responses
         if (logout_response.type == LOGOUT_RESPONSE_TYPE::LOGOUT_SUCCESS) {
             std::cout << "[server] user " << logout_request.user << " logged out successfully" << std::endl;
-            _user_sessions.erase(_user_sessions.begin() + token_index);
+            REPLICATION replication;
+            replication.sequence = _journal.sequence();
+            replication.logouts.push_back(session->id);
+            _user_sessions.remove(session->id);
+            _publish(replication);
         }
 
         // send the LOGOUT_RESPONSE
@@ -234,37 +812,37 @@ namespace Server {
 
     void Server::_send_bank_list_response(BANK_LIST_RESPONSE &bank_list_response) {
 
-        // pack the BANK_LIST_RESPONSE message
-        _msg = MSG{MSG_ID::BANK_LIST_RESPONSE, msgpack::object(bank_list_response, _z)};
-
-        // send the BANK_LIST_RESPONSE message
-        _send_message();
+        // pack the BANK_LIST_RESPONSE message into the arena it was built in, and send it
+        _send_packed(MSG_ID::BANK_LIST_RESPONSE, bank_list_response,
+                     bank_list_response.banks.get_allocator().resource());
     }
 
-    void Server::_handle_bank_list_request([[maybe_unused]]BANK_LIST_REQUEST &bank_list_request) {
+    Tools::Task<> Server::_handle_bank_list_request([[maybe_unused]]BANK_LIST_REQUEST bank_list_request) {
 
-        // create a BANK_LIST_RESPONSE
-        BANK_LIST_RESPONSE bank_list_response;
+        // create a BANK_LIST_RESPONSE in the arena of the request, filled on a connection of the database pool
+        std::pmr::monotonic_buffer_resource arena(&_arenas);
+        BANK_LIST_RESPONSE bank_list_response(&arena);
 
         // get the banks from the database
-        bool error = false;
-        sqlite3_stmt *stmt;
-        std::string sql = "SELECT id, name FROM banks";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            error = true;
-        }
+        co_await _query([&](sqlite3 *db) {
+            bool error = false;
+            sqlite3_stmt *stmt;
+            std::string sql = "SELECT id, name FROM banks";
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+                error = true;
+            }
 
-        // fill the BANK_LIST_RESPONSE
-        if (!error){
-            while (sqlite3_step(stmt) == SQLITE_ROW) {
-                Bank bank{};
-                bank.id = sqlite3_column_int(stmt, 0);
-                bank.name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-                bank_list_response.banks.push_back(bank);
+            // fill the BANK_LIST_RESPONSE
+            if (!error) {
+                while (sqlite3_step(stmt) == SQLITE_ROW) {
+                    Bank &bank = bank_list_response.banks.emplace_back();
+                    bank.id = sqlite3_column_int(stmt, 0);
+                    bank.name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+                }
             }
-        }
-        sqlite3_finalize(stmt);
+            sqlite3_finalize(stmt);
+        });
 
         // send the BANK_LIST_RESPONSE
         _send_bank_list_response(bank_list_response);
@@ -273,369 +851,1944 @@ namespace Server {
 
     void Server::_send_account_list_response(ACCOUNT_LIST_RESPONSE &account_list_response) {
 
-        // pack the ACCOUNT_LIST_RESPONSE message
-        _msg = MSG{MSG_ID::ACCOUNT_LIST_RESPONSE, msgpack::object(account_list_response, _z)};
+        // pack the ACCOUNT_LIST_RESPONSE message into the arena it was built in, and send it
+        _send_packed(MSG_ID::ACCOUNT_LIST_RESPONSE, account_list_response,
+                     account_list_response.accounts.get_allocator().resource());
+    }
+
+    Tools::Task<> Server::_handle_account_list_request(ACCOUNT_LIST_REQUEST account_list_request) {
 
-        // send the ACCOUNT_LIST_RESPONSE message
-        _send_message();
+        // create a ACCOUNT_LIST_RESPONSE in the arena of the request
+        std::pmr::monotonic_buffer_resource arena(&_arenas);
+        ACCOUNT_LIST_RESPONSE account_list_response(&arena);
+
+        // check if the user has already logged in and the token is valid
+        LOGIN_RESPONSE *session = _user_sessions.find(account_list_request.user);
+        if (session != nullptr && session->token == account_list_request.token) {
+            _user_sessions.renew(session->id, Tools::Tools::monotonic_time());
+
+            // fill the ACCOUNT_LIST_RESPONSE with the accounts of the user in the bank
+            const std::vector<uint32_t> &user_accounts = _ledger.user_accounts(account_list_request.user);
+            std::pmr::vector<uint32_t> indexes(&arena);
+            indexes.reserve(user_accounts.size());
+            account_list_response.accounts.reserve(user_accounts.size());
+            for (const uint32_t index: user_accounts) {
+                const LedgerAccount &ledger_account = _ledger.accounts()[index];
+                if (ledger_account.bank != account_list_request.bank) {
+                    continue;
+                }
+                Account account{};
+                account.iban = ledger_account.iban;
+                account.user = ledger_account.user;
+                account.bank = ledger_account.bank;
+                account_list_response.accounts.push_back(account);
+                indexes.push_back(index);
+            }
+
+            // read the balances of all of them as of the same journal record, while the server thread goes on
+            std::pmr::vector<double_t> balances(indexes.size(), &arena);
+            co_await _query([&](sqlite3 *) { _ledger.read(indexes.data(), indexes.size(), balances.data()); });
+            for (std::size_t i = 0; i < balances.size(); i++) {
+                account_list_response.accounts[i].balance = balances[i];
+            }
+        }
+
+        // send the ACCOUNT_LIST_RESPONSE
+        _send_account_list_response(account_list_response);
+        std::cout << "[server] sent ACCOUNT_LIST_RESPONSE" << std::endl;
     }
 
-    void Server::_handle_account_list_request(ACCOUNT_LIST_REQUEST &account_list_request) {
+    void Server::_send_bank_summary_response(BANK_SUMMARY_RESPONSE &bank_summary_response) {
+
+        // pack the BANK_SUMMARY_RESPONSE message into the arena it was built in, and send it
+        _send_packed(MSG_ID::BANK_SUMMARY_RESPONSE, bank_summary_response,
+                     bank_summary_response.banks.get_allocator().resource());
+    }
+
+    void Server::_handle_bank_summary_request(const BANK_SUMMARY_REQUEST &bank_summary_request) {
+
+        // create a BANK_SUMMARY_RESPONSE in the arena of the request
+        std::pmr::monotonic_buffer_resource arena(&_arenas);
+        BANK_SUMMARY_RESPONSE bank_summary_response(&arena);
+
+        // check if the user has already logged in and the token is valid
+        LOGIN_RESPONSE *session = _user_sessions.find(bank_summary_request.user);
+        if (session != nullptr && session->token == bank_summary_request.token) {
+            _user_sessions.renew(session->id, Tools::Tools::monotonic_time());
+
+            // fill the BANK_SUMMARY_RESPONSE from the columnar copy of the ledger, without touching the database
+            const AccountStore &store = _ledger.store();
+            for (const AccountStore::BankTotal &bank_total: store.bank_totals()) {
+                BankSummary &bank_summary = bank_summary_response.banks.emplace_back();
+                bank_summary.id = bank_total.bank;
+                bank_summary.accounts = bank_total.accounts;
+                bank_summary.total = (double_t) bank_total.cents / 100;
+                bank_summary.overdrawn = bank_total.overdrawn;
+            }
+            bank_summary_response.net_worth =
+                    (double_t) store.total(_ledger.user_accounts(bank_summary_request.user)) / 100;
+        }
+
+        // send the BANK_SUMMARY_RESPONSE
+        _send_bank_summary_response(bank_summary_response);
+        std::cout << "[server] sent BANK_SUMMARY_RESPONSE" << std::endl;
+    }
+
+    void Server::_send_add_balance_response(ADD_BALANCE_RESPONSE &add_balance_response) {
+
+        // pack the ADD_BALANCE_RESPONSE message
+        _msg = MSG{MSG_ID::ADD_BALANCE_RESPONSE, msgpack::object(add_balance_response, _z)};
+
+        // send the ADD_BALANCE_RESPONSE message
+        _send_message();
+    }
+
+    Tools::Task<> Server::_handle_add_balance_request(ADD_BALANCE_REQUEST add_balance_request,
+                                                      ADD_BALANCE_RESPONSE &add_balance_response) {
+
+        // check if the user has already logged in
+        LOGIN_RESPONSE *session = _user_sessions.find(add_balance_request.user);
+        if (session == nullptr) {
+            std::cout << "[server] user has not logged in" << std::endl;
+            co_return;
+        }
+
+        // check if the token is valid
+        if (session->token != add_balance_request.token) {
+            std::cout << "[server] invalid token" << std::endl;
+            co_return;
+        }
+        _user_sessions.renew(session->id, Tools::Tools::monotonic_time());
+
+        // fill the ADD_BALANCE_RESPONSE
+        add_balance_response.user = add_balance_request.user;
+        add_balance_response.token = add_balance_request.token;
+        add_balance_response.bank = add_balance_request.bank;
+        add_balance_response.iban = add_balance_request.iban;
+        add_balance_response.key = add_balance_request.key;
+
+        // check if amount is positive and finite, anything else would be journaled as it is
+        if (!(std::isfinite(add_balance_request.amount) && add_balance_request.amount > 0)) {
+            std::cout << "[server] invalid amount" << std::endl;
+            co_return;
+        }
+
+        // answer a retry with the response to the original request
+        if (!add_balance_request.key.empty()) {
+            const IdempotentResponse *original = co_await _find_idempotent(
+                    JOURNAL_RECORD_TYPE::ADD_BALANCE, add_balance_request.user, add_balance_request.key);
+            if (original != nullptr) {
+                add_balance_response.amount = original->balance;
+                std::cout << "[server] balance was already added for this key" << std::endl;
+                co_return;
+            }
+        }
+
+        // check the account belongs to the user in the bank
+        const LedgerAccount *account = _ledger.find(add_balance_request.iban);
+        if (account == nullptr || account->user != add_balance_request.user ||
+            account->bank != add_balance_request.bank) {
+            std::cout << "[server] account not found" << std::endl;
+            co_return;
+        }
+
+        // add the balance to the account
+        JournalRecord record{};
+        record.type = JOURNAL_RECORD_TYPE::ADD_BALANCE;
+        record.user = add_balance_request.user;
+        record.bank = add_balance_request.bank;
+        record.token.resize(Token::capacity());
+        Tools::Tools::random_token(record.token.data(), record.token.size());
+        record.to = add_balance_request.iban;
+        record.amount = add_balance_request.amount;
+        record.balance = account->balance + add_balance_request.amount;
+        record.key = add_balance_request.key;
+        if (!_journal_mutation(record)) {
+            std::cout << "[server] can not update balance" << std::endl;
+            co_return;
+        }
+        add_balance_response.amount = account->balance;
+    }
+
+    Tools::Task<> Server::_serve_add_balance_request(ADD_BALANCE_REQUEST add_balance_request) {
+        ADD_BALANCE_RESPONSE add_balance_response;
+        co_await _handle_add_balance_request(std::move(add_balance_request), add_balance_response);
+        _send_add_balance_response(add_balance_response);
+        std::cout << "[server] sent ADD_BALANCE_RESPONSE" << std::endl;
+    }
+
+    void Server::_send_transaction_response(TRANSACTION_RESPONSE &transaction_response) {
+
+        // pack the TRANSACTION_RESPONSE message
+        _msg = MSG{MSG_ID::TRANSACTION_RESPONSE, msgpack::object(transaction_response, _z)};
+
+        // send the TRANSACTION_RESPONSE message
+        _send_message();
+    }
+
+    Tools::Task<> Server::_handle_transaction_request(TRANSACTION_REQUEST transaction_request,
+                                                      TRANSACTION_RESPONSE &transaction_response) {
+
+        // check if the user has already logged in
+        LOGIN_RESPONSE *session = _user_sessions.find(transaction_request.user);
+        if (session == nullptr) {
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::NOT_LOGGED_IN;
+            std::cout << "[server] user has not logged in" << std::endl;
+            co_return;
+        }
+
+        // check if the token is valid
+        if (session->token != transaction_request.token) {
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_TOKEN;
+            std::cout << "[server] invalid token" << std::endl;
+            co_return;
+        }
+        _user_sessions.renew(session->id, Tools::Tools::monotonic_time());
+
+        // check if amount is positive
+        if (!(transaction_request.amount > 0)) {
+            std::cout << "[server] amount is not positive" << std::endl;
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_AMOUNT;
+            co_return;
+        }
+
+        // check if from account exists
+        const LedgerAccount *from = _ledger.find(transaction_request.from);
+        if (from == nullptr || from->user != transaction_request.user || from->bank != transaction_request.bank) {
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_FROM_IBAN;
+            std::cout << "[server] from account not found" << std::endl;
+            co_return;
+        }
+
+        // check if to account exists, on this shard or another one
+        const LedgerAccount *to = _ledger.find(transaction_request.to);
+        uint16_t to_bank = to != nullptr ? to->bank : 0;
+        bool found = to != nullptr;
+        if (!found && _shard_map.size() > 0) {
+            found = co_await _find_bank(transaction_request.to, to_bank) && !_owns(to_bank);
+        }
+        if (!found || transaction_request.to == transaction_request.from) {
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_TO_IBAN;
+            std::cout << "[server] to account not found" << std::endl;
+            co_return;
+        }
+
+        // get the fee of the transaction from the fee schedule
+        float_t fee = 0.0;
+        if (!_fees.fee(from->bank, to_bank, transaction_request.amount, fee)) {
+            std::cout << "[server] can not get fee" << std::endl;
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
+            co_return;
+        }
+
+        // fill the TRANSACTION_RESPONSE
+        transaction_response.fee = fee;
+        transaction_response.token.resize(Token::capacity());
+        Tools::Tools::random_token(transaction_response.token.data(), transaction_response.token.size());
+
+        // a transaction to another shard needs the consent of that shard first, nothing is kept until it is committed
+        if (to == nullptr) {
+            TRANSFER transfer;
+            transfer.token = transaction_response.token;
+            transfer.from = transaction_request.from;
+            transfer.to = transaction_request.to;
+            transfer.amount = transaction_request.amount;
+            const std::optional<TRANSFER_RESPONSE> transfer_response =
+                    co_await _ask_shard(_shard_map.shard(to_bank), MSG_ID::TRANSFER_PREPARE, transfer);
+            if (!transfer_response) {
+                transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
+                std::cout << "[server] shard of to account did not answer" << std::endl;
+                co_return;
+            }
+            if (!transfer_response->ok) {
+                transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_TO_IBAN;
+                std::cout << "[server] shard of to account refused the transaction" << std::endl;
+                co_return;
+            }
+        }
+
+        // answer a retry with the response to the original request
+        // this is the last wait, so no retry of the request can be journaled between this check and the journal
+        if (!transaction_request.key.empty()) {
+            const IdempotentResponse *original = co_await _find_idempotent(
+                    JOURNAL_RECORD_TYPE::TRANSACTION, transaction_request.user, transaction_request.key);
+            if (original != nullptr) {
+                transaction_response.type = TRANSACTION_RESPONSE_TYPE::TRANSACTION_SUCCESS;
+                transaction_response.token = original->token;
+                transaction_response.fee = original->fee;
+                std::cout << "[server] transaction was already made for this key" << std::endl;
+                co_return;
+            }
+        }
+
+        // check if from account has enough balance
+        if (from->balance < transaction_request.amount + fee) {
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INSUFFICIENT_FUNDS;
+            std::cout << "[server] insufficient funds" << std::endl;
+            co_return;
+        }
+
+        // count the transaction against the limits of from account, taken back if it is not made after all
+        const auto account = static_cast<uint32_t>(from - _ledger.accounts().data());
+        const uint64_t admitted = Tools::Tools::monotonic_time();
+        if (!_limits.admit(account, transaction_request.amount, admitted)) {
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::LIMIT_EXCEEDED;
+            std::cout << "[server] spending limit exceeded" << std::endl;
+            co_return;
+        }
+
+        // move the balance between the accounts and add the transaction
+        JournalRecord record{};
+        record.type = to != nullptr ? JOURNAL_RECORD_TYPE::TRANSACTION : JOURNAL_RECORD_TYPE::TRANSFER_OUT;
+        record.user = transaction_request.user;
+        record.bank = transaction_request.bank;
+        record.token = transaction_response.token;
+        record.from = transaction_request.from;
+        record.to = transaction_request.to;
+        record.amount = transaction_request.amount;
+        record.fee = fee;
+        record.balance = from->balance - transaction_request.amount - fee;
+        record.key = transaction_request.key;
+        if (!_journal_mutation(record)) {
+            _limits.refund(account, transaction_request.amount, admitted);
+            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
+            std::cout << "[server] can not journal transaction" << std::endl;
+            co_return;
+        }
+
+        // the transaction is decided, have the other shard credit it now or retry later
+        if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_OUT) {
+            co_await _commit_transfer(record);
+        }
+
+        // fill the TRANSACTION_RESPONSE
+        transaction_response.type = TRANSACTION_RESPONSE_TYPE::TRANSACTION_SUCCESS;
+    }
+
+    Tools::Task<> Server::_serve_transaction_request(TRANSACTION_REQUEST transaction_request) {
+        TRANSACTION_RESPONSE transaction_response;
+        co_await _handle_transaction_request(std::move(transaction_request), transaction_response);
+        _send_transaction_response(transaction_response);
+        std::cout << "[server] sent TRANSACTION_RESPONSE" << std::endl;
+    }
+
+    void Server::_send_standing_order_response(STANDING_ORDER_RESPONSE &standing_order_response) {
+
+        // pack the STANDING_ORDER_RESPONSE message
+        _msg = MSG{MSG_ID::STANDING_ORDER_RESPONSE, msgpack::object(standing_order_response, _z)};
+
+        // send the STANDING_ORDER_RESPONSE message
+        _send_message();
+    }
+
+    Tools::Task<> Server::_handle_standing_order_request(STANDING_ORDER_REQUEST standing_order_request,
+                                                         STANDING_ORDER_RESPONSE &standing_order_response) {
+
+        // check if the user has already logged in
+        LOGIN_RESPONSE *session = _user_sessions.find(standing_order_request.user);
+        if (session == nullptr) {
+            standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::NOT_LOGGED_IN;
+            std::cout << "[server] user has not logged in" << std::endl;
+            co_return;
+        }
+
+        // check if the token is valid
+        if (session->token != standing_order_request.token) {
+            standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::INVALID_TOKEN;
+            std::cout << "[server] invalid token" << std::endl;
+            co_return;
+        }
+        _user_sessions.renew(session->id, Tools::Tools::monotonic_time());
+
+        // the order of a new one, or the one to cancel
+        JournalRecord record{};
+        const bool cancel = !standing_order_request.order.empty();
+        record.type = cancel ? JOURNAL_RECORD_TYPE::ORDER_DELETE : JOURNAL_RECORD_TYPE::ORDER;
+        record.user = standing_order_request.user;
+        record.bank = standing_order_request.bank;
+        record.key = standing_order_request.key;
+        if (cancel) {
+            record.token = standing_order_request.order;
+        } else {
+
+            // check if amount is positive
+            if (!(standing_order_request.amount > 0)) {
+                std::cout << "[server] amount is not positive" << std::endl;
+                standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::INVALID_AMOUNT;
+                co_return;
+            }
+
+            // check if from account exists
+            const LedgerAccount *from = _ledger.find(standing_order_request.from);
+            if (from == nullptr || from->user != standing_order_request.user ||
+                from->bank != standing_order_request.bank) {
+                standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::INVALID_FROM_IBAN;
+                std::cout << "[server] from account not found" << std::endl;
+                co_return;
+            }
+
+            // check if to account exists, on this shard or another one
+            uint16_t to_bank = 0;
+            bool found = _ledger.find(standing_order_request.to) != nullptr;
+            if (!found && _shard_map.size() > 0) {
+                found = co_await _find_bank(standing_order_request.to, to_bank) && !_owns(to_bank);
+            }
+            if (!found || standing_order_request.to == standing_order_request.from) {
+                standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::INVALID_TO_IBAN;
+                std::cout << "[server] to account not found" << std::endl;
+                co_return;
+            }
+            record.token.resize(Token::capacity());
+            Tools::Tools::random_token(record.token.data(), record.token.size());
+            record.from = standing_order_request.from;
+            record.to = standing_order_request.to;
+            record.amount = standing_order_request.amount;
+            record.due = standing_order_request.first;
+            record.period = standing_order_request.monthly ? -(float_t) standing_order_request.period
+                                                           : (float_t) standing_order_request.period;
+            record.day = standing_order_request.monthly ? StandingOrders::day_of(standing_order_request.first) : 0;
+        }
+
+        // answer a retry with the response to the original request
+        // this is the last wait, so no retry of the request can be journaled between this check and the journal
+        if (!standing_order_request.key.empty()) {
+            const IdempotentResponse *original = co_await _find_idempotent(
+                    JOURNAL_RECORD_TYPE::ORDER, standing_order_request.user, standing_order_request.key);
+            if (original != nullptr) {
+                standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::ORDER_SUCCESS;
+                standing_order_response.order = original->token;
+                std::cout << "[server] standing order was already made for this key" << std::endl;
+                co_return;
+            }
+        }
+
+        // only the user owning an order can cancel it
+        if (cancel) {
+            const StandingOrders::Order *order = _orders.find(record.token);
+            if (order == nullptr || order->user != standing_order_request.user) {
+                standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::INVALID_ORDER;
+                std::cout << "[server] standing order not found" << std::endl;
+                co_return;
+            }
+            record.bank = order->bank;
+            record.from = order->from;
+            record.to = order->to;
+        }
+
+        // register or remove the order
+        if (!_journal_mutation(record)) {
+            standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::SERVER_ERROR;
+            std::cout << "[server] can not journal standing order" << std::endl;
+            co_return;
+        }
+
+        // fill the STANDING_ORDER_RESPONSE
+        standing_order_response.type = STANDING_ORDER_RESPONSE_TYPE::ORDER_SUCCESS;
+        standing_order_response.order = record.token;
+    }
+
+    Tools::Task<> Server::_serve_standing_order_request(STANDING_ORDER_REQUEST standing_order_request) {
+        STANDING_ORDER_RESPONSE standing_order_response;
+        co_await _handle_standing_order_request(std::move(standing_order_request), standing_order_response);
+        _send_standing_order_response(standing_order_response);
+        std::cout << "[server] sent STANDING_ORDER_RESPONSE" << std::endl;
+    }
+
+    void Server::maintain() {
+        Tools::Span span("server", "maintain");
+
+        const uint64_t now = Tools::Tools::monotonic_time();
+        if (_backup) {
+
+            // a backup follows the primary, sessions included
+            _follow_primary();
+        } else {
+
+            // evict timed out sessions, a few at a time so that requests are not held up
+            const std::size_t expired = _user_sessions.expire(now, 64);
+            if (expired > 0) {
+                std::cout << "[server] expired " << expired << " sessions" << std::endl;
+            }
+
+            // let the backups know about the evicted sessions, and every second how far the journal is
+            if (_publisher && (expired > 0 || now - _publish_time >= 1000)) {
+                REPLICATION replication;
+                replication.sequence = _journal.sequence();
+                replication.logouts = _user_sessions.expired();
+                _publish(replication);
+            }
+        }
+
+        // fail the calls to other shards that were not answered in time
+        if (!_shard_calls.empty()) {
+            _expire_shard_calls(now);
+        }
+
+        // send the transactions other shards did not confirm again, a few every second
+        if (!_backup && !_outbox.empty() && now - _outbox_time >= 1000) {
+            _outbox_time = now;
+            std::vector<JournalRecord> unconfirmed;
+            for (auto it = _outbox.begin(); it != _outbox.end() && unconfirmed.size() < 16; ++it) {
+                unconfirmed.push_back(it->second);
+            }
+            for (const JournalRecord &record: unconfirmed) {
+                _commit_transfer(record).detach();
+            }
+        }
+
+        // compile the fee rules again when asked to
+        if (_reload.exchange(false)) {
+            _reload_fees().detach();
+        }
+
+        // post interest and fees once a day
+        if (!_backup) {
+            _run_end_of_day();
+        }
+
+        // run the standing orders that are due
+        if (!_backup) {
+            _run_standing_orders();
+        }
+
+        // apply the journal to the database in batches, or once it has waited long enough
+        const uint64_t backlog = _journal.sequence() - _applied;
+        if (!_flushing && (backlog >= 256 || (backlog > 0 && now - _applied_time >= 100))) {
+            _flush_journal(8192).detach();
+            _applied_time = now;
+        }
+
+        // take a snapshot every minute while the ledger changed since the last one
+        if (now - _snapshot_time >= 60 * 1000 && !_snapshot_running && _ledger.sequence() != _snapshot_sequence) {
+            _take_snapshot(false);
+        }
+
+        // drop the journal records the database and the latest snapshot both have, once they outnumber the rest,
+        // so that the journal does not grow forever and a restart does not read through all of it
+        // the records the backups heard from in the last minute have not asked for yet are kept for them
+        uint64_t kept = std::min<uint64_t>(_applied, _snapshot_written);
+        for (auto it = _backups.begin(); it != _backups.end();) {
+            if (now - it->second.time > 60 * 1000) {
+                it = _backups.erase(it);
+            } else {
+                kept = std::min<uint64_t>(kept, it->second.from - 1);
+                ++it;
+            }
+        }
+        if (kept >= _journal.first() + (1 << 16) && kept - _journal.first() >= _journal.sequence() - kept) {
+            _journal.compact(kept);
+        }
+
+        // forget the responses to requests that are too old to be retried
+        _idempotency.expire(Tools::Tools::system_time());
+    }
+
+    bool Server::_open_journal() {
+
+        // the database remembers the last journal record applied to it, and must not lose it since the journal
+        // drops the records the database has, so it commits to disk like the connections of the pool
+        char *error = nullptr;
+        const char *sql = "PRAGMA journal_mode = WAL;"
+                          "PRAGMA synchronous = FULL;"
+                          "CREATE TABLE IF NOT EXISTS journal (sequence INTEGER NOT NULL);"
+                          "INSERT INTO journal (sequence) SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM journal);"
+                          "CREATE TABLE IF NOT EXISTS idempotency (user INTEGER NOT NULL, type INTEGER NOT NULL, "
+                          "key TEXT NOT NULL, token TEXT, fee REAL, balance REAL, time INTEGER NOT NULL, "
+                          "PRIMARY KEY (user, type, key));"
+                          "CREATE INDEX IF NOT EXISTS idempotency_time ON idempotency (time);"
+                          "CREATE TABLE IF NOT EXISTS outbox (token TEXT PRIMARY KEY, user INTEGER, bank INTEGER, "
+                          "source TEXT, destination TEXT, amount REAL);"
+                          "CREATE TABLE IF NOT EXISTS batch (id INTEGER PRIMARY KEY, day INTEGER, days INTEGER, "
+                          "position INTEGER);"
+                          "CREATE TABLE IF NOT EXISTS rates (bank INTEGER PRIMARY KEY, "
+                          "interest REAL NOT NULL DEFAULT 0, fee REAL NOT NULL DEFAULT 0);"
+                          "CREATE TABLE IF NOT EXISTS fee_rules (from_bank INTEGER, to_bank INTEGER, "
+                          "amount REAL NOT NULL DEFAULT 0, flat REAL NOT NULL DEFAULT 0, "
+                          "percent REAL NOT NULL DEFAULT 0, minimum REAL NOT NULL DEFAULT 0, "
+                          "maximum REAL NOT NULL DEFAULT 0);"
+                          "CREATE TABLE IF NOT EXISTS standing_orders (token TEXT PRIMARY KEY, user INTEGER, "
+                          "bank INTEGER, source TEXT, destination TEXT, amount REAL, due INTEGER, period REAL, "
+                          "day INTEGER);";
+        if (sqlite3_exec(_db, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+            std::cout << "[server] can not prepare journal table: " << error << std::endl;
+            sqlite3_free(error);
+            return false;
+        }
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(_db, "SELECT sequence FROM journal", -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            _applied = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+
+        // open the journal located next to the database
+        return _journal.open("banking.journal", _applied);
+    }
+
+    bool Server::_restore() {
+        const uint64_t now = Tools::Tools::monotonic_time();
+        _applied_time = now;
+        _snapshot_time = now;
+
+        // the database must have the records the journal dropped, or it can never catch up with the journal
+        if (_journal.first() > _applied + 1) {
+            std::cout << "[server] journal starts at record " << _journal.first() << " but the database only has "
+                      << "the records up to " << _applied << ", it is older than the journal" << std::endl;
+            return false;
+        }
+
+        // start from the latest snapshot if the journal continues where it ends
+        Snapshot snapshot;
+        if (snapshot.read("banking.snapshot") && snapshot.sequence() <= _journal.sequence() &&
+            (snapshot.sequence() == _journal.sequence() || _journal.record(snapshot.sequence() + 1) != nullptr)) {
+            _ledger.assign(snapshot.accounts(), snapshot.account_count(), snapshot.sequence());
+            const std::vector<SessionState> sessions = snapshot.sessions();
+            _user_sessions.restore(sessions, now);
+            _snapshot_sequence = snapshot.sequence();
+            _snapshot_written = snapshot.sequence();
+
+            // replay the journal records after the snapshot, the database catches up in the background
+            for (uint64_t sequence = snapshot.sequence() + 1; sequence <= _journal.sequence(); sequence++) {
+                _ledger.apply(*_journal.record(sequence));
+            }
+
+            // the keys of the records the database does not have yet are only in the journal
+            for (uint64_t sequence = _applied + 1; sequence <= _journal.sequence(); sequence++) {
+                _idempotency.insert(*_journal.record(sequence));
+            }
+            std::cout << "[server] restored " << snapshot.account_count() << " accounts and " << sessions.size()
+                      << " sessions from snapshot at sequence " << snapshot.sequence() << ", replayed "
+                      << _journal.sequence() - snapshot.sequence() << " journal records" << std::endl;
+            _restored = true;
+            return _load_outbox() && _load_batch() && _load_orders();
+        }
+
+        // otherwise replay what the database missed and load the ledger from it
+        std::size_t replayed = 0;
+        while (_journal.sequence() > _applied) {
+            const std::size_t applied = _apply_journal(1024);
+            if (applied == 0) {
+                return false;
+            }
+            replayed += applied;
+        }
+        if (replayed > 0) {
+            std::cout << "[server] replayed " << replayed << " journal records" << std::endl;
+        }
+        _applied_time = Tools::Tools::monotonic_time();
+        _restored = _ledger.load(_db, _applied);
+        return _restored && _load_outbox() && _load_batch() && _load_orders();
+    }
+
+    void Server::_take_snapshot(bool wait) {
+
+        // the previous snapshot must be written completely first
+        if (_snapshot_thread.joinable()) {
+            _snapshot_thread.join();
+        }
+
+        // the sessions are few, copy them right away
+        std::vector<SessionState> sessions = _user_sessions.save(Tools::Tools::monotonic_time());
+        _snapshot_sequence = _ledger.sequence();
+        _snapshot_time = Tools::Tools::monotonic_time();
+
+        // copy the accounts through the versions of their balances and write them out, while requests change them
+        // the IBANs, users and banks never change, and the versions give the balances as of one journal record
+        auto write = [this](const std::vector<SessionState> &sessions) {
+            const std::vector<LedgerAccount> &ledger_accounts = _ledger.accounts();
+            std::vector<LedgerAccount> accounts(ledger_accounts.size());
+            std::vector<double_t> balances(ledger_accounts.size());
+            const uint64_t sequence = _ledger.read(balances.data());
+            for (std::size_t i = 0; i < accounts.size(); i++) {
+                accounts[i].iban = ledger_accounts[i].iban;
+                accounts[i].user = ledger_accounts[i].user;
+                accounts[i].bank = ledger_accounts[i].bank;
+                accounts[i].balance = balances[i];
+            }
+            if (Snapshot::write("banking.snapshot", sequence, accounts, sessions)) {
+                _snapshot_written = sequence;
+                std::cout << "[server] took snapshot at sequence " << sequence << std::endl;
+            }
+            _snapshot_running = false;
+        };
+        _snapshot_running = true;
+        if (wait) {
+            write(sessions);
+        } else {
+            _snapshot_thread = std::thread(write, std::move(sessions));
+        }
+    }
+
+    bool Server::_journal_mutation(JournalRecord &record) {
+        Tools::Span span("server", "journal");
+        if (_journal.append(record) == 0) {
+            return false;
+        }
+        _ledger.apply(record);
+        _idempotency.insert(record);
+        _orders.apply(record);
+        if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_OUT) {
+            _outbox[record.token] = record;
+        } else if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_DONE) {
+            _outbox.erase(record.token);
+        }
+
+        // send the record to the backups exactly as it was journaled
+        if (_publisher) {
+            const auto *data = reinterpret_cast<const char *>(_journal.record(record.sequence));
+            REPLICATION replication;
+            replication.sequence = record.sequence;
+            replication.records.assign(data, data + sizeof(JournalRecord));
+            _publish(replication);
+        }
+        return true;
+    }
+
+    bool Server::_journal_mutations(std::vector<JournalRecord> &records) {
+        Tools::Span span("server", "journal", (int64_t) records.size());
+        if (records.empty() || _journal.append(records.data(), records.size()) == 0) {
+            return false;
+        }
+        for (const JournalRecord &record: records) {
+            _ledger.apply(record);
+            _idempotency.insert(record);
+            _orders.apply(record);
+            if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_OUT) {
+                _outbox[record.token] = record;
+            } else if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_DONE) {
+                _outbox.erase(record.token);
+            }
+        }
+
+        // send the records to the backups in slices small enough for one message each
+        const std::size_t slice = 1024;
+        for (std::size_t i = 0; _publisher && i < records.size(); i += slice) {
+            const std::size_t count = std::min(slice, records.size() - i);
+            const auto *data = reinterpret_cast<const char *>(_journal.record(records[i].sequence));
+            REPLICATION replication;
+            replication.sequence = records[i + count - 1].sequence;
+            replication.records.assign(data, data + count * sizeof(JournalRecord));
+            _publish(replication);
+        }
+        return true;
+    }
+
+    void Server::_publish(REPLICATION &replication) {
+        if (!_publisher) {
+            return;
+        }
+
+        // pack the REPLICATION message
+        std::stringstream buffer;
+        msgpack::pack(buffer, MSG{MSG_ID::REPLICATION, msgpack::object(replication, _z)});
+        const std::string payload = buffer.str();
+        _z.clear();
+
+        // publish the REPLICATION message, a backup that can not keep up asks for what it missed later
+        _publisher.send(zmq::buffer(payload), zmq::send_flags::dontwait);
+        _publish_time = Tools::Tools::monotonic_time();
+    }
+
+    void Server::_follow_primary() {
+
+        // apply the changes published by the primary, a malformed one is dropped and fetched again later
+        zmq::message_t message;
+        while (_subscriber.recv(message, zmq::recv_flags::dontwait)) {
+            try {
+                msgpack::object_handle result =
+                        msgpack::unpack(static_cast<const char *>(message.data()), message.size());
+                MSG msg;
+                result.get().convert(msg);
+                if (msg.id == MSG_ID::REPLICATION) {
+                    REPLICATION replication;
+                    msg.msg.convert(replication);
+                    _apply_replication(replication);
+                }
+            } catch (const msgpack::unpack_error &) {
+                std::cout << "[server] dropped a malformed message of the primary" << std::endl;
+            } catch (const msgpack::type_error &) {
+                std::cout << "[server] dropped a malformed message of the primary" << std::endl;
+            }
+        }
+
+        // wait a second for the answer to the last request, the server goes on handling requests meanwhile
+        const uint64_t now = Tools::Tools::monotonic_time();
+        if (_sync_waiting) {
+            if (now - _sync_time < 1000) {
+                return;
+            }
+            _sync_waiting = false;
+            std::cout << "[server] primary did not answer REPLICATION_REQUEST" << std::endl;
+        }
+
+        // ask the primary for the sessions once, and for the records that did not arrive
+        // a backup that is up to date still asks every few seconds, so that the primary keeps the records it may miss
+        const bool behind = !_synced || _primary_sequence > _journal.sequence();
+        if (now - _sync_time < (behind ? 100 : 5000)) {
+            return;
+        }
+        _sync_time = now;
+        REPLICATION_REQUEST replication_request;
+        replication_request.from = _journal.sequence() + 1;
+        replication_request.sessions = !_synced;
+        msgpack::zone zone;
+        std::stringstream buffer;
+        msgpack::pack(buffer, MSG{MSG_ID::REPLICATION_REQUEST, msgpack::object(replication_request, zone)});
+        const std::string payload = buffer.str();
+
+        // number the request, the primary sends the number back with its answer
+        const uint64_t call = _sync_call + 1;
+        if (!_primary.send(zmq::buffer(&call, sizeof(call)), zmq::send_flags::sndmore | zmq::send_flags::dontwait) ||
+            !_primary.send(zmq::buffer(payload), zmq::send_flags::dontwait)) {
+            std::cout << "[server] can not ask the primary" << std::endl;
+            return;
+        }
+        _sync_call = call;
+        _sync_waiting = true;
+        _sync_sessions = replication_request.sessions;
+    }
+
+    void Server::_receive_replication() {
+
+        // receive the number of the request and the answer
+        zmq::message_t call;
+        zmq::message_t message;
+        if (!_primary.recv(call, zmq::recv_flags::dontwait) || !call.more() ||
+            !_primary.recv(message, zmq::recv_flags::dontwait)) {
+            return;
+        }
+        while (message.more()) {
+            if (!_primary.recv(message, zmq::recv_flags::dontwait)) {
+                return;
+            }
+        }
+        uint64_t number = 0;
+        if (call.size() == sizeof(number)) {
+            std::memcpy(&number, call.data(), sizeof(number));
+        }
+        if (!_sync_waiting || number != _sync_call) {
+            std::cout << "[server] dropped an answer of the primary that came too late" << std::endl;
+            return;
+        }
+        _sync_waiting = false;
+
+        // unpack the answer, a malformed one is asked for again
+        REPLICATION replication;
+        try {
+            msgpack::object_handle result = msgpack::unpack(static_cast<const char *>(message.data()), message.size());
+            MSG msg;
+            result.get().convert(msg);
+            if (msg.id != MSG_ID::REPLICATION) {
+                return;
+            }
+            msg.msg.convert(replication);
+        } catch (const msgpack::unpack_error &) {
+            std::cout << "[server] dropped a malformed message of the primary" << std::endl;
+            return;
+        } catch (const msgpack::type_error &) {
+            std::cout << "[server] dropped a malformed message of the primary" << std::endl;
+            return;
+        }
+
+        // the sessions of the primary replace the ones the backup had
+        if (_sync_sessions) {
+            for (const SessionState &state: _user_sessions.save(Tools::Tools::monotonic_time())) {
+                _user_sessions.remove(state.login_response.id);
+            }
+            _synced = true;
+        }
+        _apply_replication(replication);
+        std::cout << "[server] synced with primary at sequence " << _journal.sequence() << " of "
+                  << _primary_sequence << std::endl;
+    }
+
+    void Server::_apply_replication(const REPLICATION &replication) {
+        _primary_sequence = std::max(_primary_sequence, replication.sequence);
+
+        // journal and apply the records that follow the last one, the others were seen already or are fetched later
+        for (std::size_t offset = 0; offset + sizeof(JournalRecord) <= replication.records.size();
+             offset += sizeof(JournalRecord)) {
+            JournalRecord record;
+            std::memcpy(&record, replication.records.data() + offset, sizeof(record));
+            if (record.sequence != _journal.sequence() + 1) {
+                continue;
+            }
+            if (_journal.replicate(record) == 0) {
+                std::cout << "[server] can not replicate journal record " << record.sequence << std::endl;
+                break;
+            }
+            _ledger.apply(record);
+            _idempotency.insert(record);
+            _orders.apply(record);
+        }
+
+        // follow the sessions
+        const uint64_t now = Tools::Tools::monotonic_time();
+        for (const LOGIN_RESPONSE &login_response: replication.logins) {
+            _user_sessions.add(login_response, now);
+        }
+        for (const uint32_t user: replication.logouts) {
+            _user_sessions.remove(user);
+        }
+    }
+
+    void Server::_receive_replication_request() {
+        if (!_receive_from(_replicas)) {
+            return;
+        }
+
+        // the backups only ask for what they missed
+        if (_msg.id != MSG_ID::REPLICATION_REQUEST) {
+            std::cout << "[server] dropped a message of a backup that is not a REPLICATION_REQUEST" << std::endl;
+            return;
+        }
+        REPLICATION_REQUEST replication_request;
+        try {
+            _msg.msg.convert(replication_request);
+        } catch (const msgpack::type_error &) {
+            std::cout << "[server] dropped a malformed message of a backup" << std::endl;
+            return;
+        }
+        std::cout << "[server] got REPLICATION_REQUEST" << std::endl;
+        _handle_replication_request(replication_request);
+    }
+
+    void Server::_handle_replication_request(const REPLICATION_REQUEST &replication_request) {
+
+        // keep the records the backup has not asked for yet
+        if (!_envelope.empty()) {
+            _backups[_envelope.front()] = Backup{std::max<uint64_t>(replication_request.from, 1),
+                                                 Tools::Tools::monotonic_time()};
+        }
+
+        // create a REPLICATION
+        REPLICATION replication;
+        replication.sequence = _journal.sequence();
+
+        // fill the REPLICATION with the records from the requested one on, a batch at a time
+        const JournalRecord *first = _journal.record(replication_request.from);
+        if (first != nullptr) {
+            const uint64_t count = std::min<uint64_t>(_journal.sequence() - replication_request.from + 1, 1024);
+            const auto *data = reinterpret_cast<const char *>(first);
+            replication.records.assign(data, data + count * sizeof(JournalRecord));
+        } else if (replication_request.from <= _journal.sequence()) {
+            std::cout << "[server] journal does not hold record " << replication_request.from << " anymore"
+                      << std::endl;
+        }
+
+        // fill the REPLICATION with all sessions if asked
+        if (replication_request.sessions) {
+            for (const SessionState &state: _user_sessions.save(Tools::Tools::monotonic_time())) {
+                replication.logins.push_back(state.login_response);
+            }
+        }
+
+        // send the REPLICATION
+        _msg = MSG{MSG_ID::REPLICATION, msgpack::object(replication, _z)};
+        _send_message();
+        std::cout << "[server] sent REPLICATION" << std::endl;
+    }
+
+    bool Server::_owns(uint16_t bank) const {
+        return _shard_map.size() == 0 || _shard_map.shard(bank) == _shard;
+    }
+
+    Tools::Task<bool> Server::_find_bank(IBAN iban, uint16_t &bank) {
+
+        // every shard starts from the whole database, so it knows the banks of the accounts it does not own
+        bool found = false;
+        co_await _query([&](sqlite3 *db) {
+            sqlite3_stmt *stmt;
+            std::string sql = "SELECT bank FROM accounts WHERE iban = ?";
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+                return;
+            }
+            sqlite3_bind_text(stmt, 1, iban.data(), (int) iban.size(), SQLITE_STATIC);
+            found = sqlite3_step(stmt) == SQLITE_ROW;
+            if (found) {
+                bank = (uint16_t) sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        });
+        co_return found;
+    }
+
+    bool Server::_load_outbox() {
+        _outbox.clear();
+
+        // load the transactions the database has applied
+        sqlite3_stmt *stmt;
+        std::string sql = "SELECT token, user, bank, source, destination, amount FROM outbox";
+        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            JournalRecord record{};
+            record.type = JOURNAL_RECORD_TYPE::TRANSFER_OUT;
+            record.token = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+            record.user = (uint32_t) sqlite3_column_int(stmt, 1);
+            record.bank = (uint16_t) sqlite3_column_int(stmt, 2);
+            record.from = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+            record.to = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4));
+            record.amount = sqlite3_column_double(stmt, 5);
+            _outbox[record.token] = record;
+        }
+        sqlite3_finalize(stmt);
+
+        // then the ones in the journal tail the database has not applied yet
+        for (uint64_t sequence = _applied + 1; sequence <= _journal.sequence(); sequence++) {
+            const JournalRecord &record = *_journal.record(sequence);
+            if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_OUT) {
+                _outbox[record.token] = record;
+            } else if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_DONE) {
+                _outbox.erase(record.token);
+            }
+        }
+        if (!_outbox.empty()) {
+            std::cout << "[server] " << _outbox.size() << " transactions to other shards are not confirmed yet"
+                      << std::endl;
+        }
+        return true;
+    }
+
+    bool Server::_load_batch() {
+
+        // load how far the database got
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(_db, "SELECT day, days, position FROM batch WHERE id = 0", -1, &stmt,
+                               nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+            return false;
+        }
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            _batch_day = (uint32_t) sqlite3_column_int64(stmt, 0);
+            _batch_days = (uint32_t) sqlite3_column_int64(stmt, 1);
+            _batch_position = (uint32_t) sqlite3_column_int64(stmt, 2);
+        }
+        sqlite3_finalize(stmt);
+
+        // then the progress in the journal tail the database has not applied yet
+        for (uint64_t sequence = _applied + 1; sequence <= _journal.sequence(); sequence++) {
+            const JournalRecord &record = *_journal.record(sequence);
+            if (record.type == JOURNAL_RECORD_TYPE::BATCH) {
+                _batch_day = record.day;
+                _batch_days = record.days;
+                _batch_position = record.position;
+            }
+        }
+        if (_batch_day != 0 && _batch_position != batch_done) {
+            std::cout << "[server] end-of-day batch of day " << _batch_day << " continues from account "
+                      << _batch_position << std::endl;
+        }
+        return true;
+    }
+
+    void Server::_run_end_of_day() {
+        if (!_restored) {
+            return;
+        }
+        const auto today = (uint32_t) (Tools::Tools::system_time() / (24 * 60 * 60 * 1000));
+
+        // the first start only marks the day, interest accrues from then on
+        if (_batch_day == 0) {
+            JournalRecord record;
+            record.type = JOURNAL_RECORD_TYPE::BATCH;
+            record.day = today;
+            record.position = batch_done;
+            if (_journal_mutation(record)) {
+                _batch_day = today;
+                _batch_position = batch_done;
+            }
+            return;
+        }
+
+        // start the batch of a new day, or continue the one that was interrupted
+        if (!_end_of_day.running()) {
+            if (_batch_position == batch_done && today <= _batch_day) {
+                return;
+            }
+            std::unordered_map<uint16_t, EndOfDay::Rate> rates;
+            sqlite3_stmt *stmt;
+            if (sqlite3_prepare_v2(_db, "SELECT bank, interest, fee FROM rates", -1, &stmt, nullptr) != SQLITE_OK) {
+                std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+                return;
+            }
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                rates[(uint16_t) sqlite3_column_int(stmt, 0)] = {sqlite3_column_double(stmt, 1),
+                                                                 sqlite3_column_double(stmt, 2)};
+            }
+            sqlite3_finalize(stmt);
+            if (_batch_position == batch_done) {
+                _batch_days = today - _batch_day;
+                _batch_day = today;
+                _batch_position = 0;
+                std::cout << "[server] started end-of-day batch of day " << today << " covering " << _batch_days
+                          << " days" << std::endl;
+            }
+            _end_of_day.begin(_batch_day, _batch_days, _batch_position, (uint32_t) _ledger.accounts().size(),
+                              std::move(rates));
+
+            // without accounts left the day is finished right away
+            if (!_end_of_day.running()) {
+                JournalRecord record;
+                record.type = JOURNAL_RECORD_TYPE::BATCH;
+                record.day = _batch_day;
+                record.days = _batch_days;
+                record.position = batch_done;
+                if (_journal_mutation(record)) {
+                    _batch_position = batch_done;
+                }
+                return;
+            }
+        }
+
+        // journal the postings of the computed chunk, then compute the next one
+        std::vector<EndOfDay::Posting> postings;
+        uint32_t position;
+        if (_end_of_day.take(postings, position)) {
+            std::vector<JournalRecord> records;
+            records.reserve(2 * postings.size() + 1);
+            for (const EndOfDay::Posting &posting: postings) {
+                const LedgerAccount &account = _ledger.accounts()[posting.account];
+                double_t balance = account.balance;
+                JournalRecord record;
+                record.user = account.user;
+                record.bank = account.bank;
+                Tools::Tools::random_token(record.token.data(), Token::capacity());
+                record.token.resize(Token::capacity());
+
+                // amounts are posted in whole cents
+                const double_t interest = std::round(posting.interest * 100) / 100;
+                if (interest >= 0.01) {
+                    balance += interest;
+                    record.type = JOURNAL_RECORD_TYPE::INTEREST;
+                    record.to = account.iban;
+                    record.amount = interest;
+                    record.balance = balance;
+                    records.push_back(record);
+                }
+                const double_t fee = std::round(posting.fee * 100) / 100;
+                if (fee >= 0.01) {
+                    balance -= fee;
+                    record.type = JOURNAL_RECORD_TYPE::FEE;
+                    Tools::Tools::random_token(record.token.data(), Token::capacity());
+                    record.from = account.iban;
+                    record.to = IBAN();
+                    record.amount = 0;
+                    record.fee = (float_t) fee;
+                    record.balance = balance;
+                    records.push_back(record);
+                }
+            }
+            JournalRecord batch;
+            batch.type = JOURNAL_RECORD_TYPE::BATCH;
+            batch.day = _batch_day;
+            batch.days = _batch_days;
+            batch.position = _end_of_day.running() ? position : batch_done;
+            records.push_back(batch);
+            if (!_journal_mutations(records)) {
+                std::cout << "[server] can not journal end-of-day postings" << std::endl;
+                return;
+            }
+            _batch_position = batch.position;
+            if (_batch_position == batch_done) {
+                std::cout << "[server] finished end-of-day batch of day " << _batch_day << std::endl;
+            }
+        }
+        _end_of_day.compute(_ledger);
+    }
+
+    bool Server::_load_orders() {
+
+        // load the orders the database has applied
+        if (!_orders.load(_db)) {
+            return false;
+        }
+
+        // then the ones in the journal tail the database has not applied yet
+        for (uint64_t sequence = _applied + 1; sequence <= _journal.sequence(); sequence++) {
+            _orders.apply(*_journal.record(sequence));
+        }
+        if (_orders.size() > 0) {
+            std::cout << "[server] loaded " << _orders.size() << " standing orders" << std::endl;
+        }
+        return true;
+    }
+
+    void Server::_run_standing_orders() {
+        if (!_restored) {
+            return;
+        }
+        const uint64_t now = Tools::Tools::system_time();
+        const uint64_t started = Tools::Tools::monotonic_time();
+
+        // run the due orders a batch at a time, for a short while so that requests are not held up
+        std::vector<StandingOrders::Order> due;
+        std::vector<JournalRecord> records;
+        std::vector<std::pair<uint32_t, double_t>> admitted;
+        std::unordered_map<const LedgerAccount *, double_t> balances;
+        do {
+            due.clear();
+            _orders.take(now, due, 4096);
+            if (due.empty()) {
+                return;
+            }
+            records.clear();
+            admitted.clear();
+            balances.clear();
+            records.reserve(2 * due.size());
+            std::size_t skipped = 0;
+            for (const StandingOrders::Order &order: due) {
+                const LedgerAccount *from = _ledger.find(order.from);
+                const LedgerAccount *to = _ledger.find(order.to);
+
+                // a transaction to another shard needs a lookup of its bank first, so it is made on its own
+                if (from != nullptr && to == nullptr && _shard_map.size() > 0) {
+                    _transfer_order(order).detach();
+                } else {
+
+                    // the balances of the batch so far, the ledger has them only once it is journaled
+                    float_t fee = 0.0;
+                    const bool payable = from != nullptr && to != nullptr && from->user == order.user &&
+                                         _fees.fee(from->bank, to->bank, order.amount, fee);
+                    auto balance = payable ? balances.try_emplace(from, from->balance).first : balances.end();
+                    const auto account = payable ? static_cast<uint32_t>(from - _ledger.accounts().data()) : 0;
+                    if (!payable || balance->second < order.amount + fee ||
+                        !_limits.admit(account, order.amount, started)) {
+                        skipped++;
+                    } else {
+                        balance->second -= order.amount + fee;
+                        auto credited = balances.find(to);
+                        if (credited != balances.end()) {
+                            credited->second += order.amount;
+                        }
+                        admitted.emplace_back(account, order.amount);
+                        JournalRecord record{};
+                        record.type = JOURNAL_RECORD_TYPE::TRANSACTION;
+                        record.user = order.user;
+                        record.bank = order.bank;
+                        record.token.resize(Token::capacity());
+                        Tools::Tools::random_token(record.token.data(), record.token.size());
+                        record.from = order.from;
+                        record.to = order.to;
+                        record.amount = order.amount;
+                        record.fee = fee;
+                        record.balance = balance->second;
+                        records.push_back(record);
+                    }
+                }
 
-        // create a ACCOUNT_LIST_RESPONSE
-        ACCOUNT_LIST_RESPONSE account_list_response;
+                // move the order to its next due time, or remove it after its last transfer
+                const uint64_t next = StandingOrders::next(order.due, order.period, order.day, now);
+                JournalRecord record{};
+                record.type = next != 0 ? JOURNAL_RECORD_TYPE::ORDER : JOURNAL_RECORD_TYPE::ORDER_DELETE;
+                record.user = order.user;
+                record.bank = order.bank;
+                record.token = order.token;
+                record.from = order.from;
+                record.to = order.to;
+                if (next != 0) {
+                    record.amount = order.amount;
+                    record.due = next;
+                    record.period = order.period;
+                    record.day = order.day;
+                }
+                records.push_back(record);
+            }
 
-        // check if the user has already logged in and the token is valid
-        int token_index = -1;
-        for (int i = 0; i < _user_sessions.size(); i++) {
-            if (_user_sessions[i].id == account_list_request.user) {
-                if (_user_sessions[i].token == account_list_request.token) {
-                    token_index = i;
+            // a batch that can not be journaled is taken again a minute later
+            if (!_journal_mutations(records)) {
+                for (const auto &[account, amount]: admitted) {
+                    _limits.refund(account, amount, started);
                 }
-                break;
+                for (const StandingOrders::Order &order: due) {
+                    _orders.postpone(order.token, now + 60 * 1000);
+                }
+                std::cout << "[server] can not journal standing orders" << std::endl;
+                return;
             }
-        }
+            std::cout << "[server] ran " << due.size() << " standing orders, " << skipped << " of them were not paid"
+                      << std::endl;
+        } while (Tools::Tools::monotonic_time() - started < 50);
+    }
 
-        // check if the user has already logged in
-        if (token_index != -1) {
+    Tools::Task<> Server::_transfer_order(StandingOrders::Order order) {
 
-            // get the accounts from the database
-            bool error = false;
-            sqlite3_stmt *stmt;
-            std::string sql = "SELECT iban, user, bank, balance FROM accounts WHERE user = ? AND bank = ?";
-            if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-                std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-                error = true;
-            }
+        // the fee depends on the bank of the to account, which the other shard owns
+        uint16_t to_bank;
+        if (!co_await _find_bank(order.to, to_bank) || _owns(to_bank)) {
+            std::cout << "[server] to account of standing order " << order.token << " not found" << std::endl;
+            co_return;
+        }
 
-            // fill the ACCOUNT_LIST_RESPONSE
-            if (!error) {
-                sqlite3_bind_int(stmt, 1, (int) account_list_request.user);
-                sqlite3_bind_int(stmt, 2, account_list_request.bank);
-                while (sqlite3_step(stmt) == SQLITE_ROW) {
-                    Account account{};
-                    account.iban = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-                    account.user = sqlite3_column_int(stmt, 1);
-                    account.bank = sqlite3_column_int(stmt, 2);
-                    account.balance = sqlite3_column_double(stmt, 3);
-                    account_list_response.accounts.push_back(account);
-                }
-            }
-            sqlite3_finalize(stmt);
+        // the order was checked when it was registered, and the other shard does not forget accounts,
+        // so the transaction is decided without asking that shard first
+        const LedgerAccount *from = _ledger.find(order.from);
+        float_t fee = 0.0;
+        if (from == nullptr || from->user != order.user || !_fees.fee(from->bank, to_bank, order.amount, fee) ||
+            from->balance < order.amount + fee) {
+            std::cout << "[server] standing order " << order.token << " was not paid" << std::endl;
+            co_return;
+        }
+        const auto account = static_cast<uint32_t>(from - _ledger.accounts().data());
+        const uint64_t admitted = Tools::Tools::monotonic_time();
+        if (!_limits.admit(account, order.amount, admitted)) {
+            std::cout << "[server] standing order " << order.token << " was not paid" << std::endl;
+            co_return;
         }
 
-        // send the ACCOUNT_LIST_RESPONSE
-        _send_account_list_response(account_list_response);
-        std::cout << "[server] sent ACCOUNT_LIST_RESPONSE" << std::endl;
+        // journal it and have the other shard credit it now or retry later
+        JournalRecord record{};
+        record.type = JOURNAL_RECORD_TYPE::TRANSFER_OUT;
+        record.user = order.user;
+        record.bank = order.bank;
+        record.token.resize(Token::capacity());
+        Tools::Tools::random_token(record.token.data(), record.token.size());
+        record.from = order.from;
+        record.to = order.to;
+        record.amount = order.amount;
+        record.fee = fee;
+        record.balance = from->balance - order.amount - fee;
+        if (!_journal_mutation(record)) {
+            _limits.refund(account, order.amount, admitted);
+            std::cout << "[server] can not journal standing order " << order.token << std::endl;
+            co_return;
+        }
+        co_await _commit_transfer(record);
     }
 
-    void Server::_send_add_balance_response(ADD_BALANCE_RESPONSE &add_balance_response) {
+    Token Server::_sign(MSG_ID id, const TRANSFER &transfer) const {
 
-        // pack the ADD_BALANCE_RESPONSE message
-        _msg = MSG{MSG_ID::ADD_BALANCE_RESPONSE, msgpack::object(add_balance_response, _z)};
+        // sign everything the other shard acts on, and whether it is a prepare or a commit
+        std::string data;
+        const auto type = static_cast<uint16_t>(id);
+        data.append(reinterpret_cast<const char *>(&type), sizeof(type));
+        for (const std::string_view field: {transfer.token.view(), transfer.from.view(), transfer.to.view()}) {
+            data.push_back(static_cast<char>(field.size()));
+            data.append(field);
+        }
+        data.append(reinterpret_cast<const char *>(&transfer.amount), sizeof(transfer.amount));
+        return _mac(data);
+    }
 
-        // send the ADD_BALANCE_RESPONSE message
-        _send_message();
+    Token Server::_sign(const HANDOFF_REQUEST &handoff_request) const {
+        std::string data;
+        const auto type = static_cast<uint16_t>(MSG_ID::HANDOFF_REQUEST);
+        data.append(reinterpret_cast<const char *>(&type), sizeof(type));
+        data.append(reinterpret_cast<const char *>(&handoff_request.time), sizeof(handoff_request.time));
+        return _mac(data);
     }
 
-    void Server::_handle_add_balance_request(ADD_BALANCE_REQUEST &add_balance_request,
-                                             ADD_BALANCE_RESPONSE &add_balance_response) {
+    Token Server::_mac(const std::string &data) const {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        HMAC(EVP_sha256(), _secret.data(), static_cast<int>(_secret.size()),
+             reinterpret_cast<const unsigned char *>(data.data()), data.size(), digest, &size);
+        Token mac;
+        mac.assign(reinterpret_cast<const char *>(digest), size);
+        return mac;
+    }
 
-        // check if the user has already logged in and the token is valid
-        int user_index = -1;
-        bool valid_token;
-        for (int i = 0; i < _user_sessions.size(); i++) {
-            if (_user_sessions[i].id == add_balance_request.user) {
-                user_index = i;
-                valid_token = (_user_sessions[i].token == add_balance_request.token);
-                break;
+    bool Server::_receive_from(zmq::socket_t &socket) {
+
+        // receive a message, the frames before the payload tell which server it came from
+        zmq::message_t message;
+        if (!socket.recv(message, zmq::recv_flags::dontwait)) {
+            return false;
+        }
+        _envelope.clear();
+        while (message.more()) {
+            _envelope.push_back(message.to_string());
+            if (!socket.recv(message, zmq::recv_flags::dontwait)) {
+                return false;
             }
         }
-
-        // check if the user has already logged in
-        if (user_index == -1) {
-            std::cout << "[server] user has not logged in" << std::endl;
-            return;
+        _origin = &socket;
+
+        // unpack the message, kept until the next one since the MSG points into it
+        try {
+            const std::string payload = message.to_string();
+            std::size_t off = 0;
+            msgpack::unpack(_handle, payload.data(), payload.size(), off);
+            _msg = MSG{};
+            _handle.get().convert(_msg);
+        } catch (const msgpack::unpack_error &) {
+            std::cout << "[server] dropped a malformed message of another server" << std::endl;
+            return false;
+        } catch (const msgpack::type_error &) {
+            std::cout << "[server] dropped a malformed message of another server" << std::endl;
+            return false;
         }
+        return true;
+    }
 
-        // check if the token is valid
-        if (!valid_token) {
-            std::cout << "[server] invalid token" << std::endl;
+    void Server::_receive_peer_request() {
+        if (!_receive_from(_peers)) {
             return;
         }
 
-        // fill the ADD_BALANCE_RESPONSE
-        add_balance_response.user = add_balance_request.user;
-        add_balance_response.token = add_balance_request.token;
-        add_balance_response.bank = add_balance_request.bank;
-        add_balance_response.iban = add_balance_request.iban;
-
-        // add the balance to the account
-        sqlite3_stmt *stmt;
-        std::string sql = "UPDATE accounts SET balance = balance + ? WHERE iban = ? AND user = ? AND bank = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+        // the other shards send only transactions
+        if (_msg.id != MSG_ID::TRANSFER_PREPARE && _msg.id != MSG_ID::TRANSFER_COMMIT) {
+            std::cout << "[server] dropped a message of another shard that is not a transaction" << std::endl;
             return;
         }
-        sqlite3_bind_double(stmt, 1, add_balance_request.amount);
-        sqlite3_bind_text(stmt, 2, add_balance_request.iban.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, (int) add_balance_request.user);
-        sqlite3_bind_int(stmt, 4, add_balance_request.bank);
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            std::cout << "[server] can not update balance: " << sqlite3_errmsg(_db) << std::endl;
+        TRANSFER transfer;
+        try {
+            _msg.msg.convert(transfer);
+        } catch (const msgpack::type_error &) {
+            std::cout << "[server] dropped a malformed message of another shard" << std::endl;
             return;
         }
-        sqlite3_finalize(stmt);
 
-        // get the new balance from the database
-        sql = "SELECT balance FROM accounts WHERE iban = ? AND user = ? AND bank = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
+        // refuse what is not signed by a shard, and what a backup must not change
+        if (transfer.mac != _sign(_msg.id, transfer) || _backup) {
+            TRANSFER_RESPONSE transfer_response;
+            _msg = MSG{MSG_ID::TRANSFER_RESPONSE, msgpack::object(transfer_response, _z)};
+            _send_message();
+            std::cout << "[server] refused a transaction " << (_backup ? "as a backup" : "that is not signed")
+                      << std::endl;
             return;
         }
-        sqlite3_bind_text(stmt, 1, add_balance_request.iban.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 2, (int) add_balance_request.user);
-        sqlite3_bind_int(stmt, 3, add_balance_request.bank);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
-            std::cout << "[server] can not get balance: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+
+        // handle the message, the span shows the id of the message
+        Tools::Span span("server", "handle", (int64_t) _msg.id);
+        if (_msg.id == MSG_ID::TRANSFER_PREPARE) {
+            std::cout << "[server] got TRANSFER_PREPARE" << std::endl;
+            _handle_transfer_prepare(transfer);
+        } else {
+            std::cout << "[server] got TRANSFER_COMMIT" << std::endl;
+            _handle_transfer_commit(transfer).detach();
         }
-        add_balance_response.amount = sqlite3_column_double(stmt, 0);
-        sqlite3_finalize(stmt);
     }
 
-    void Server::_send_transaction_response(TRANSACTION_RESPONSE &transaction_response) {
-
-        // pack the TRANSACTION_RESPONSE message
-        _msg = MSG{MSG_ID::TRANSACTION_RESPONSE, msgpack::object(transaction_response, _z)};
-
-        // send the TRANSACTION_RESPONSE message
-        _send_message();
+    Server::ShardCall Server::_ask_shard(std::size_t shard, MSG_ID id, TRANSFER transfer) {
+        return ShardCall(*this, shard, id, std::move(transfer));
     }
 
-    void Server::_handle_transaction_request(TRANSACTION_REQUEST &transaction_request,
-                                             TRANSACTION_RESPONSE &transaction_response) {
+    void Server::_receive_shard_response(zmq::socket_t &socket) {
 
-        // check if the user has already logged in and the token is valid
-        int user_index = -1;
-        bool valid_token;
-        for (int i = 0; i < _user_sessions.size(); i++) {
-            if (_user_sessions[i].id == transaction_request.user) {
-                user_index = i;
-                valid_token = (_user_sessions[i].token == transaction_request.token);
-                break;
+        // receive the number of the call and the response
+        zmq::message_t call;
+        zmq::message_t message;
+        if (!socket.recv(call, zmq::recv_flags::dontwait) || !call.more() ||
+            !socket.recv(message, zmq::recv_flags::dontwait)) {
+            return;
+        }
+        while (message.more()) {
+            if (!socket.recv(message, zmq::recv_flags::dontwait)) {
+                return;
             }
         }
-
-        // check if the user has already logged in
-        if (user_index == -1) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::NOT_LOGGED_IN;
-            std::cout << "[server] user has not logged in" << std::endl;
-            return;
+        uint64_t number = 0;
+        if (call.size() == sizeof(number)) {
+            std::memcpy(&number, call.data(), sizeof(number));
         }
-
-        // check if the token is valid
-        if (!valid_token) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_TOKEN;
-            std::cout << "[server] invalid token" << std::endl;
+        auto it = _shard_calls.find(number);
+        if (it == _shard_calls.end()) {
+            std::cout << "[server] dropped a response of another shard that came too late" << std::endl;
             return;
         }
+        ShardCall *shard_call = it->second;
+        _shard_calls.erase(it);
+
+        // unpack the response, a malformed one fails the call
+        std::optional<TRANSFER_RESPONSE> transfer_response;
+        try {
+            msgpack::object_handle handle = msgpack::unpack(static_cast<const char *>(message.data()), message.size());
+            MSG msg;
+            handle.get().convert(msg);
+            if (msg.id == MSG_ID::TRANSFER_RESPONSE) {
+                transfer_response.emplace();
+                msg.msg.convert(*transfer_response);
+            }
+        } catch (const msgpack::unpack_error &) {
+            transfer_response.reset();
+        } catch (const msgpack::type_error &) {
+            transfer_response.reset();
+        }
+        if (!transfer_response) {
+            std::cout << "[server] dropped a malformed response of another shard" << std::endl;
+        }
+        shard_call->answer(std::move(transfer_response));
+    }
 
-        // check if amount is positive
-        if (transaction_response.type == TRANSACTION_RESPONSE_TYPE::TRANSACTION_SUCCESS) {
-            if (transaction_request.amount <= 0) {
-                std::cout << "[server] amount is not positive" << std::endl;
-                transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_AMOUNT;
+    void Server::_expire_shard_calls(uint64_t now) {
+
+        // take the expired calls out first, resuming them may make new ones
+        std::vector<ShardCall *> expired;
+        for (auto it = _shard_calls.begin(); it != _shard_calls.end();) {
+            if (it->second->deadline() <= now) {
+                expired.push_back(it->second);
+                it = _shard_calls.erase(it);
+            } else {
+                ++it;
             }
         }
+        for (ShardCall *shard_call: expired) {
+            std::cout << "[server] shard did not answer" << std::endl;
+            shard_call->answer(std::nullopt);
+        }
+    }
 
-        // SQL statements
-        sqlite3_stmt *stmt;
-        std::string sql;
+    Tools::Task<bool> Server::_commit_transfer(JournalRecord record) {
 
-        // check if from account exists
-        sql = "SELECT balance FROM accounts WHERE iban = ? AND user = ? AND bank = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        // have the other shard credit the to account, unless it is being asked already
+        uint16_t to_bank;
+        if (_shard_map.size() == 0 || !_committing.insert(record.token).second) {
+            co_return false;
         }
-        sqlite3_bind_text(stmt, 1, transaction_request.from.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 2, (int) transaction_request.user);
-        sqlite3_bind_int(stmt, 3, transaction_request.bank);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_FROM_IBAN;
-            std::cout << "[server] from account not found: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        if (!co_await _find_bank(record.to, to_bank)) {
+            _committing.erase(record.token);
+            co_return false;
+        }
+        TRANSFER transfer;
+        transfer.token = record.token;
+        transfer.from = record.from;
+        transfer.to = record.to;
+        transfer.amount = record.amount;
+        const std::optional<TRANSFER_RESPONSE> transfer_response =
+                co_await _ask_shard(_shard_map.shard(to_bank), MSG_ID::TRANSFER_COMMIT, transfer);
+        _committing.erase(record.token);
+        if (!transfer_response || !transfer_response->ok) {
+            std::cout << "[server] transaction " << record.token << " will be sent again" << std::endl;
+            co_return false;
         }
-        sqlite3_finalize(stmt);
 
-        // check if to account exists
-        sql= "SELECT balance FROM accounts WHERE iban = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        // the transaction is complete, stop sending it
+        JournalRecord done{};
+        done.type = JOURNAL_RECORD_TYPE::TRANSFER_DONE;
+        done.user = record.user;
+        done.bank = record.bank;
+        done.token = record.token;
+        done.from = record.from;
+        done.to = record.to;
+        done.amount = record.amount;
+        co_return _journal_mutation(done);
+    }
+
+    void Server::_handle_transfer_prepare(const TRANSFER &transfer) {
+
+        // vote for the transaction if the to account is here, nothing is kept until it is committed
+        TRANSFER_RESPONSE transfer_response;
+        transfer_response.ok = _ledger.find(transfer.to) != nullptr && std::isfinite(transfer.amount) &&
+                               transfer.amount > 0;
+
+        // send the TRANSFER_RESPONSE
+        _msg = MSG{MSG_ID::TRANSFER_RESPONSE, msgpack::object(transfer_response, _z)};
+        _send_message();
+        std::cout << "[server] sent TRANSFER_RESPONSE" << std::endl;
+    }
+
+    Tools::Task<> Server::_handle_transfer_commit(TRANSFER transfer) {
+        TRANSFER_RESPONSE transfer_response;
+
+        // a commit is sent again until it is confirmed, credit it only once
+        if (!std::isfinite(transfer.amount) || !(transfer.amount > 0)) {
+            std::cout << "[server] amount of transaction " << transfer.token << " is not positive" << std::endl;
+        } else if (co_await _find_idempotent(JOURNAL_RECORD_TYPE::TRANSFER_IN, 0, transfer.token) != nullptr) {
+            transfer_response.ok = true;
+        } else if (const LedgerAccount *account = _ledger.find(transfer.to)) {
+
+            // credit the to account
+            JournalRecord record{};
+            record.type = JOURNAL_RECORD_TYPE::TRANSFER_IN;
+            record.bank = account->bank;
+            record.token = transfer.token;
+            record.key = transfer.token;
+            record.from = transfer.from;
+            record.to = transfer.to;
+            record.amount = transfer.amount;
+            record.balance = account->balance + transfer.amount;
+            transfer_response.ok = _journal_mutation(record);
+        } else {
+            std::cout << "[server] to account of transaction " << transfer.token << " not found" << std::endl;
         }
-        sqlite3_bind_text(stmt, 1, transaction_request.to.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_TO_IBAN;
-            std::cout << "[server] can not get balance: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+
+        // send the TRANSFER_RESPONSE
+        _msg = MSG{MSG_ID::TRANSFER_RESPONSE, msgpack::object(transfer_response, _z)};
+        _send_message();
+        std::cout << "[server] sent TRANSFER_RESPONSE" << std::endl;
+    }
+
+    Tools::Task<const IdempotentResponse *> Server::_find_idempotent(JOURNAL_RECORD_TYPE type, uint32_t user,
+                                                                     Token key) {
+        const IdempotentResponse *response = _idempotency.find(type, user, key);
+        if (response != nullptr) {
+            co_return response;
         }
-        sqlite3_finalize(stmt);
 
-        // apply fee if from account and to account are in the same bank
-        float_t fee = 0.0;
-        uint16_t bank_from, bank_to;
+        // the response may have left the cache but still be in the database
+        const uint64_t since = Tools::Tools::system_time() - _idempotency.window();
+        std::optional<JournalRecord> persisted;
+        co_await _query([&](sqlite3 *db) {
+            sqlite3_stmt *stmt;
+            std::string sql = "SELECT token, fee, balance, time FROM idempotency "
+                              "WHERE user = ? AND type = ? AND key = ? AND time >= ?";
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+                return;
+            }
+            sqlite3_bind_int(stmt, 1, (int) user);
+            sqlite3_bind_int(stmt, 2, (int) type);
+            sqlite3_bind_text(stmt, 3, key.data(), (int) key.size(), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 4, (sqlite3_int64) since);
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                JournalRecord record{};
+                record.type = type;
+                record.user = user;
+                record.key = key;
+                record.token = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+                record.fee = (float_t) sqlite3_column_double(stmt, 1);
+                record.balance = sqlite3_column_double(stmt, 2);
+                record.time = sqlite3_column_int64(stmt, 3);
+                persisted = record;
+            }
+            sqlite3_finalize(stmt);
+        });
+        if (persisted) {
+            _idempotency.insert(*persisted);
+        }
 
-        // get from bank
-        sql = "SELECT bank FROM accounts WHERE iban = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        // look in the cache again, a retry may have been journaled while waiting for the database
+        co_return _idempotency.find(type, user, key);
+    }
+
+    std::size_t Server::_apply_journal(std::size_t limit) {
+        const uint64_t last = std::min<uint64_t>(_journal.sequence(), _applied + limit);
+        if (last <= _applied || _journal.record(_applied + 1) == nullptr) {
+            return 0;
         }
-        sqlite3_bind_text(stmt, 1, transaction_request.from.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_FROM_IBAN;
-            std::cout << "[server] can not get from bank: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+
+        // copy the records, the journal may be remapped while they are written
+        std::vector<JournalRecord> records(_journal.record(_applied + 1), _journal.record(last) + 1);
+        if (!_write_journal(_db, records, Tools::Tools::system_time() - _idempotency.window())) {
+            return 0;
         }
-        bank_from = sqlite3_column_int(stmt, 0);
-        sqlite3_finalize(stmt);
 
-        // get to bank
-        sql = "SELECT bank FROM accounts WHERE iban = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        const std::size_t applied = last - _applied;
+        _applied = last;
+        return applied;
+    }
+
+    Tools::Task<> Server::_reload_fees() {
+
+        // compile off the server thread, transactions keep the old fees until then
+        FeeSchedule fees;
+        bool loaded = false;
+        co_await _query([&](sqlite3 *db) {
+            loaded = fees.load(db);
+        });
+        if (!loaded) {
+            std::cout << "[server] kept the fee rules" << std::endl;
+            co_return;
         }
-        sqlite3_bind_text(stmt, 1, transaction_request.to.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_TO_IBAN;
-            std::cout << "[server] can not get to bank: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        _fees = std::move(fees);
+        std::cout << "[server] reloaded " << _fees.size() << " fee rules" << std::endl;
+    }
+
+    Tools::Task<> Server::_flush_journal(std::size_t limit) {
+        const uint64_t last = std::min<uint64_t>(_journal.sequence(), _applied + limit);
+        if (last <= _applied || _journal.record(_applied + 1) == nullptr) {
+            co_return;
         }
-        bank_to = sqlite3_column_int(stmt, 0);
-        sqlite3_finalize(stmt);
 
-        // from account and to account are not in the same bank
-        if (bank_from != bank_to) {
+        // write a copy of the records on the database pool, one batch at a time
+        _flushing = true;
+        std::vector<JournalRecord> records(_journal.record(_applied + 1), _journal.record(last) + 1);
+        const uint64_t forget_before = Tools::Tools::system_time() - _idempotency.window();
+        bool written = false;
+        co_await _query([&](sqlite3 *db) { written = _write_journal(db, records, forget_before); });
+        if (written) {
+            _applied = last;
+        }
+        _flushing = false;
+    }
 
-            // get the fee from the database
-            sql = "SELECT fee FROM banks WHERE id = ?";
-            if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-                transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-                std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-                return;
+    bool Server::_write_journal(sqlite3 *db, const std::vector<JournalRecord> &records, uint64_t forget_before) {
+
+        // prepare the statements once for the whole batch
+        const char *sqls[] = {
+                "UPDATE accounts SET balance = balance - ? WHERE iban = ? AND user = ? AND bank = ?",
+                "UPDATE accounts SET balance = balance + ? WHERE iban = ?",
+                "INSERT INTO transactions (token, source, destination, amount, fee) VALUES (?, ?, ?, ?, ?)",
+                "UPDATE accounts SET balance = balance + ? WHERE iban = ? AND user = ? AND bank = ?",
+                "UPDATE journal SET sequence = ?",
+                "INSERT OR REPLACE INTO idempotency (user, type, key, token, fee, balance, time) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?)",
+                "DELETE FROM idempotency WHERE time < ?",
+                "INSERT OR REPLACE INTO outbox (token, user, bank, source, destination, amount) "
+                "VALUES (?, ?, ?, ?, ?, ?)",
+                "DELETE FROM outbox WHERE token = ?",
+                "INSERT OR REPLACE INTO batch (id, day, days, position) VALUES (0, ?, ?, ?)",
+                "INSERT OR REPLACE INTO standing_orders (token, user, bank, source, destination, amount, due, period, "
+                "day) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                "DELETE FROM standing_orders WHERE token = ?",
+        };
+        sqlite3_stmt *stmts[std::size(sqls)] = {};
+        bool error = sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK;
+        for (std::size_t i = 0; i < std::size(sqls) && !error; i++) {
+            error = sqlite3_prepare_v2(db, sqls[i], -1, &stmts[i], nullptr) != SQLITE_OK;
+        }
+        auto [debit, credit, insert, deposit, watermark, remember, forget, enqueue, dequeue, progress, order,
+              unorder] = stmts;
+
+        // apply the records in order
+        for (std::size_t i = 0; i < records.size() && !error; i++) {
+            const JournalRecord &record = records[i];
+            if (record.type == JOURNAL_RECORD_TYPE::TRANSACTION || record.type == JOURNAL_RECORD_TYPE::TRANSFER_OUT) {
+                sqlite3_bind_double(debit, 1, record.amount + record.fee);
+                sqlite3_bind_text(debit, 2, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_int(debit, 3, (int) record.user);
+                sqlite3_bind_int(debit, 4, record.bank);
+                sqlite3_bind_double(credit, 1, record.amount);
+                sqlite3_bind_text(credit, 2, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 2, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 3, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_double(insert, 4, record.amount);
+                sqlite3_bind_double(insert, 5, record.fee);
+                sqlite3_bind_text(enqueue, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_int(enqueue, 2, (int) record.user);
+                sqlite3_bind_int(enqueue, 3, record.bank);
+                sqlite3_bind_text(enqueue, 4, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_text(enqueue, 5, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_double(enqueue, 6, record.amount);
+
+                // the to account of a transfer is on another shard, which is told from the outbox
+                sqlite3_stmt *receive = record.type == JOURNAL_RECORD_TYPE::TRANSACTION ? credit : enqueue;
+                for (sqlite3_stmt *stmt: {debit, receive, insert}) {
+                    error = error || sqlite3_step(stmt) != SQLITE_DONE;
+                    sqlite3_reset(stmt);
+                }
+            } else if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_IN) {
+                sqlite3_bind_double(credit, 1, record.amount);
+                sqlite3_bind_text(credit, 2, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 2, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 3, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_double(insert, 4, record.amount);
+                sqlite3_bind_double(insert, 5, 0);
+
+                // the transaction is kept on the shard of either account, so that each can be audited on its own
+                for (sqlite3_stmt *stmt: {credit, insert}) {
+                    error = error || sqlite3_step(stmt) != SQLITE_DONE;
+                    sqlite3_reset(stmt);
+                }
+            } else if (record.type == JOURNAL_RECORD_TYPE::TRANSFER_DONE) {
+                sqlite3_bind_text(dequeue, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                error = sqlite3_step(dequeue) != SQLITE_DONE;
+                sqlite3_reset(dequeue);
+            } else if (record.type == JOURNAL_RECORD_TYPE::ADD_BALANCE) {
+                sqlite3_bind_double(deposit, 1, record.amount);
+                sqlite3_bind_text(deposit, 2, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_int(deposit, 3, (int) record.user);
+                sqlite3_bind_int(deposit, 4, record.bank);
+                sqlite3_bind_text(insert, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 2, "", 0, SQLITE_STATIC);
+                sqlite3_bind_text(insert, 3, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_double(insert, 4, record.amount);
+                sqlite3_bind_double(insert, 5, 0);
+
+                // deposits are kept with the transactions too, so that every balance can be audited
+                for (sqlite3_stmt *stmt: {deposit, insert}) {
+                    error = error || sqlite3_step(stmt) != SQLITE_DONE;
+                    sqlite3_reset(stmt);
+                }
+            } else if (record.type == JOURNAL_RECORD_TYPE::INTEREST || record.type == JOURNAL_RECORD_TYPE::FEE) {
+                sqlite3_bind_double(debit, 1, record.fee);
+                sqlite3_bind_text(debit, 2, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_int(debit, 3, (int) record.user);
+                sqlite3_bind_int(debit, 4, record.bank);
+                sqlite3_bind_double(credit, 1, record.amount);
+                sqlite3_bind_text(credit, 2, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 2, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_text(insert, 3, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_double(insert, 4, record.amount);
+                sqlite3_bind_double(insert, 5, record.fee);
+
+                // the postings of the end-of-day batch are kept with the transactions
+                sqlite3_stmt *post = record.type == JOURNAL_RECORD_TYPE::INTEREST ? credit : debit;
+                for (sqlite3_stmt *stmt: {post, insert}) {
+                    error = error || sqlite3_step(stmt) != SQLITE_DONE;
+                    sqlite3_reset(stmt);
+                }
+            } else if (record.type == JOURNAL_RECORD_TYPE::BATCH) {
+                sqlite3_bind_int64(progress, 1, record.day);
+                sqlite3_bind_int64(progress, 2, record.days);
+                sqlite3_bind_int64(progress, 3, record.position);
+                error = sqlite3_step(progress) != SQLITE_DONE;
+                sqlite3_reset(progress);
+            } else if (record.type == JOURNAL_RECORD_TYPE::ORDER_DELETE) {
+                sqlite3_bind_text(unorder, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                error = sqlite3_step(unorder) != SQLITE_DONE;
+                sqlite3_reset(unorder);
+            } else if (record.type == JOURNAL_RECORD_TYPE::ORDER) {
+                sqlite3_bind_text(order, 1, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_int(order, 2, (int) record.user);
+                sqlite3_bind_int(order, 3, record.bank);
+                sqlite3_bind_text(order, 4, record.from.data(), (int) record.from.size(), SQLITE_STATIC);
+                sqlite3_bind_text(order, 5, record.to.data(), (int) record.to.size(), SQLITE_STATIC);
+                sqlite3_bind_double(order, 6, record.amount);
+                sqlite3_bind_int64(order, 7, (sqlite3_int64) record.due);
+                sqlite3_bind_double(order, 8, record.period);
+                sqlite3_bind_int64(order, 9, record.day);
+                error = sqlite3_step(order) != SQLITE_DONE;
+                sqlite3_reset(order);
             }
-            sqlite3_bind_int(stmt, 1, bank_from);
-            if (sqlite3_step(stmt) != SQLITE_ROW) {
-                transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-                std::cout << "[server] can not get fee: " << sqlite3_errmsg(_db) << std::endl;
-                return;
+
+            // keep the response for retries of the request
+            if (!record.key.empty() && !error) {
+                sqlite3_bind_int(remember, 1, (int) record.user);
+                const JOURNAL_RECORD_TYPE type = idempotency_type(record.type);
+                sqlite3_bind_int(remember, 2, (int) type);
+                sqlite3_bind_text(remember, 3, record.key.data(), (int) record.key.size(), SQLITE_STATIC);
+                sqlite3_bind_text(remember, 4, record.token.data(), (int) record.token.size(), SQLITE_STATIC);
+                sqlite3_bind_double(remember, 5, record.fee);
+                sqlite3_bind_double(remember, 6, record.balance);
+                sqlite3_bind_int64(remember, 7, (sqlite3_int64) record.time);
+                error = sqlite3_step(remember) != SQLITE_DONE;
+                sqlite3_reset(remember);
             }
-            fee = (float_t) sqlite3_column_double(stmt, 0);
-            sqlite3_finalize(stmt);
         }
 
-        // fill the TRANSACTION_RESPONSE
-        transaction_response.fee = fee;
+        // drop the responses that are too old to be retried
+        if (!error) {
+            sqlite3_bind_int64(forget, 1, (sqlite3_int64) forget_before);
+            error = sqlite3_step(forget) != SQLITE_DONE;
+        }
 
-        // check if from account has enough balance
-        sql = "SELECT balance FROM accounts WHERE iban = ? AND user = ? AND bank = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        // remember how far the database got, in the same transaction
+        if (!error) {
+            sqlite3_bind_int64(watermark, 1, (sqlite3_int64) records.back().sequence);
+            error = sqlite3_step(watermark) != SQLITE_DONE;
         }
-        sqlite3_bind_text(stmt, 1, transaction_request.from.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 2, (int) transaction_request.user);
-        sqlite3_bind_int(stmt, 3, transaction_request.bank);
-        if (sqlite3_step(stmt) != SQLITE_ROW) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INVALID_FROM_IBAN;
-            std::cout << "[server] from account not found: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        for (sqlite3_stmt *stmt: stmts) {
+            sqlite3_finalize(stmt);
         }
-        if (sqlite3_column_double(stmt, 0) < transaction_request.amount + fee) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::INSUFFICIENT_FUNDS;
-            std::cout << "[server] insufficient funds" << std::endl;
-            return;
+        if (error || sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not apply journal: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+            return false;
         }
-        sqlite3_finalize(stmt);
+        return true;
+    }
 
-        // update the balance of from account
-        sql = "UPDATE accounts SET balance = balance - ? WHERE iban = ? AND user = ? AND bank = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+    bool Server::handle_request() {
+
+        // wait for a request, or for the database pool to finish a query
+        // with a pipeline the requests are decoded already, and its eventfd tells when there are new ones
+        const bool pipelined = _pipeline.running();
+        const bool waiting = pipelined && _pipeline.waiting();
+        std::vector<zmq::pollitem_t> &items = _items;
+        items.assign(1, {_sock.handle(), 0, ZMQ_POLLIN, 0});
+        if (pipelined) {
+            items[0] = {nullptr, _pipeline.fd(), ZMQ_POLLIN, 0};
         }
-        sqlite3_bind_double(stmt, 1, transaction_request.amount + fee);
-        sqlite3_bind_text(stmt, 2, transaction_request.from.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, (int) transaction_request.user);
-        sqlite3_bind_int(stmt, 4, transaction_request.bank);
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not update balance: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        if (_database.running()) {
+            items.push_back({nullptr, _database.fd(), ZMQ_POLLIN, 0});
         }
-        sqlite3_finalize(stmt);
-
-        // update the balance of the to account
-        sql = "UPDATE accounts SET balance = balance + ? WHERE iban = ?";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        if (_wake >= 0) {
+            items.push_back({nullptr, _wake, ZMQ_POLLIN, 0});
+        }
+        const std::size_t handoff = items.size();
+        if (_handoff && !_handed_off) {
+            items.push_back({_handoff.handle(), 0, ZMQ_POLLIN, 0});
+        }
+        const std::size_t peers = items.size();
+        if (_peers) {
+            items.push_back({_peers.handle(), 0, ZMQ_POLLIN, 0});
+        }
+        const std::size_t replicas = items.size();
+        if (_replicas) {
+            items.push_back({_replicas.handle(), 0, ZMQ_POLLIN, 0});
+        }
+        const std::size_t primary = items.size();
+        if (_primary) {
+            items.push_back({_primary.handle(), 0, ZMQ_POLLIN, 0});
+        }
+        const std::size_t shards = items.size();
+        for (zmq::socket_t &socket: _shard_sockets) {
+            if (socket) {
+                items.push_back({socket.handle(), 0, ZMQ_POLLIN, 0});
+            }
+        }
+        const std::size_t count = items.size();
         {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+            Tools::Span span("server", "poll");
+            zmq::poll(items.data(), count, std::chrono::milliseconds(waiting ? 0 : 1000));
         }
-        sqlite3_bind_double(stmt, 1, transaction_request.amount);
-        sqlite3_bind_text(stmt, 2, transaction_request.to.c_str(), -1, SQLITE_STATIC);
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not update balance: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+
+        // resume the handlers whose queries finished
+        {
+            Tools::Span span("server", "resume");
+            _database.resume();
         }
-        sqlite3_finalize(stmt);
 
-        // fill the TRANSACTION_RESPONSE
-        transaction_response.token = Tools::Tools::random_string(32);
+        // hand the server over to a new process asking for it
+        if (handoff < count && (items[handoff].revents & ZMQ_POLLIN)) {
+            _hand_off();
+            return false;
+        }
 
-        // add the transaction to the database
-        sql = "INSERT INTO transactions (token, source, destination, amount, fee) VALUES (?, ?, ?, ?, ?)";
-        if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
-        {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+        // take part in the transactions of the other shards
+        if (peers < count && (items[peers].revents & ZMQ_POLLIN)) {
+            _receive_peer_request();
         }
-        sqlite3_bind_text(stmt, 1, transaction_response.token.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, transaction_request.from.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 3, transaction_request.to.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_double(stmt, 4, transaction_request.amount);
-        sqlite3_bind_double(stmt, 5, fee);
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            transaction_response.type = TRANSACTION_RESPONSE_TYPE::SERVER_ERROR;
-            std::cout << "[server] can not insert transaction: " << sqlite3_errmsg(_db) << std::endl;
-            return;
+
+        // resume the handlers whose calls to other shards were answered
+        std::size_t item = shards;
+        for (zmq::socket_t &socket: _shard_sockets) {
+            if (socket && (items[item++].revents & ZMQ_POLLIN)) {
+                _receive_shard_response(socket);
+            }
         }
-        sqlite3_finalize(stmt);
 
-        // fill the TRANSACTION_RESPONSE
-        transaction_response.type = TRANSACTION_RESPONSE_TYPE::TRANSACTION_SUCCESS;
-    }
+        // catch up with the primary once it answers
+        if (primary < count && (items[primary].revents & ZMQ_POLLIN)) {
+            _receive_replication();
+        }
 
-    bool Server::handle_request() {
+        // bring the backups up to date
+        if (replicas < count && (items[replicas].revents & ZMQ_POLLIN)) {
+            _receive_replication_request();
+        }
 
         // receive a message
-        if (!_receive_message()) {
+        if (pipelined && (items[0].revents & ZMQ_POLLIN)) {
+            _pipeline.reset();
+        }
+        if (!(waiting || (items[0].revents & ZMQ_POLLIN)) || !_receive_message()) {
             return false;
         }
 
-        // handle the message
+        // drop the request if the client has stopped waiting for it
+        if (_msg.deadline != 0 && Tools::Tools::system_time() > _msg.deadline) {
+            SERVER_BUSY server_busy;
+            server_busy.type = SERVER_BUSY_TYPE::DEADLINE_EXCEEDED;
+            _send_server_busy(server_busy);
+            std::cout << "[server] dropped request past its deadline" << std::endl;
+            return true;
+        }
+
+        // a backup only answers reads, changes go to the primary
+        if (_backup && (_msg.id == MSG_ID::LOGIN_REQUEST || _msg.id == MSG_ID::LOGOUT_REQUEST ||
+                        _msg.id == MSG_ID::ADD_BALANCE_REQUEST || _msg.id == MSG_ID::TRANSACTION_REQUEST ||
+                        _msg.id == MSG_ID::STANDING_ORDER_REQUEST)) {
+            SERVER_BUSY server_busy;
+            server_busy.type = SERVER_BUSY_TYPE::READ_ONLY;
+            _send_server_busy(server_busy);
+            std::cout << "[server] turned away a change, this is a backup" << std::endl;
+            return true;
+        }
+
+        // handle the message, the span shows the id of the message
+        Tools::Span span("server", "handle", (int64_t) _msg.id);
         switch (_msg.id) {
 
             case MSG_ID::NONE: {
@@ -648,7 +2801,9 @@ namespace Server {
 
                 // parse the PING message
                 PING ping;
-                _msg.msg.convert(ping);
+                if (!_parse(ping)) {
+                    break;
+                }
 
                 // handle the PING message
                 _handle_ping(ping);
@@ -661,7 +2816,9 @@ namespace Server {
 
                 // parse the LOGIN_REQUEST message
                 LOGIN_REQUEST login_request;
-                _msg.msg.convert(login_request);
+                if (!_parse(login_request) || !_admit({})) {
+                    break;
+                }
 
                 // handle the LOGIN_REQUEST message
                 LOGIN_RESPONSE login_response;
@@ -679,7 +2836,9 @@ namespace Server {
 
                 // parse the LOGOUT_REQUEST message
                 LOGOUT_REQUEST logout_request;
-                _msg.msg.convert(logout_request);
+                if (!_parse(logout_request) || !_admit(logout_request.token)) {
+                    break;
+                }
 
                 // handle the LOGOUT_REQUEST message
                 _handle_logout_request(logout_request);
@@ -692,10 +2851,12 @@ namespace Server {
 
                 // parse the BANK_LIST_REQUEST message
                 BANK_LIST_REQUEST bank_list_request;
-                _msg.msg.convert(bank_list_request);
+                if (!_parse(bank_list_request) || !_admit({})) {
+                    break;
+                }
 
                 // handle the BANK_LIST_REQUEST message
-                _handle_bank_list_request(bank_list_request);
+                _handle_bank_list_request(bank_list_request).detach();
 
                 break;
             }
@@ -705,10 +2866,27 @@ namespace Server {
 
                 // parse the ACCOUNT_LIST_REQUEST message
                 ACCOUNT_LIST_REQUEST account_list_request;
-                _msg.msg.convert(account_list_request);
+                if (!_parse(account_list_request) || !_admit(account_list_request.token)) {
+                    break;
+                }
 
                 // handle the ACCOUNT_LIST_REQUEST message
-                _handle_account_list_request(account_list_request);
+                _handle_account_list_request(account_list_request).detach();
+
+                break;
+            }
+
+            case MSG_ID::BANK_SUMMARY_REQUEST: {
+                std::cout << "[server] got BANK_SUMMARY_REQUEST" << std::endl;
+
+                // parse the BANK_SUMMARY_REQUEST message
+                BANK_SUMMARY_REQUEST bank_summary_request;
+                if (!_parse(bank_summary_request) || !_admit(bank_summary_request.token)) {
+                    break;
+                }
+
+                // handle the BANK_SUMMARY_REQUEST message
+                _handle_bank_summary_request(bank_summary_request);
 
                 break;
             }
@@ -718,13 +2896,12 @@ namespace Server {
 
                 // parse the ADD_BALANCE_REQUEST message
                 ADD_BALANCE_REQUEST add_balance_request;
-                _msg.msg.convert(add_balance_request);
+                if (!_parse(add_balance_request) || !_admit(add_balance_request.token)) {
+                    break;
+                }
 
-                // handle the ADD_BALANCE_REQUEST message
-                ADD_BALANCE_RESPONSE add_balance_response;
-                _handle_add_balance_request(add_balance_request, add_balance_response);
-                _send_add_balance_response(add_balance_response);
-                std::cout << "[server] sent ADD_BALANCE_RESPONSE" << std::endl;
+                // handle the ADD_BALANCE_REQUEST message, answered once it is done
+                _serve_add_balance_request(add_balance_request).detach();
 
                 break;
             }
@@ -734,13 +2911,27 @@ namespace Server {
 
                 // parse the TRANSACTION_REQUEST message
                 TRANSACTION_REQUEST transaction_request;
-                _msg.msg.convert(transaction_request);
+                if (!_parse(transaction_request) || !_admit(transaction_request.token)) {
+                    break;
+                }
+
+                // handle the TRANSACTION_REQUEST message, answered once it is done
+                _serve_transaction_request(transaction_request).detach();
+
+                break;
+            }
+
+            case MSG_ID::STANDING_ORDER_REQUEST: {
+                std::cout << "[server] got STANDING_ORDER_REQUEST" << std::endl;
+
+                // parse the STANDING_ORDER_REQUEST message
+                STANDING_ORDER_REQUEST standing_order_request;
+                if (!_parse(standing_order_request) || !_admit(standing_order_request.token)) {
+                    break;
+                }
 
-                // handle the TRANSACTION_REQUEST message
-                TRANSACTION_RESPONSE transaction_response;
-                _handle_transaction_request(transaction_request, transaction_response);
-                _send_transaction_response(transaction_response);
-                std::cout << "[server] sent TRANSACTION_RESPONSE" << std::endl;
+                // handle the STANDING_ORDER_REQUEST message, answered once it is done
+                _serve_standing_order_request(standing_order_request).detach();
 
                 break;
             }
@@ -2,9 +2,31 @@
 #define BANKING_SERVER_H
 
 #include <string>
+#include <vector>
+#include <memory_resource>
+#include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <coroutine>
 #include <zmq.hpp>
 #include <sqlite3.h>
 #include "Messages.h"
+#include "DatabasePool.h"
+#include "EndOfDay.h"
+#include "FeeSchedule.h"
+#include "Journal.h"
+#include "Ledger.h"
+#include "Pipeline.h"
+#include "IdempotencyCache.h"
+#include "SessionTable.h"
+#include "SpendingLimits.h"
+#include "StandingOrders.h"
+#include "ShardMap.h"
+#include "Task.h"
+#include "UserIndex.h"
 
 namespace Server {
 
@@ -21,6 +43,41 @@ namespace Server {
         */
         bool initialize(const std::string &address);
 
+        /*
+         * Initializes the server like initialize(address), with its sockets in the zmq context of the host process.
+         * Clients in the same process reach an inproc:// address only through the same context.
+         */
+        bool initialize(const std::string &address, zmq::context_t &context);
+
+        /*
+         * Publishes every change of the state of the server to its backups on address,
+         * and answers the backups asking for the changes they missed on sync.
+         * Both carry the tokens of the sessions, so only the backups may reach them, never the clients.
+         */
+        bool publish(const std::string &address, const std::string &sync);
+
+        /*
+         * Makes the server a read-only backup of the primary server answering on sync, which publishes its changes on
+         * replication.
+         * The backup must start from the same database as the primary did.
+         */
+        bool follow(const std::string &sync, const std::string &replication);
+
+        /*
+         * Makes the server own only the banks of the shard in the shard map.
+         * Transactions to the other shards are made with them in two phases, the other shards must be running.
+         * They are taken only on the peer address of the shard, and only if signed with the secret the shards share.
+         */
+        bool shard(std::size_t shard, const Tools::ShardMap &shard_map, const std::string &secret);
+
+        /*
+         * Moves receiving, unpacking, packing and sending the messages of the clients to a pipeline of threads,
+         * leaving the thread calling handle_request to handle the requests and write the ledger.
+         * The cores are those of the I/O, decode, server and encode stages in order, a negative core is not pinned.
+         * The server thread is pinned right away, or once it starts if the server runs on a thread of its own.
+         */
+        bool pipeline(const std::vector<int> &cores);
+
         /*
         * Terminates the server.
         */
@@ -37,29 +94,471 @@ namespace Server {
         ~Server();
 
         /*
-         * Handles a request from the client.
+         * Waits up to a second for a request from a client, or for the database to finish a query of a suspended
+         * handler.
+         * Handles the request, or resumes the handlers whose queries finished.
+         * Returns false if no request arrived.
          */
         bool handle_request();
 
+        /*
+         * Does housekeeping between requests, like evicting timed out sessions in small batches.
+         */
+        void maintain();
+
+        /*
+         * Runs the server on a thread of its own until stop is called, for a host process embedding it.
+         * The host must not call the other methods of the server while it runs.
+         */
+        bool start();
+
+        /*
+         * Stops the thread started by start, after the request it is handling.
+         */
+        void stop();
+
+        /*
+         * Compiles the fee rules again and uses them for the following transactions, without stopping the server.
+         * Safe to call from any thread, the rules are loaded at the next housekeeping.
+         */
+        void reload();
+
+        /*
+         * Lets a new server process take over from this one by asking on address, an ipc:// address next to the
+         * database.
+         * Only the user of the server can reach the address, and only a request signed with the secret is answered.
+         * The server then answers the requests it has, closes the database and hands its sessions over,
+         * after which handed_off returns true and the process can exit.
+         * Returns false if there is no secret.
+         */
+        bool hand_off(const std::string &address, const std::string &secret);
+
+        /*
+         * Takes over from the server handing off on address before initializing, so that its clients stay logged in.
+         * The request is signed with the secret the server handing off has.
+         * Waits for it to finish its requests and close the database, and keeps its sessions.
+         * Returns false if no server answered, the server then starts from the latest snapshot as usual.
+         */
+        bool take_over(const std::string &address, const std::string &secret);
+
+        /*
+         * Returns whether the server was handed over to a new process.
+         */
+        bool handed_off() const;
+
     private:
+        class ShardCall;
+
+        /*
+         * This is a backup as the primary knows it.
+         */
+        struct Backup {
+            uint64_t from{}; // first journal record the backup asked for last
+            uint64_t time{}; // monotonic time it last asked in milliseconds
+        };
+
         std::string _address{}; // The address of the server.
-        msgpack::zone _z; // this is needed for the msgpack::object constructor
+        msgpack::zone _z; // this is needed for the msgpack::object constructor, cleared once a message is packed
         MSG _msg; // this is the message that will be sent or received
-        zmq::context_t _ctx; // create a zmq context
+        zmq::context_t _own_ctx; // create a zmq context, unless the host process gives one
+        zmq::context_t *_ctx{&_own_ctx}; // zmq context of the sockets
         zmq::socket_t _sock; // create a zmq socket
+        msgpack::object_handle _handle; // unpacked payload of the request being handled
+        std::pmr::synchronized_pool_resource _arenas{std::pmr::pool_options{0, 1 << 20}}; // memory of the arenas
+        Pipeline _pipeline{4096}; // receives, unpacks, packs and sends the messages on threads of its own, if started
+        int _writer_core{-1}; // core the server thread is pinned to, negative if it is not
+        std::vector<std::string> _envelope{}; // routing frames of the request being handled
+        zmq::socket_t *_origin{}; // socket of the request being handled if it came from another server, else nullptr
+        std::vector<zmq::pollitem_t> _items{}; // sockets and descriptors the server waits on, kept between polls
+        zmq::socket_t _publisher; // publishes every change of the state to the backups
+        zmq::socket_t _subscriber; // receives the changes published by the primary, on a backup
+        zmq::socket_t _primary; // asks the primary for the changes a backup missed
+        zmq::socket_t _replicas; // answers the backups asking for the changes they missed, on the primary
+        bool _backup{}; // whether the server is a read-only backup
+        bool _synced{}; // whether the backup has the sessions of the primary
+        uint64_t _primary_sequence{}; // last journal record the primary reported
+        uint64_t _publish_time{}; // when the primary last published its sequence
+        uint64_t _sync_time{}; // when the backup last asked the primary for the changes it missed
+        uint64_t _sync_call{}; // number of the last REPLICATION_REQUEST sent to the primary
+        bool _sync_waiting{}; // whether the primary has yet to answer it
+        bool _sync_sessions{}; // whether it asked for the sessions
+        std::unordered_map<std::string, Backup> _backups; // backups heard from lately, by routing id
+        Tools::ShardMap _shard_map; // shards of a sharded deployment, empty if the server owns every bank
+        std::size_t _shard{}; // shard of the server
+        std::vector<zmq::socket_t> _shard_sockets; // asks the other shards to take part in transactions, by shard
+        std::unordered_map<uint64_t, ShardCall *> _shard_calls; // calls to other shards waiting for a response
+        uint64_t _shard_call{}; // number of the last call to another shard
+        std::unordered_set<Token> _committing; // transactions to other shards being sent, so they are sent once
+        zmq::socket_t _peers; // takes part in the transactions of the other shards, on the peer address of the shard
+        std::string _secret{}; // shared by the servers, signs the transactions between shards and the handoffs
+        std::unordered_map<Token, JournalRecord> _outbox; // transactions to other shards not confirmed yet, by token
+        uint64_t _outbox_time{}; // when the transactions in the outbox were last sent again
         sqlite3 *_db{}; // create database handler
-        std::vector<LOGIN_RESPONSE> _user_sessions; // hold login response messages for each client
+        DatabasePool _database; // runs the queries of the handlers off the server thread
+        UserIndex _users; // users and their banks for logins
+        FeeSchedule _fees; // fees of transactions between banks
+        std::atomic<bool> _reload{false}; // whether the fee rules must be compiled again
+        Journal _journal; // durable record of every balance mutation
+        uint64_t _applied{}; // sequence of the last journal record applied to the database
+        uint64_t _applied_time{}; // when the journal was last applied to the database
+        bool _flushing{}; // whether the database pool is applying journal records
+        Ledger _ledger; // balances of all accounts, up to date with the journal
+        bool _restored{}; // whether the ledger and the sessions were restored at startup
+        IdempotencyCache _idempotency{1 << 16, 24 * 60 * 60 * 1000}; // responses to recent requests with a key
+        SpendingLimits _limits{{{{60 * 1000, 20, 100000},
+                                 {60 * 60 * 1000, 200, 500000},
+                                 {24 * 60 * 60 * 1000, 1000, 2000000}}}}; // transfers of every account in a window
+        StandingOrders _orders; // standing orders of the users, by their next due time
+        uint64_t _snapshot_sequence{}; // last journal record contained in the latest snapshot
+        std::atomic<uint64_t> _snapshot_written{}; // last journal record contained in the snapshot file written last
+        uint64_t _snapshot_time{}; // when the latest snapshot was taken
+        std::thread _snapshot_thread; // writes the latest snapshot in the background
+        std::atomic<bool> _snapshot_running{false}; // whether the snapshot thread is still writing
+        SessionTable _user_sessions{15 * 60 * 1000, 12 * 60 * 60 * 1000, 20, 40}; // login responses of the clients
+        Tools::TokenBucket _anonymous{}; // rate limit of the requests made without a session
+        std::thread _thread; // runs the server for a host process embedding it
+        std::atomic<bool> _stopping{false}; // whether the thread running the server must stop
+        int _wake{-1}; // eventfd waking the thread running the server up when it must stop
+        EndOfDay _end_of_day; // accrues interest and charges fees once a day
+        uint32_t _batch_day{}; // day of the latest end-of-day batch, 0 before the first one
+        uint32_t _batch_days{}; // days the latest end-of-day batch covers
+        uint32_t _batch_position{}; // account the latest end-of-day batch continues from, batch_done once finished
+        zmq::socket_t _handoff; // answers a new server process taking over
+        bool _handed_off{}; // whether the server was handed over to a new process
+        bool _taken_over{}; // whether the server took over from a previous process
+        std::vector<SessionState> _handed_sessions{}; // sessions of the previous process, until they are restored
+
+        /*
+         * This is a stream for msgpack::packer keeping the packed bytes in a memory resource, like the arena of a
+         * request.
+         */
+        struct Packed {
+            std::pmr::vector<char> bytes; // the packed bytes
+
+            void write(const char *data, std::size_t size) { bytes.insert(bytes.end(), data, data + size); }
+        };
+
+        /*
+         * This is the awaitable of a query, suspending the handler until the database pool has run the query.
+         * The routing frames of the request of the handler are put back when it resumes, so it answers its own client.
+         * Without a running pool the query runs right away on the connection of the server.
+         */
+        class Query {
+
+        public:
+
+            Query(Server &server, std::function<void(sqlite3 *)> work);
+
+            bool await_ready();
+
+            void await_suspend(std::coroutine_handle<> handle);
+
+            void await_resume();
+
+        private:
+            Server &_server; // server running the handler
+            std::function<void(sqlite3 *)> _work; // the query, given the connection to run on
+            std::vector<std::string> _envelope{}; // routing frames of the request of the suspended handler
+            zmq::socket_t *_origin{}; // socket of the request of the suspended handler if it came from another server
+        };
+
+        /*
+         * Returns the awaitable running work on a connection of the database pool.
+         */
+        Query _query(std::function<void(sqlite3 *)> work);
 
         /*
-         * Sends a message to the client.
+         * This is the awaitable of a TRANSFER_PREPARE or TRANSFER_COMMIT to another shard, suspending the handler
+         * until the shard responds or a second has passed, so that a slow shard does not hold up the other requests.
+         * The call is numbered in the frame before the message, which the shard sends back with the response.
+         * It resumes with the TRANSFER_RESPONSE, or nothing if it could not be sent or the shard did not respond.
+         */
+        class ShardCall {
+
+        public:
+
+            ShardCall(Server &server, std::size_t shard, MSG_ID id, TRANSFER transfer);
+
+            bool await_ready();
+
+            void await_suspend(std::coroutine_handle<> handle);
+
+            std::optional<TRANSFER_RESPONSE> await_resume();
+
+            /*
+             * Resumes the handler with the response of the shard, or nothing if there was none.
+             */
+            void answer(std::optional<TRANSFER_RESPONSE> response);
+
+            /*
+             * Returns the monotonic time in milliseconds after which the call has failed.
+             */
+            uint64_t deadline() const;
+
+        private:
+            Server &_server; // server running the handler
+            std::size_t _shard; // shard asked
+            MSG_ID _id; // TRANSFER_PREPARE or TRANSFER_COMMIT
+            TRANSFER _transfer; // the transaction asked about
+            uint64_t _call{}; // number of the call
+            uint64_t _deadline{}; // monotonic time in milliseconds after which the call has failed
+            std::coroutine_handle<> _handle{}; // the suspended handler
+            std::optional<TRANSFER_RESPONSE> _response{}; // response of the shard, if there was one
+            std::vector<std::string> _envelope{}; // routing frames of the request of the suspended handler
+            zmq::socket_t *_origin{}; // socket of the request of the suspended handler if it came from another server
+        };
+
+        /*
+         * Sends a message to the client, or to the server the request being handled came from.
          */
         void _send_message();
 
+        /*
+         * Sends a message packed into the arena, straight from the response in it and without the zone of the server,
+         * to the client like _send_message.
+         */
+        template<typename T>
+        void _send_packed(MSG_ID id, const T &response, std::pmr::memory_resource *arena);
+
+        /*
+         * Sends the packed message to the client like _send_message.
+         */
+        void _send_payload(const char *data, std::size_t size);
+
         /*
          * Receives a message from the client.
          */
         bool _receive_message();
 
+        /*
+         * Answers the requests waiting and finishes the handlers waiting for the database, for up to a second.
+         */
+        void _drain();
+
+        /*
+         * Finishes the handlers, takes a final snapshot and closes the journal and the database.
+         */
+        void _close_database();
+
+        /*
+         * Closes the sockets to the clients, the backups and the other shards.
+         */
+        void _close_sockets();
+
+        /*
+         * Hands the server over to the new process asking on the handoff socket.
+         */
+        void _hand_off();
+
+        /*
+         * Opens the journal, continuing after the last record the database has.
+         */
+        bool _open_journal();
+
+        /*
+         * Restores the ledger and the sessions from the latest snapshot and the journal records after it.
+         * Without a usable snapshot the database is brought up to date with the journal and the ledger loaded from it.
+         */
+        bool _restore();
+
+        /*
+         * Takes a snapshot of the ledger and the sessions.
+         * The sessions are copied right away, the accounts are copied from the versions of the ledger and written by a
+         * background thread unless wait is set.
+         */
+        void _take_snapshot(bool wait);
+
+        /*
+         * Appends a balance mutation to the journal and applies it to the ledger.
+         * The database is updated from the journal later.
+         */
+        bool _journal_mutation(JournalRecord &record);
+
+        /*
+         * Appends balance mutations to the journal with a single flush and applies them to the ledger.
+         */
+        bool _journal_mutations(std::vector<JournalRecord> &records);
+
+        /*
+         * Returns whether the server owns the bank.
+         */
+        bool _owns(uint16_t bank) const;
+
+        /*
+         * Looks up the bank of an account the ledger does not hold, like one of another shard.
+         */
+        Tools::Task<bool> _find_bank(IBAN iban, uint16_t &bank);
+
+        /*
+         * Loads the transactions to other shards that were not confirmed yet.
+         */
+        bool _load_outbox();
+
+        /*
+         * Loads how far the end-of-day batch got.
+         */
+        bool _load_batch();
+
+        /*
+         * Runs the end-of-day batch once a day, journaling a chunk of postings whenever one is computed.
+         */
+        void _run_end_of_day();
+
+        /*
+         * Loads the standing orders.
+         */
+        bool _load_orders();
+
+        /*
+         * Runs the standing orders that are due, a batch at a time, journaling each batch with a single flush.
+         */
+        void _run_standing_orders();
+
+        /*
+         * Runs a standing order whose to account is on another shard, as a transaction to that shard.
+         */
+        Tools::Task<> _transfer_order(StandingOrders::Order order);
+
+        /*
+         * Returns the mac of a TRANSFER_PREPARE or TRANSFER_COMMIT, signed with the secret of the shards.
+         */
+        Token _sign(MSG_ID id, const TRANSFER &transfer) const;
+
+        /*
+         * Returns the mac of a HANDOFF_REQUEST, signed with the secret of the servers.
+         */
+        Token _sign(const HANDOFF_REQUEST &handoff_request) const;
+
+        /*
+         * Returns the HMAC-SHA256 of data with the secret of the servers.
+         */
+        Token _mac(const std::string &data) const;
+
+        /*
+         * Receives a message from another server on the socket, which answers it directly.
+         * Returns false if there was none, or it could not be unpacked.
+         */
+        bool _receive_from(zmq::socket_t &socket);
+
+        /*
+         * Receives a TRANSFER_PREPARE or TRANSFER_COMMIT from another shard on the peer socket and handles it.
+         * Messages that are not signed with the secret of the shards are refused.
+         */
+        void _receive_peer_request();
+
+        /*
+         * Returns the awaitable sending a TRANSFER_PREPARE or TRANSFER_COMMIT to the shard, signed with the secret.
+         */
+        ShardCall _ask_shard(std::size_t shard, MSG_ID id, TRANSFER transfer);
+
+        /*
+         * Receives the response of another shard on the socket asking it, and resumes the call waiting for it.
+         * Responses to calls that have failed already are dropped.
+         */
+        void _receive_shard_response(zmq::socket_t &socket);
+
+        /*
+         * Fails the calls to other shards whose deadline is before now, a monotonic time in milliseconds.
+         */
+        void _expire_shard_calls(uint64_t now);
+
+        /*
+         * Has the other shard credit a transaction journaled as TRANSFER_OUT, and journals that it did.
+         */
+        Tools::Task<bool> _commit_transfer(JournalRecord record);
+
+        /*
+         * Handles a TRANSFER_PREPARE message from another shard.
+         */
+        void _handle_transfer_prepare(const TRANSFER &transfer);
+
+        /*
+         * Handles a TRANSFER_COMMIT message from another shard.
+         */
+        Tools::Task<> _handle_transfer_commit(TRANSFER transfer);
+
+        /*
+         * Returns the response to an earlier request of the user with the key, or nullptr if there was none.
+         * Looks in the cache first and falls back to the responses persisted in the database.
+         */
+        Tools::Task<const IdempotentResponse *> _find_idempotent(JOURNAL_RECORD_TYPE type, uint32_t user, Token key);
+
+        /*
+         * Applies at most limit journal records to the database in one transaction.
+         * Returns how many records were applied.
+         */
+        std::size_t _apply_journal(std::size_t limit);
+
+        /*
+         * Applies at most limit journal records to the database like _apply_journal, on the database pool.
+         */
+        Tools::Task<> _flush_journal(std::size_t limit);
+
+        /*
+         * Compiles the fee rules on the database pool and swaps them in once compiled.
+         */
+        Tools::Task<> _reload_fees();
+
+        /*
+         * Writes the journal records to the database in one transaction, moving its watermark to the last one.
+         * Responses to requests older than forget_before are dropped in the same transaction.
+         */
+        static bool _write_journal(sqlite3 *db, const std::vector<JournalRecord> &records, uint64_t forget_before);
+
+        /*
+         * Checks the rate limit of the session holding the token, or the shared one for requests without a session.
+         * Answers with SERVER_BUSY and returns false if the request must be turned away.
+         */
+        bool _admit(const Token &token);
+
+        /*
+         * Sends a SERVER_BUSY message to the client.
+         */
+        void _send_server_busy(SERVER_BUSY &server_busy);
+
+        /*
+         * Answers a request that can not be unpacked, like one with a token or an IBAN too long, with SERVER_BUSY.
+         */
+        void _send_invalid_request();
+
+        /*
+         * Converts the message of the request being handled into request.
+         * Answers with SERVER_BUSY and returns false if the message does not fit it.
+         */
+        template<typename T>
+        bool _parse(T &request);
+
+        /*
+         * Publishes a change of the state to the backups.
+         */
+        void _publish(REPLICATION &replication);
+
+        /*
+         * Applies the changes published by the primary, and asks it for the ones that were missed.
+         * The request is only sent, its answer is received along with the requests of the clients.
+         */
+        void _follow_primary();
+
+        /*
+         * Applies the answer of the primary to the last REPLICATION_REQUEST of the backup.
+         */
+        void _receive_replication();
+
+        /*
+         * Applies a change of the state of the primary.
+         */
+        void _apply_replication(const REPLICATION &replication);
+
+        /*
+         * Receives a REPLICATION_REQUEST from a backup on the replicas socket and handles it.
+         */
+        void _receive_replication_request();
+
+        /*
+         * Handles a REPLICATION_REQUEST message from a backup.
+         */
+        void _handle_replication_request(const REPLICATION_REQUEST &replication_request);
+
         /*
          * Sends a PING message to the client.
          */
@@ -98,7 +597,7 @@ namespace Server {
         /*
          * Handles a BANK_LIST_REQUEST message from the client.
          */
-        void _handle_bank_list_request([[maybe_unused]]BANK_LIST_REQUEST &bank_list_request);
+        Tools::Task<> _handle_bank_list_request([[maybe_unused]]BANK_LIST_REQUEST bank_list_request);
 
         /*
          * Sends an ACCOUNT_LIST_RESPONSE message to the client.
@@ -108,7 +607,17 @@ namespace Server {
         /*
          * Handles an ACCOUNT_LIST_REQUEST message from the client.
          */
-        void _handle_account_list_request(ACCOUNT_LIST_REQUEST &account_list_request);
+        Tools::Task<> _handle_account_list_request(ACCOUNT_LIST_REQUEST account_list_request);
+
+        /*
+         * Sends a BANK_SUMMARY_RESPONSE message to the client.
+         */
+        void _send_bank_summary_response(BANK_SUMMARY_RESPONSE &bank_summary_response);
+
+        /*
+         * Handles a BANK_SUMMARY_REQUEST message from the client.
+         */
+        void _handle_bank_summary_request(const BANK_SUMMARY_REQUEST &bank_summary_request);
 
         /*
          * Sends an ADD_BALANCE_RESPONSE message to the client.
@@ -118,8 +627,13 @@ namespace Server {
         /*
          * Handles an ADD_BALANCE_REQUEST message from the client.
          */
-        void _handle_add_balance_request(ADD_BALANCE_REQUEST &add_balance_request,
-                                         ADD_BALANCE_RESPONSE &add_balance_response);
+        Tools::Task<> _handle_add_balance_request(ADD_BALANCE_REQUEST add_balance_request,
+                                                  ADD_BALANCE_RESPONSE &add_balance_response);
+
+        /*
+         * Handles an ADD_BALANCE_REQUEST message from the client and sends the ADD_BALANCE_RESPONSE.
+         */
+        Tools::Task<> _serve_add_balance_request(ADD_BALANCE_REQUEST add_balance_request);
 
         /*
          * Sends a TRANSACTION_RESPONSE message to the client.
@@ -129,8 +643,29 @@ namespace Server {
         /*
          * Handles a TRANSACTION_REQUEST message from the client.
          */
-        void _handle_transaction_request(TRANSACTION_REQUEST &transaction_request,
-                                         TRANSACTION_RESPONSE &transaction_response);
+        Tools::Task<> _handle_transaction_request(TRANSACTION_REQUEST transaction_request,
+                                                  TRANSACTION_RESPONSE &transaction_response);
+
+        /*
+         * Handles a TRANSACTION_REQUEST message from the client and sends the TRANSACTION_RESPONSE.
+         */
+        Tools::Task<> _serve_transaction_request(TRANSACTION_REQUEST transaction_request);
+
+        /*
+         * Sends a STANDING_ORDER_RESPONSE message to the client.
+         */
+        void _send_standing_order_response(STANDING_ORDER_RESPONSE &standing_order_response);
+
+        /*
+         * Handles a STANDING_ORDER_REQUEST message from the client.
+         */
+        Tools::Task<> _handle_standing_order_request(STANDING_ORDER_REQUEST standing_order_request,
+                                                     STANDING_ORDER_RESPONSE &standing_order_response);
+
+        /*
+         * Handles a STANDING_ORDER_REQUEST message from the client and sends the STANDING_ORDER_RESPONSE.
+         */
+        Tools::Task<> _serve_standing_order_request(STANDING_ORDER_REQUEST standing_order_request);
     };
 
 } // Server
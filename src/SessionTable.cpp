@@ -0,0 +1,116 @@
+#include <algorithm>
+#include "SessionTable.h"
+#include "Tools.h"
+
+namespace Server {
+
+    SessionTable::SessionTable(uint64_t idle_timeout, uint64_t absolute_timeout, double rate, double burst)
+            : _idle_timeout(idle_timeout), _absolute_timeout(absolute_timeout), _rate(rate), _burst(burst),
+              _timers(Tools::Tools::monotonic_time(), 1000) {
+    }
+
+    LOGIN_RESPONSE *SessionTable::find(uint32_t user) {
+        auto it = _sessions.find(user);
+        return it == _sessions.end() ? nullptr : &it->second.login_response;
+    }
+
+    LOGIN_RESPONSE *SessionTable::find(const Token &token) {
+        auto it = _tokens.find(token);
+        return it == _tokens.end() ? nullptr : find(it->second);
+    }
+
+    LOGIN_RESPONSE *SessionTable::find(const std::string &user) {
+        for (auto &[id, session]: _sessions) {
+            if (session.login_response.user == user) {
+                return &session.login_response;
+            }
+        }
+        return nullptr;
+    }
+
+    void SessionTable::add(const LOGIN_RESPONSE &login_response, uint64_t now) {
+        auto [it, inserted] = _sessions.try_emplace(login_response.id);
+        Session &session = it->second;
+        if (!inserted) {
+            _tokens.erase(session.login_response.token);
+        }
+        session.login_response = login_response;
+        session.login_time = now;
+        session.bucket = Tools::TokenBucket(_rate, _burst, now);
+        _tokens[login_response.token] = login_response.id;
+        _schedule(login_response.id, session, _deadline(session, now));
+    }
+
+    void SessionTable::remove(uint32_t user) {
+        auto it = _sessions.find(user);
+        if (it == _sessions.end()) {
+            return;
+        }
+        _tokens.erase(it->second.login_response.token);
+        _timers.cancel(user);
+        _sessions.erase(it);
+    }
+
+    void SessionTable::renew(uint32_t user, uint64_t now) {
+        auto it = _sessions.find(user);
+        if (it != _sessions.end()) {
+            _schedule(user, it->second, _deadline(it->second, now));
+        }
+    }
+
+    Tools::TokenBucket *SessionTable::bucket(uint32_t user) {
+        auto it = _sessions.find(user);
+        return it == _sessions.end() ? nullptr : &it->second.bucket;
+    }
+
+    std::size_t SessionTable::expire(uint64_t now, std::size_t limit) {
+        _expired.clear();
+        _timers.advance(now, _expired, limit);
+        for (const uint32_t user: _expired) {
+            auto it = _sessions.find(user);
+            _tokens.erase(it->second.login_response.token);
+            _sessions.erase(it);
+        }
+        return _expired.size();
+    }
+
+    const std::vector<uint32_t> &SessionTable::expired() const {
+        return _expired;
+    }
+
+    std::size_t SessionTable::size() const {
+        return _sessions.size();
+    }
+
+    std::vector<SessionState> SessionTable::save(uint64_t now) const {
+        std::vector<SessionState> sessions;
+        sessions.reserve(_sessions.size());
+        for (const auto &[id, session]: _sessions) {
+            SessionState state;
+            state.login_response = session.login_response;
+            state.age = now - session.login_time;
+            state.remaining = session.deadline > now ? session.deadline - now : 0;
+            sessions.push_back(std::move(state));
+        }
+        return sessions;
+    }
+
+    void SessionTable::restore(const std::vector<SessionState> &sessions, uint64_t now) {
+        for (const auto &state: sessions) {
+            add(state.login_response, now);
+            Session &session = _sessions[state.login_response.id];
+            session.login_time = now - std::min(state.age, now);
+            _schedule(state.login_response.id, session, now + state.remaining);
+        }
+    }
+
+    uint64_t SessionTable::_deadline(const Session &session, uint64_t now) const {
+        return std::min(now + _idle_timeout, session.login_time + _absolute_timeout);
+    }
+
+    void SessionTable::_schedule(uint32_t user, Session &session, uint64_t deadline) {
+        session.deadline = deadline;
+        _timers.schedule(user, deadline);
+    }
+
+} // Server
@@ -0,0 +1,131 @@
+#ifndef BANKING_SESSIONTABLE_H
+#define BANKING_SESSIONTABLE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include "Messages.h"
+#include "TimerWheel.h"
+#include "TokenBucket.h"
+
+namespace Server {
+
+    /*
+     * This is a session detached from the clock of the process, to carry it over a restart.
+     */
+    class SessionState {
+    public:
+        LOGIN_RESPONSE login_response{};
+        uint64_t age{}; // milliseconds since the login
+        uint64_t remaining{}; // milliseconds until the session expires
+        MSGPACK_DEFINE (login_response, age, remaining);
+    };
+
+    /*
+     * This is the table of logged in users, indexed by user id and by session token.
+     * A session expires when it is idle for idle_timeout or absolute_timeout after the login, whichever comes first.
+     * Every session has a token bucket limiting its requests to rate per second, with bursts of up to burst requests.
+     * All times are milliseconds of Tools::Tools::monotonic_time.
+     */
+    class SessionTable {
+
+    public:
+
+        /*
+         * Creates an empty session table.
+         */
+        SessionTable(uint64_t idle_timeout, uint64_t absolute_timeout, double rate, double burst);
+
+        /*
+         * Returns the session of the user id or nullptr if the user has not logged in.
+         */
+        LOGIN_RESPONSE *find(uint32_t user);
+
+        /*
+         * Returns the session holding the token or nullptr if there is none.
+         */
+        LOGIN_RESPONSE *find(const Token &token);
+
+        /*
+         * Returns the session of the username or nullptr if the user has not logged in.
+         * This is a linear scan, only meant for error paths.
+         */
+        LOGIN_RESPONSE *find(const std::string &user);
+
+        /*
+         * Adds the session of a user that has just logged in.
+         */
+        void add(const LOGIN_RESPONSE &login_response, uint64_t now);
+
+        /*
+         * Removes the session of the user id.
+         */
+        void remove(uint32_t user);
+
+        /*
+         * Extends the idle timeout of the session of the user id, up to its absolute timeout.
+         */
+        void renew(uint32_t user, uint64_t now);
+
+        /*
+         * Returns the rate limit of the session of the user id or nullptr if the user has not logged in.
+         */
+        Tools::TokenBucket *bucket(uint32_t user);
+
+        /*
+         * Removes at most limit sessions that have timed out and returns how many were removed.
+         */
+        std::size_t expire(uint64_t now, std::size_t limit);
+
+        /*
+         * Returns the user ids whose sessions were removed by the last call to expire.
+         */
+        const std::vector<uint32_t> &expired() const;
+
+        /*
+         * Returns the number of sessions.
+         */
+        std::size_t size() const;
+
+        /*
+         * Returns the state of all sessions at now.
+         */
+        std::vector<SessionState> save(uint64_t now) const;
+
+        /*
+         * Adds sessions from their saved state, as of now.
+         */
+        void restore(const std::vector<SessionState> &sessions, uint64_t now);
+
+    private:
+        struct Session {
+            LOGIN_RESPONSE login_response{}; // the login response sent to the user
+            uint64_t login_time{}; // when the user logged in
+            uint64_t deadline{}; // when the session expires
+            Tools::TokenBucket bucket{}; // rate limit of the requests of the session
+        };
+
+        uint64_t _idle_timeout; // milliseconds a session lives without activity
+        uint64_t _absolute_timeout; // milliseconds a session lives after the login
+        double _rate; // requests per second a session may make
+        double _burst; // requests a session may make at once
+        std::unordered_map<uint32_t, Session> _sessions{}; // sessions by user id
+        std::unordered_map<Token, uint32_t> _tokens{}; // user ids by session token
+        Tools::TimerWheel _timers; // session deadlines by user id
+        std::vector<uint32_t> _expired{}; // reused buffer of expired user ids
+
+        /*
+         * Returns the deadline of a session that was active at now.
+         */
+        uint64_t _deadline(const Session &session, uint64_t now) const;
+
+        /*
+         * Sets the deadline of the session of the user id.
+         */
+        void _schedule(uint32_t user, Session &session, uint64_t deadline);
+    };
+
+} // Server
+
+#endif //BANKING_SESSIONTABLE_H
@@ -0,0 +1,49 @@
+#include <sstream>
+#include <utility>
+#include "ShardMap.h"
+
+namespace Tools {
+
+    namespace {
+
+        // splits a comma separated list of addresses
+        std::vector<std::string> split(const std::string &addresses) {
+            std::vector<std::string> list;
+            std::stringstream stream(addresses);
+            std::string address;
+            while (std::getline(stream, address, ',')) {
+                if (!address.empty()) {
+                    list.push_back(address);
+                }
+            }
+            return list;
+        }
+
+    } // namespace
+
+    ShardMap::ShardMap(std::vector<std::string> addresses, std::vector<std::string> peers)
+            : _addresses(std::move(addresses)), _peers(std::move(peers)) {
+    }
+
+    ShardMap ShardMap::parse(const std::string &addresses, const std::string &peers) {
+        return ShardMap(split(addresses), split(peers));
+    }
+
+    std::size_t ShardMap::shard(uint16_t bank) const {
+        return _addresses.empty() ? 0 : bank % _addresses.size();
+    }
+
+    const std::string &ShardMap::address(std::size_t shard) const {
+        return _addresses.at(shard);
+    }
+
+    const std::string &ShardMap::peer(std::size_t shard) const {
+        static const std::string none;
+        return shard < _peers.size() ? _peers[shard] : none;
+    }
+
+    std::size_t ShardMap::size() const {
+        return _addresses.size();
+    }
+
+} // Tools
@@ -0,0 +1,64 @@
+#ifndef BANKING_SHARDMAP_H
+#define BANKING_SHARDMAP_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Tools {
+
+    /*
+     * This is the map of the shards of a sharded deployment, given as the addresses of their servers.
+     * The shards also have peer addresses, on which they take transactions from each other and nothing from clients.
+     * Bank id b belongs to shard b modulo the number of shards, so the proxy and every shard agree on it without
+     * talking.
+     * An empty map is an unsharded deployment, where the one server owns every bank.
+     */
+    class ShardMap {
+
+    public:
+
+        /*
+         * Creates an empty map.
+         */
+        ShardMap() = default;
+
+        /*
+         * Creates a map of the shards at the addresses, with their peer addresses if the map is for a shard.
+         */
+        explicit ShardMap(std::vector<std::string> addresses, std::vector<std::string> peers = {});
+
+        /*
+         * Creates a map of the shards from comma separated lists of addresses and peer addresses.
+         */
+        static ShardMap parse(const std::string &addresses, const std::string &peers = "");
+
+        /*
+         * Returns the shard owning the bank.
+         */
+        std::size_t shard(uint16_t bank) const;
+
+        /*
+         * Returns the address of the server of the shard.
+         */
+        const std::string &address(std::size_t shard) const;
+
+        /*
+         * Returns the peer address of the server of the shard, empty if the map has none.
+         */
+        const std::string &peer(std::size_t shard) const;
+
+        /*
+         * Returns the number of shards, 0 if the deployment is not sharded.
+         */
+        std::size_t size() const;
+
+    private:
+        std::vector<std::string> _addresses{}; // server address of every shard
+        std::vector<std::string> _peers{}; // peer address of every shard, for the transactions between them
+    };
+
+} // Tools
+
+#endif //BANKING_SHARDMAP_H
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <msgpack.hpp>
+#include "Snapshot.h"
+#include "Tools.h"
+
+namespace Server {
+
+    namespace {
+
+        // identifies snapshot files and their layout
+        constexpr uint64_t snapshot_magic = 0x544f4853504e5342; // "BSNPSHOT"
+        constexpr uint32_t snapshot_version = 1;
+
+        // writes all of size bytes to the file
+        bool write_all(int fd, const char *data, std::size_t size) {
+            while (size > 0) {
+                const ssize_t written = ::write(fd, data, size);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    return false;
+                }
+                data += written;
+                size -= written;
+            }
+            return true;
+        }
+
+    } // namespace
+
+    Snapshot::~Snapshot() {
+        _close();
+    }
+
+    bool Snapshot::write(const std::string &path, uint64_t sequence, const std::vector<LedgerAccount> &accounts,
+                         const std::vector<SessionState> &sessions) {
+
+        // pack the sessions
+        msgpack::sbuffer packed;
+        msgpack::pack(packed, sessions);
+
+        // fill the header
+        Header header{};
+        header.magic = snapshot_magic;
+        header.version = snapshot_version;
+        header.sequence = sequence;
+        header.time = Tools::Tools::system_time();
+        header.accounts = accounts.size();
+        header.sessions = packed.size();
+        header.crc = Tools::Tools::crc32c(accounts.data(), accounts.size() * sizeof(LedgerAccount));
+        header.crc = Tools::Tools::crc32c(packed.data(), packed.size(), header.crc);
+
+        // write everything to a temporary file first
+        const std::string temporary = path + ".tmp";
+        const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cout << "[server] can not create snapshot " << temporary << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        const bool written = write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header)) &&
+                             write_all(fd, reinterpret_cast<const char *>(accounts.data()),
+                                       accounts.size() * sizeof(LedgerAccount)) &&
+                             write_all(fd, packed.data(), packed.size()) &&
+                             fsync(fd) == 0;
+        ::close(fd);
+        if (!written) {
+            std::cout << "[server] can not write snapshot " << temporary << ": " << std::strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+
+        // then replace the previous snapshot in one step
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            std::cout << "[server] can not rename snapshot " << temporary << ": " << std::strerror(errno) << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool Snapshot::read(const std::string &path) {
+        _close();
+
+        // map the snapshot file
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+            std::cout << "[server] snapshot " << path << " is too short" << std::endl;
+            ::close(fd);
+            return false;
+        }
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            std::cout << "[server] can not map snapshot " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        _map = static_cast<char *>(map);
+        _size = st.st_size;
+        madvise(_map, _size, MADV_SEQUENTIAL);
+
+        // check the header against the file
+        std::memcpy(&_header, _map, sizeof(_header));
+        const std::size_t body = _size - sizeof(Header);
+        if (_header.magic != snapshot_magic || _header.version != snapshot_version ||
+            _header.accounts > body / sizeof(LedgerAccount) ||
+            _header.accounts * sizeof(LedgerAccount) + _header.sessions != body) {
+            std::cout << "[server] snapshot " << path << " has an invalid header" << std::endl;
+            _close();
+            return false;
+        }
+        if (Tools::Tools::crc32c(_map + sizeof(Header), body) != _header.crc) {
+            std::cout << "[server] snapshot " << path << " is corrupt" << std::endl;
+            _close();
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t Snapshot::sequence() const {
+        return _header.sequence;
+    }
+
+    const LedgerAccount *Snapshot::accounts() const {
+        return reinterpret_cast<const LedgerAccount *>(_map + sizeof(Header));
+    }
+
+    std::size_t Snapshot::account_count() const {
+        return _header.accounts;
+    }
+
+    std::vector<SessionState> Snapshot::sessions() const {
+        std::vector<SessionState> sessions;
+        if (_header.sessions > 0) {
+            const char *packed = _map + sizeof(Header) + _header.accounts * sizeof(LedgerAccount);
+            msgpack::object_handle result = msgpack::unpack(packed, _header.sessions);
+            result.get().convert(sessions);
+        }
+        return sessions;
+    }
+
+    void Snapshot::_close() {
+        if (_map != nullptr) {
+            munmap(_map, _size);
+            _map = nullptr;
+        }
+        _size = 0;
+        _header = Header{};
+    }
+
+} // Server
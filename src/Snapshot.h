@@ -0,0 +1,86 @@
+#ifndef BANKING_SNAPSHOT_H
+#define BANKING_SNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Ledger.h"
+#include "SessionTable.h"
+
+namespace Server {
+
+    /*
+     * This is a compact binary image of the ledger and the sessions as of one journal record.
+     * The file holds a header, the accounts exactly as they are laid out in memory and the packed sessions.
+     * Starting from a snapshot only the journal records after it have to be replayed.
+     */
+    class Snapshot {
+
+    public:
+
+        /*
+         * Unmaps the snapshot.
+         */
+        ~Snapshot();
+
+        /*
+         * Writes a snapshot to path, replacing the previous one only once the new one is safely on disk.
+         */
+        static bool write(const std::string &path, uint64_t sequence, const std::vector<LedgerAccount> &accounts,
+                          const std::vector<SessionState> &sessions);
+
+        /*
+         * Maps the snapshot at path and verifies its checksum.
+         * Returns false if there is no usable snapshot.
+         */
+        bool read(const std::string &path);
+
+        /*
+         * Returns the sequence of the last journal record contained in the snapshot.
+         */
+        uint64_t sequence() const;
+
+        /*
+         * Returns the accounts of the snapshot, valid as long as the snapshot is mapped.
+         */
+        const LedgerAccount *accounts() const;
+
+        /*
+         * Returns the number of accounts in the snapshot.
+         */
+        std::size_t account_count() const;
+
+        /*
+         * Unpacks the sessions of the snapshot.
+         */
+        std::vector<SessionState> sessions() const;
+
+    private:
+
+        /*
+         * This is the fixed header at the start of a snapshot file.
+         */
+        struct Header {
+            uint64_t magic{};
+            uint32_t version{};
+            uint32_t crc{}; // CRC32C of everything after the header
+            uint64_t sequence{}; // last journal record contained
+            uint64_t time{}; // system time the snapshot was taken at in milliseconds
+            uint64_t accounts{}; // number of accounts following the header
+            uint64_t sessions{}; // bytes of packed sessions following the accounts
+        };
+
+        char *_map{}; // mapping of the snapshot file
+        std::size_t _size{}; // size of the mapping
+        Header _header{}; // header of the mapped snapshot
+
+        /*
+         * Unmaps the snapshot.
+         */
+        void _close();
+    };
+
+} // Server
+
+#endif //BANKING_SNAPSHOT_H
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include "SpendingLimits.h"
+#include "AccountStore.h"
+
+namespace Server {
+
+    SpendingLimits::SpendingLimits(const std::array<Limit, windows> &limits) : _limits(limits) {
+        for (std::size_t i = 0; i < windows; i++) {
+            _cents[i] = AccountStore::cents(_limits[i].amount);
+            _widths[i] = std::max<uint64_t>(1, _limits[i].window / buckets);
+        }
+    }
+
+    bool SpendingLimits::admit(uint32_t account, double_t amount, uint64_t now) {
+        if (_accounts.size() <= account) {
+            _accounts.resize(account + 1);
+        }
+        if (_accounts[account] == nullptr) {
+            _accounts[account] = std::make_unique<Counters>();
+        }
+        Counters &counters = *_accounts[account];
+        const int64_t cents = AccountStore::cents(amount);
+
+        // check every window before counting in any of them
+        for (std::size_t i = 0; i < windows; i++) {
+            Window &window = counters[i];
+            _slide(window, i, now);
+            if ((_limits[i].count > 0 && window.count + 1 > _limits[i].count) ||
+                (_cents[i] > 0 && window.cents + cents > _cents[i])) {
+                return false;
+            }
+        }
+        for (std::size_t i = 0; i < windows; i++) {
+            Window &window = counters[i];
+            const std::size_t bucket = window.bucket % buckets;
+            window.counts[bucket]++;
+            window.amounts[bucket] += cents;
+            window.count++;
+            window.cents += cents;
+        }
+        return true;
+    }
+
+    void SpendingLimits::refund(uint32_t account, double_t amount, uint64_t time) {
+        if (_accounts.size() <= account || _accounts[account] == nullptr) {
+            return;
+        }
+        const int64_t cents = AccountStore::cents(amount);
+
+        // only the windows still holding the transfer
+        for (std::size_t i = 0; i < windows; i++) {
+            Window &window = (*_accounts[account])[i];
+            const uint64_t bucket = time / _widths[i];
+            if (bucket > window.bucket || window.bucket - bucket >= buckets || window.counts[bucket % buckets] == 0) {
+                continue;
+            }
+            window.counts[bucket % buckets]--;
+            window.amounts[bucket % buckets] -= cents;
+            window.count--;
+            window.cents -= cents;
+        }
+    }
+
+    void SpendingLimits::_slide(Window &window, std::size_t index, uint64_t now) const {
+        const uint64_t bucket = now / _widths[index];
+        if (bucket <= window.bucket) {
+            return;
+        }
+
+        // empty the buckets between the latest one and now, all of them once the whole window passed
+        if (bucket - window.bucket >= buckets) {
+            window = Window{};
+        } else {
+            for (uint64_t b = window.bucket + 1; b <= bucket; b++) {
+                const std::size_t slot = b % buckets;
+                window.count -= window.counts[slot];
+                window.cents -= window.amounts[slot];
+                window.counts[slot] = 0;
+                window.amounts[slot] = 0;
+            }
+        }
+        window.bucket = bucket;
+    }
+
+} // Server
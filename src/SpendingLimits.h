@@ -0,0 +1,82 @@
+#ifndef BANKING_SPENDINGLIMITS_H
+#define BANKING_SPENDINGLIMITS_H
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+
+namespace Server {
+
+    /*
+     * These are the limits on the transfers an account makes in a minute, an hour and a day.
+     * Every window is a ring of buckets, each holding the transfers of a slice of the window, with running totals,
+     * so that checking an account costs the same however many transfers it made.
+     * A window slides a bucket at a time, transfers leave it up to a bucket width late.
+     * The transfers are kept in memory only, they are not counted again after a restart.
+     */
+    class SpendingLimits {
+
+    public:
+
+        /*
+         * This is the limit of a window, a zero count or amount is no limit.
+         */
+        struct Limit {
+            uint64_t window{}; // length of the window in milliseconds
+            uint32_t count{}; // transfers allowed in the window
+            double_t amount{}; // sum of the amounts allowed in the window
+        };
+
+        static constexpr std::size_t windows = 3; // a minute, an hour and a day
+        static constexpr std::size_t buckets = 32; // buckets every window is sliced into
+
+        /*
+         * Creates the limits of every window.
+         */
+        explicit SpendingLimits(const std::array<Limit, windows> &limits);
+
+        /*
+         * Counts a transfer of amount from the account at the monotonic time now in milliseconds.
+         * Returns false, without counting it, if it would exceed a limit.
+         */
+        bool admit(uint32_t account, double_t amount, uint64_t now);
+
+        /*
+         * Takes back a transfer admitted at time that was not made after all.
+         */
+        void refund(uint32_t account, double_t amount, uint64_t time);
+
+    private:
+
+        /*
+         * This is a window of an account.
+         */
+        struct Window {
+            uint64_t bucket{}; // number of the latest bucket since the epoch
+            uint32_t count{}; // transfers in the window
+            int64_t cents{}; // sum of the amounts in the window
+            std::array<uint32_t, buckets> counts{}; // transfers by bucket
+            std::array<int64_t, buckets> amounts{}; // sum of the amounts by bucket
+        };
+
+        /*
+         * These are the windows of an account.
+         */
+        using Counters = std::array<Window, windows>;
+
+        std::array<Limit, windows> _limits; // limits of every window
+        std::array<int64_t, windows> _cents{}; // amount limits of every window in cents
+        std::array<uint64_t, windows> _widths{}; // widths of the buckets of every window in milliseconds
+        std::vector<std::unique_ptr<Counters>> _accounts{}; // windows by ledger account index, once it made a transfer
+
+        /*
+         * Slides the window forward to now, emptying the buckets that left it.
+         */
+        void _slide(Window &window, std::size_t index, uint64_t now) const;
+    };
+
+} // Server
+
+#endif //BANKING_SPENDINGLIMITS_H
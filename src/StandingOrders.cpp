@@ -0,0 +1,161 @@
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include "StandingOrders.h"
+#include "Tools.h"
+
+namespace Server {
+
+    namespace {
+
+        constexpr uint64_t day = 24 * 60 * 60 * 1000;
+
+        /*
+         * Returns the time months after time, on month_day, or on the last day of the month if it is shorter.
+         * The day is not taken from time, which may have been moved to the end of a shorter month before.
+         */
+        uint64_t add_months(uint64_t time, int32_t months, uint32_t month_day) {
+            using namespace std::chrono;
+            const sys_days days{floor<std::chrono::days>(sys_time<milliseconds>(milliseconds(time)))};
+            const uint64_t rest = time - (uint64_t) duration_cast<milliseconds>(days.time_since_epoch()).count();
+            const year_month_day from{days};
+            const year_month moved = from.year() / from.month() + std::chrono::months(months);
+            const year_month_day_last end{moved / last};
+            const year_month_day date{moved / std::chrono::day(std::min(month_day, (uint32_t) unsigned(end.day())))};
+            return (uint64_t) duration_cast<milliseconds>(sys_days{date}.time_since_epoch()).count() + rest;
+        }
+
+    } // namespace
+
+    StandingOrders::StandingOrders() : _timers(Tools::Tools::system_time(), 1000) {
+    }
+
+    bool StandingOrders::load(sqlite3 *db) {
+        _orders.clear();
+        _free.clear();
+        _slots.clear();
+        _timers = Tools::TimerWheel(Tools::Tools::system_time(), 1000);
+        sqlite3_stmt *stmt;
+        const char *sql = "SELECT token, user, bank, source, destination, amount, due, period, day "
+                          "FROM standing_orders";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        int result;
+        while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+            JournalRecord record{};
+            record.type = JOURNAL_RECORD_TYPE::ORDER;
+            record.token = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+            record.user = (uint32_t) sqlite3_column_int(stmt, 1);
+            record.bank = (uint16_t) sqlite3_column_int(stmt, 2);
+            record.from = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+            record.to = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4));
+            record.amount = sqlite3_column_double(stmt, 5);
+            record.due = (uint64_t) sqlite3_column_int64(stmt, 6);
+            record.period = (float_t) sqlite3_column_double(stmt, 7);
+            record.day = (uint32_t) sqlite3_column_int(stmt, 8);
+            apply(record);
+        }
+        sqlite3_finalize(stmt);
+        if (result != SQLITE_DONE) {
+            std::cout << "[server] can not read standing orders: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void StandingOrders::apply(const JournalRecord &record) {
+        if (record.type != JOURNAL_RECORD_TYPE::ORDER && record.type != JOURNAL_RECORD_TYPE::ORDER_DELETE) {
+            return;
+        }
+        auto it = _slots.find(record.token);
+
+        // remove the order, its slot is reused
+        if (record.type == JOURNAL_RECORD_TYPE::ORDER_DELETE) {
+            if (it != _slots.end()) {
+                _timers.cancel(it->second);
+                _free.push_back(it->second);
+                _slots.erase(it);
+            }
+            return;
+        }
+
+        // otherwise register the order, or replace it
+        uint32_t slot;
+        if (it != _slots.end()) {
+            slot = it->second;
+        } else if (!_free.empty()) {
+            slot = _free.back();
+            _free.pop_back();
+            _slots.emplace(record.token, slot);
+        } else {
+            slot = (uint32_t) _orders.size();
+            _orders.emplace_back();
+            _slots.emplace(record.token, slot);
+        }
+        Order &order = _orders[slot];
+        order.token = record.token;
+        order.user = record.user;
+        order.bank = record.bank;
+        order.from = record.from;
+        order.to = record.to;
+        order.amount = record.amount;
+        order.due = record.due;
+        order.period = record.period;
+        order.day = record.day;
+        _timers.schedule(slot, order.due);
+    }
+
+    void StandingOrders::take(uint64_t now, std::vector<Order> &orders, std::size_t limit) {
+        _expired.clear();
+        _timers.advance(now, _expired, limit);
+        for (const uint32_t slot: _expired) {
+            orders.push_back(_orders[slot]);
+        }
+    }
+
+    void StandingOrders::postpone(const Token &token, uint64_t due) {
+        auto it = _slots.find(token);
+        if (it != _slots.end()) {
+            _timers.schedule(it->second, due);
+        }
+    }
+
+    const StandingOrders::Order *StandingOrders::find(const Token &token) const {
+        auto it = _slots.find(token);
+        return it != _slots.end() ? &_orders[it->second] : nullptr;
+    }
+
+    std::size_t StandingOrders::size() const {
+        return _slots.size();
+    }
+
+    uint64_t StandingOrders::next(uint64_t due, float_t period, uint32_t month_day, uint64_t now) {
+        if (period == 0) {
+            return 0;
+        }
+
+        // a period in days skips the transfers missed while the server was down at once
+        if (period > 0) {
+            const auto step = (uint64_t) period * day;
+            return due + (now >= due ? (now - due) / step + 1 : 1) * step;
+        }
+
+        // months are of different lengths, counted one at a time
+        if (month_day == 0) {
+            month_day = day_of(due);
+        }
+        do {
+            due = add_months(due, (int32_t) -period, month_day);
+        } while (due <= now);
+        return due;
+    }
+
+    uint32_t StandingOrders::day_of(uint64_t time) {
+        using namespace std::chrono;
+        const year_month_day date{floor<std::chrono::days>(sys_time<milliseconds>(milliseconds(time)))};
+        return unsigned(date.day());
+    }
+
+} // Server
@@ -0,0 +1,101 @@
+#ifndef BANKING_STANDINGORDERS_H
+#define BANKING_STANDINGORDERS_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <sqlite3.h>
+#include "Journal.h"
+#include "TimerWheel.h"
+
+namespace Server {
+
+    /*
+     * These are the standing orders of the users, transfers repeated on a schedule until they are cancelled.
+     * Every order has a slot, and the timer wheel holds the next due time of every slot by the second,
+     * so that finding the due orders costs the same however many orders are waiting.
+     * Orders are changed only by ORDER and ORDER_DELETE journal records, the standing_orders table is their copy in the
+     * database.
+     */
+    class StandingOrders {
+
+    public:
+
+        /*
+         * This is a standing order.
+         */
+        struct Order {
+            Token token{}; // token of the order
+            uint32_t user{}; // user owning the order
+            uint16_t bank{}; // bank of the user
+            IBAN from{}; // account paying
+            IBAN to{}; // account paid
+            double_t amount{}; // amount of every transfer
+            uint64_t due{}; // system time of the next transfer in milliseconds
+            float_t period{}; // days between transfers, or months if negative, 0 for a single transfer
+            uint32_t day{}; // day of the month the transfers fall on if the period is in months
+        };
+
+        /*
+         * Creates the orders, none are due yet.
+         */
+        StandingOrders();
+
+        /*
+         * Loads the orders the database has.
+         */
+        bool load(sqlite3 *db);
+
+        /*
+         * Registers or replaces the order of an ORDER record, or removes the one of an ORDER_DELETE record,
+         * other records are ignored.
+         */
+        void apply(const JournalRecord &record);
+
+        /*
+         * Takes up to limit orders due at the system time now, in milliseconds, out of the timer wheel.
+         * They stay registered, and are put back by the ORDER record journaled once they ran, or by postpone.
+         */
+        void take(uint64_t now, std::vector<Order> &orders, std::size_t limit);
+
+        /*
+         * Puts an order taken but not run back into the timer wheel, to be taken again at due.
+         */
+        void postpone(const Token &token, uint64_t due);
+
+        /*
+         * Returns the order with the token, or nullptr if there is none.
+         */
+        const Order *find(const Token &token) const;
+
+        /*
+         * Returns the number of orders.
+         */
+        std::size_t size() const;
+
+        /*
+         * Returns the first due time of an order with the period after the one at due that is later than now,
+         * or 0 if the order transfers only once.
+         * An order in months falls on month_day, or on the last day of the months shorter than that,
+         * so that an order on the 30th is back on the 30th after February. A month_day of 0 is the day of due.
+         */
+        static uint64_t next(uint64_t due, float_t period, uint32_t month_day, uint64_t now);
+
+        /*
+         * Returns the day of the month of a system time in milliseconds.
+         */
+        static uint32_t day_of(uint64_t time);
+
+    private:
+        std::vector<Order> _orders{}; // orders by slot
+        std::vector<uint32_t> _free{}; // slots of removed orders, reused first
+        std::unordered_map<Token, uint32_t> _slots{}; // slot of every order by token
+        std::vector<uint32_t> _expired{}; // slots taken out of the timer wheel by the latest take
+        Tools::TimerWheel _timers; // next due time of every slot
+    };
+
+} // Server
+
+#endif //BANKING_STANDINGORDERS_H
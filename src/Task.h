@@ -0,0 +1,126 @@
+#ifndef BANKING_TASK_H
+#define BANKING_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace Tools {
+
+    namespace task_detail {
+
+        /*
+         * This is the part of the promise of a task that does not depend on its result.
+         */
+        struct PromiseBase {
+            std::coroutine_handle<> continuation{}; // coroutine awaiting the task, resumed when the task finishes
+            bool detached{}; // whether nothing awaits the task, so it destroys itself when it finishes
+
+            /*
+             * Resumes the awaiting coroutine when the task finishes, or destroys a detached task.
+             */
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    PromiseBase &promise = handle.promise();
+                    if (promise.detached) {
+                        handle.destroy();
+                        return std::noop_coroutine();
+                    }
+                    return promise.continuation ? promise.continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        template<typename T>
+        struct Promise : PromiseBase {
+            std::optional<T> value{}; // result of the task
+
+            void return_value(T result) { value = std::move(result); }
+
+            T result() { return std::move(*value); }
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase {
+            void return_void() {}
+
+            void result() {}
+        };
+
+    } // task_detail
+
+    /*
+     * This is a coroutine returning a T, which starts when it is awaited and then resumes the awaiting coroutine.
+     * A task nothing awaits, like a request handler, is started with detach and destroys itself when it finishes.
+     * Tasks run on the thread resuming them, the server resumes them on its own thread only.
+     */
+    template<typename T = void>
+    class [[nodiscard]] Task {
+
+    public:
+
+        struct promise_type : task_detail::Promise<T> {
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        };
+
+        Task(Task &&other) noexcept: _handle(std::exchange(other._handle, {})) {}
+
+        Task &operator=(Task &&other) noexcept {
+            if (this != &other) {
+                if (_handle) {
+                    _handle.destroy();
+                }
+                _handle = std::exchange(other._handle, {});
+            }
+            return *this;
+        }
+
+        /*
+         * Destroys the task if it was neither awaited to the end nor detached.
+         */
+        ~Task() {
+            if (_handle) {
+                _handle.destroy();
+            }
+        }
+
+        /*
+         * Starts the task and leaves it to finish on its own.
+         * A task that does not wait for anything has finished when detach returns.
+         */
+        void detach() {
+            std::coroutine_handle<promise_type> handle = std::exchange(_handle, {});
+            handle.promise().detached = true;
+            handle.resume();
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            _handle.promise().continuation = awaiting;
+            return _handle;
+        }
+
+        T await_resume() { return _handle.promise().result(); }
+
+    private:
+        std::coroutine_handle<promise_type> _handle{}; // frame of the coroutine
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+    };
+
+} // Tools
+
+#endif //BANKING_TASK_H
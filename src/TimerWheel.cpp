@@ -0,0 +1,101 @@
+#include "TimerWheel.h"
+#include <algorithm>
+
+namespace Tools {
+
+    TimerWheel::TimerWheel(uint64_t now, uint64_t tick) : _tick(tick), _current(now / tick) {
+    }
+
+    void TimerWheel::schedule(uint32_t id, uint64_t deadline) {
+        auto [it, inserted] = _entries.try_emplace(id);
+        Entry &entry = it->second;
+        if (!inserted) {
+            _wheel[entry.level][entry.slot].erase(entry.position);
+        }
+        entry.deadline = deadline;
+        _place(id, entry);
+    }
+
+    void TimerWheel::cancel(uint32_t id) {
+        auto it = _entries.find(id);
+        if (it == _entries.end()) {
+            return;
+        }
+        _wheel[it->second.level][it->second.slot].erase(it->second.position);
+        _entries.erase(it);
+    }
+
+    void TimerWheel::advance(uint64_t now, std::vector<uint32_t> &expired, std::size_t limit) {
+        const uint64_t target = now / _tick;
+        if (target < _current) {
+            return;
+        }
+        while (true) {
+
+            // drain the level 0 slot of the current tick
+            auto &slot = _wheel[0][_current & _mask];
+            while (!slot.empty()) {
+                if (expired.size() >= limit) {
+                    return;
+                }
+                const uint32_t id = slot.front();
+                slot.pop_front();
+                auto it = _entries.find(id);
+                if (it->second.deadline <= now) {
+                    expired.push_back(id);
+                    _entries.erase(it);
+                } else {
+                    _place(id, it->second);
+                }
+            }
+
+            // stay on the target tick, ids scheduled into it later are drained by the next call
+            if (_current == target) {
+                return;
+            }
+            _current++;
+            _cascade();
+        }
+    }
+
+    std::size_t TimerWheel::size() const {
+        return _entries.size();
+    }
+
+    void TimerWheel::_place(uint32_t id, Entry &entry) {
+
+        // round the deadline up to a whole tick so that ids never expire early
+        uint64_t expires = std::max((entry.deadline + _tick - 1) / _tick, _current);
+
+        // deadlines beyond the last level are parked in its furthest slot and placed again from there
+        expires = std::min(expires, _current + (uint64_t(1) << (_bits * _levels)) - 1);
+
+        // pick the finest level whose range covers the remaining ticks
+        const uint64_t delta = expires - _current;
+        entry.level = 0;
+        while (delta >> (_bits * (entry.level + 1))) {
+            entry.level++;
+        }
+        entry.slot = (expires >> (_bits * entry.level)) & _mask;
+
+        auto &slot = _wheel[entry.level][entry.slot];
+        entry.position = slot.insert(slot.end(), id);
+    }
+
+    void TimerWheel::_cascade() {
+        for (std::size_t level = 1; level < _levels; level++) {
+
+            // a level is only cascaded when all the finer levels have wrapped around
+            if (_current & ((uint64_t(1) << (_bits * level)) - 1)) {
+                break;
+            }
+
+            std::list<uint32_t> moved;
+            moved.swap(_wheel[level][(_current >> (_bits * level)) & _mask]);
+            for (const uint32_t id: moved) {
+                _place(id, _entries.at(id));
+            }
+        }
+    }
+
+} // Tools
@@ -0,0 +1,80 @@
+#ifndef BANKING_TIMERWHEEL_H
+#define BANKING_TIMERWHEEL_H
+
+#include <array>
+#include <list>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+namespace Tools {
+
+    /*
+     * This is a hierarchical timer wheel holding one deadline per id.
+     * Scheduling and cancelling are O(1), and advancing costs O(1) per elapsed tick plus the expired ids.
+     * Level 0 has one slot per tick; every further level is 64 times coarser and is cascaded down when level 0 wraps.
+     */
+    class TimerWheel {
+
+    public:
+
+        /*
+         * Creates a wheel starting at now, with a resolution of tick milliseconds.
+         */
+        TimerWheel(uint64_t now, uint64_t tick);
+
+        /*
+         * Schedules id to expire at deadline milliseconds, replacing its previous deadline if any.
+         */
+        void schedule(uint32_t id, uint64_t deadline);
+
+        /*
+         * Removes id from the wheel.
+         */
+        void cancel(uint32_t id);
+
+        /*
+         * Advances the wheel to now and appends the ids that expired to expired.
+         * Ids expire within one tick after their deadline, never before it.
+         * Stops early once expired holds limit ids, the rest are returned by the next call.
+         */
+        void advance(uint64_t now, std::vector<uint32_t> &expired, std::size_t limit);
+
+        /*
+         * Returns the number of scheduled ids.
+         */
+        std::size_t size() const;
+
+    private:
+        static constexpr std::size_t _levels = 4;
+        static constexpr std::size_t _bits = 6;
+        static constexpr std::size_t _slots = 1 << _bits;
+        static constexpr uint64_t _mask = _slots - 1;
+
+        struct Entry {
+            uint64_t deadline{}; // deadline in milliseconds
+            std::size_t level{}; // wheel level holding the entry
+            std::size_t slot{}; // slot of the level holding the entry
+            std::list<uint32_t>::iterator position{}; // position of the entry in its slot
+        };
+
+        uint64_t _tick; // milliseconds per tick
+        uint64_t _current; // tick whose level 0 slot is drained next
+        std::array<std::array<std::list<uint32_t>, _slots>, _levels> _wheel{}; // ids per level and slot
+        std::unordered_map<uint32_t, Entry> _entries{}; // where each scheduled id lives
+
+        /*
+         * Places an already registered entry into the slot matching its deadline.
+         */
+        void _place(uint32_t id, Entry &entry);
+
+        /*
+         * Moves the entries of the coarser slots that start at the current tick down the wheel.
+         */
+        void _cascade();
+    };
+
+} // Tools
+
+#endif //BANKING_TIMERWHEEL_H
@@ -0,0 +1,30 @@
+#include <algorithm>
+#include <cmath>
+#include "TokenBucket.h"
+
+namespace Tools {
+
+    TokenBucket::TokenBucket(double rate, double burst, uint64_t now)
+            : _rate(rate / 1000), _burst(burst), _tokens(burst), _last(now) {
+    }
+
+    bool TokenBucket::take(uint64_t now) {
+        _tokens = _available(now);
+        _last = std::max(_last, now);
+        if (_tokens < 1) {
+            return false;
+        }
+        _tokens -= 1;
+        return true;
+    }
+
+    uint64_t TokenBucket::wait(uint64_t now) const {
+        const double missing = 1 - _available(now);
+        return missing <= 0 || _rate <= 0 ? 0 : static_cast<uint64_t>(std::ceil(missing / _rate));
+    }
+
+    double TokenBucket::_available(uint64_t now) const {
+        return now > _last ? std::min(_burst, _tokens + (now - _last) * _rate) : _tokens;
+    }
+
+} // Tools
@@ -0,0 +1,51 @@
+#ifndef BANKING_TOKENBUCKET_H
+#define BANKING_TOKENBUCKET_H
+
+#include <cstdint>
+
+namespace Tools {
+
+    /*
+     * This is a token bucket rate limiter.
+     * It refills at rate tokens per second up to burst tokens, and every admitted request takes one token.
+     */
+    class TokenBucket {
+
+    public:
+
+        /*
+         * Creates an empty bucket that never refills.
+         */
+        TokenBucket() = default;
+
+        /*
+         * Creates a full bucket.
+         */
+        TokenBucket(double rate, double burst, uint64_t now);
+
+        /*
+         * Takes a token at the monotonic time now in milliseconds.
+         * Returns false if the bucket is empty.
+         */
+        bool take(uint64_t now);
+
+        /*
+         * Returns the milliseconds until the next token is available.
+         */
+        uint64_t wait(uint64_t now) const;
+
+    private:
+        double _rate{}; // tokens per millisecond
+        double _burst{}; // capacity of the bucket
+        double _tokens{}; // tokens left at the last refill
+        uint64_t _last{}; // time of the last refill
+
+        /*
+         * Returns the tokens in the bucket at now.
+         */
+        double _available(uint64_t now) const;
+    };
+
+} // Tools
+
+#endif //BANKING_TOKENBUCKET_H
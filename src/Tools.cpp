@@ -1,23 +1,166 @@
 #include "Tools.h"
+#include <array>
+#include <chrono>
 #include <random>
+#include <cerrno>
+#include <cstring>
+#include <sys/random.h>
+#include <pthread.h>
+#include <sched.h>
 
 namespace Tools {
 
-    std::string Tools::random_string(std::string::size_type length) {
-        static auto &chars = "0123456789"
-                             "abcdefghijklmnopqrstuvwxyz"
-                             "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    namespace {
+
+        /*
+         * Alphanumeric alphabet of the tokens, indexed by the low six bits of a random byte.
+         * Indices 62 and 63 have no character and are rejected to keep the distribution uniform.
+         */
+        constexpr char alphabet[] = "0123456789"
+                                    "abcdefghijklmnopqrstuvwxyz"
+                                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        constexpr unsigned char alphabet_size = sizeof(alphabet) - 1;
+
+        /*
+         * Per-thread pool of kernel entropy.
+         * It is refilled in one getrandom call per 4 KiB, which is enough for more than a hundred tokens.
+         */
+        class EntropyPool {
+
+        public:
+
+            /*
+             * Encodes random bytes from the pool into length alphanumeric characters.
+             */
+            void fill(char *buffer, std::size_t length) {
+                std::size_t written = 0;
+                while (written < length) {
+                    if (_position == _pool.size()) {
+                        _refill();
+                    }
 
-        thread_local static std::mt19937 rg{std::random_device{}()};
-        thread_local static std::uniform_int_distribution<std::string::size_type> pick(0, sizeof(chars) - 2);
+                    // map as many pooled bytes as possible without checking the pool boundary per byte
+                    const unsigned char *byte = _pool.data() + _position;
+                    const unsigned char *end = _pool.data() + _pool.size();
+                    while (byte != end && written < length) {
+                        const unsigned char index = *byte++ & 0x3f;
+                        buffer[written] = alphabet[index < alphabet_size ? index : 0];
+                        written += index < alphabet_size;
+                    }
+                    _position = byte - _pool.data();
+                }
+            }
 
-        std::string s;
+        private:
+            std::array<unsigned char, 4096> _pool{}; // random bytes waiting to be encoded
+            std::size_t _position{_pool.size()}; // index of the first unused byte in the pool
 
-        s.reserve(length);
+            /*
+             * Refills the whole pool from the kernel.
+             * Falls back to std::random_device if getrandom is not available.
+             */
+            void _refill() {
+                std::size_t filled = 0;
+                while (filled < _pool.size()) {
+                    const ssize_t result = getrandom(_pool.data() + filled, _pool.size() - filled, 0);
+                    if (result > 0) {
+                        filled += result;
+                    } else if (result < 0 && errno != EINTR) {
+                        break;
+                    }
+                }
+                if (filled < _pool.size()) {
+                    std::random_device device;
+                    for (; filled < _pool.size(); filled++) {
+                        _pool[filled] = static_cast<unsigned char>(device());
+                    }
+                }
+                _position = 0;
+            }
+        };
 
-        while (length--)
-            s += chars[pick(rg)];
+        thread_local EntropyPool entropy_pool;
 
+        /*
+         * Lookup table of the reflected CRC32C polynomial, one entry per byte value.
+         */
+        constexpr std::array<uint32_t, 256> crc32c_table = [] {
+            std::array<uint32_t, 256> table{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+                }
+                table[i] = crc;
+            }
+            return table;
+        }();
+
+        uint32_t crc32c_software(const unsigned char *data, std::size_t size, uint32_t crc) {
+            while (size--) {
+                crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+            }
+            return crc;
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2")))
+        uint32_t crc32c_hardware(const unsigned char *data, std::size_t size, uint32_t crc) {
+            uint64_t crc64 = crc;
+            for (; size >= 8; data += 8, size -= 8) {
+                uint64_t word;
+                std::memcpy(&word, data, sizeof(word));
+                crc64 = __builtin_ia32_crc32di(crc64, word);
+            }
+            crc = static_cast<uint32_t>(crc64);
+            while (size--) {
+                crc = __builtin_ia32_crc32qi(crc, *data++);
+            }
+            return crc;
+        }
+#endif
+
+    } // namespace
+
+    std::string Tools::random_string(std::string::size_type length) {
+        std::string s(length, '\0');
+        random_token(s.data(), length);
         return s;
     }
+
+    void Tools::random_token(char *buffer, std::size_t length) {
+        entropy_pool.fill(buffer, length);
+    }
+
+    uint64_t Tools::monotonic_time() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t Tools::system_time() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    uint32_t Tools::crc32c(const void *data, std::size_t size, uint32_t crc) {
+        const auto *bytes = static_cast<const unsigned char *>(data);
+        crc = ~crc;
+#if defined(__x86_64__)
+        static const bool hardware = __builtin_cpu_supports("sse4.2");
+        if (hardware) {
+            return ~crc32c_hardware(bytes, size, crc);
+        }
+#endif
+        return ~crc32c_software(bytes, size, crc);
+    }
+
+    bool Tools::pin(int core) {
+        if (core < 0) {
+            return true;
+        }
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET(core, &cores);
+        return pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0;
+    }
 } // Tools
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define BANKING_TOOLS_H
 
 #include <string>
+#include <cstddef>
+#include <cstdint>
 
 namespace Tools {
 
@@ -13,6 +15,33 @@ namespace Tools {
          * Generates a random string of length characters.
          */
         static std::string random_string(std::string::size_type length);
+
+        /*
+         * Fills buffer with length random alphanumeric characters.
+         * Entropy comes from the kernel in bulk and is pooled per thread, so this never allocates.
+         */
+        static void random_token(char *buffer, std::size_t length);
+
+        /*
+         * Returns the milliseconds elapsed on a monotonic clock, for timeouts and deadlines.
+         */
+        static uint64_t monotonic_time();
+
+        /*
+         * Returns the milliseconds elapsed since the epoch on the system clock, for timestamps.
+         */
+        static uint64_t system_time();
+
+        /*
+         * Computes the CRC32C (Castagnoli) checksum of size bytes of data, continuing from crc.
+         * Uses the SSE4.2 crc32 instruction when the processor has it.
+         */
+        static uint32_t crc32c(const void *data, std::size_t size, uint32_t crc = 0);
+
+        /*
+         * Pins the calling thread to the core, or leaves it to the scheduler if core is negative.
+         */
+        static bool pin(int core);
     };
 
 } // Tools
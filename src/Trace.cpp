@@ -0,0 +1,242 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include <time.h>
+#include <unistd.h>
+#include "Trace.h"
+
+namespace Tools {
+
+    namespace {
+
+        // spans kept per thread, the oldest are overwritten first
+        constexpr std::size_t ring_size = 1 << 16;
+
+        /*
+         * One recorded span. The fields are atomic so that a dump can read a ring while its thread writes to it.
+         */
+        struct Event {
+            std::atomic<const char *> category{};
+            std::atomic<const char *> name{};
+            std::atomic<uint64_t> begin{};
+            std::atomic<uint64_t> end{};
+            std::atomic<int64_t> argument{};
+        };
+
+        /*
+         * The ring buffer of one thread, written only by that thread.
+         */
+        struct Ring {
+            uint32_t thread{}; // number of the thread in the trace
+            std::atomic<const char *> name{}; // name of the thread
+            std::atomic<uint64_t> head{}; // number of spans ever recorded
+            Event events[ring_size];
+        };
+
+        std::atomic<bool> tracing{false};
+
+        // every ring ever created, rings outlive their threads so their spans can still be dumped
+        std::mutex rings_mutex;
+        std::vector<std::unique_ptr<Ring>> rings;
+
+        // SQL texts, kept for as long as the spans naming them
+        std::mutex sqls_mutex;
+        std::deque<std::string> sqls;
+
+        thread_local Ring *thread_ring = nullptr;
+
+        Ring &ring() {
+            if (thread_ring == nullptr) {
+                auto created = std::make_unique<Ring>();
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                created->thread = static_cast<uint32_t>(rings.size() + 1);
+                thread_ring = created.get();
+                rings.push_back(std::move(created));
+            }
+            return *thread_ring;
+        }
+
+        // returns a copy of the SQL that lives as long as the process, looked up without allocating once known
+        const char *intern(const char *sql) {
+            thread_local std::unordered_map<std::string_view, const char *> known;
+            auto it = known.find(sql);
+            if (it != known.end()) {
+                return it->second;
+            }
+            std::lock_guard<std::mutex> lock(sqls_mutex);
+            const std::string &copy = sqls.emplace_back(sql);
+            known.emplace(copy, copy.c_str());
+            return copy.c_str();
+        }
+
+        // the profile of a finished statement, x holds how many nanoseconds it ran
+        int profile([[maybe_unused]] unsigned type, [[maybe_unused]] void *context, void *p, void *x) {
+            if (!Trace::enabled()) {
+                return 0;
+            }
+            const uint64_t end = Trace::now();
+            const auto elapsed = static_cast<uint64_t>(*static_cast<sqlite3_int64 *>(x));
+            const char *sql = sqlite3_sql(static_cast<sqlite3_stmt *>(p));
+            Trace::record("sql", intern(sql != nullptr ? sql : "?"), end - elapsed, end, -1);
+            return 0;
+        }
+
+        // appends a string to JSON being written, quoted and escaped
+        void append_json(std::string &out, const char *value) {
+            static const char hex[] = "0123456789abcdef";
+            out += '"';
+            for (const char *c = value; *c != '\0'; c++) {
+                const auto byte = static_cast<unsigned char>(*c);
+                if (byte == '"' || byte == '\\') {
+                    out += '\\';
+                    out += *c;
+                } else if (byte < 0x20) {
+                    out += "\\u00";
+                    out += hex[byte >> 4];
+                    out += hex[byte & 0xf];
+                } else {
+                    out += *c;
+                }
+            }
+            out += '"';
+        }
+
+        // appends nanoseconds as the microseconds of the trace format
+        void append_microseconds(std::string &out, uint64_t nanoseconds) {
+            const std::string fraction = std::to_string(1000 + nanoseconds % 1000);
+            out += std::to_string(nanoseconds / 1000);
+            out += '.';
+            out.append(fraction, 1, 3);
+        }
+
+    } // namespace
+
+    void Trace::enable(bool enabled) {
+        tracing.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool Trace::enabled() {
+        return tracing.load(std::memory_order_relaxed);
+    }
+
+    void Trace::name(const char *name) {
+        if (enabled()) {
+            ring().name.store(name, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t Trace::now() {
+        timespec time{};
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<uint64_t>(time.tv_sec) * 1000000000 + static_cast<uint64_t>(time.tv_nsec);
+    }
+
+    void Trace::record(const char *category, const char *name, uint64_t begin, uint64_t end, int64_t argument) {
+        Ring &r = ring();
+
+        // fill the next slot, then publish it
+        const uint64_t head = r.head.load(std::memory_order_relaxed);
+        Event &event = r.events[head % ring_size];
+        event.category.store(category, std::memory_order_relaxed);
+        event.name.store(name, std::memory_order_relaxed);
+        event.begin.store(begin, std::memory_order_relaxed);
+        event.end.store(end, std::memory_order_relaxed);
+        event.argument.store(argument, std::memory_order_relaxed);
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    void Trace::watch(sqlite3 *db) {
+        if (enabled()) {
+            sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, profile, nullptr);
+        }
+    }
+
+    bool Trace::dump(const std::string &path) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cout << "[server] can not write trace " << path << std::endl;
+            return false;
+        }
+        const std::string pid = std::to_string(getpid());
+        std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        bool first = true;
+        std::size_t count = 0;
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (const std::unique_ptr<Ring> &r: rings) {
+            const std::string tid = std::to_string(r->thread);
+
+            // the name of the thread
+            const char *thread_name = r->name.load(std::memory_order_relaxed);
+            if (thread_name != nullptr) {
+                out += first ? "" : ",\n";
+                out += R"({"ph":"M","name":"thread_name","pid":)" + pid + ",\"tid\":" + tid + R"(,"args":{"name":)";
+                append_json(out, thread_name);
+                out += "}}";
+                first = false;
+            }
+
+            // the spans the thread did not overwrite while they were copied
+            const uint64_t head = r->head.load(std::memory_order_acquire);
+            for (uint64_t i = head > ring_size ? head - ring_size : 0; i < head; i++) {
+                const Event &event = r->events[i % ring_size];
+                const char *category = event.category.load(std::memory_order_relaxed);
+                const char *name = event.name.load(std::memory_order_relaxed);
+                const uint64_t start = event.begin.load(std::memory_order_relaxed);
+                const uint64_t end = event.end.load(std::memory_order_relaxed);
+                const int64_t argument = event.argument.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (r->head.load(std::memory_order_relaxed) >= i + ring_size) {
+                    continue;
+                }
+
+                // a complete event
+                out += first ? "" : ",\n";
+                out += R"({"ph":"X","cat":)";
+                append_json(out, category);
+                out += ",\"name\":";
+                append_json(out, name);
+                out += ",\"ts\":";
+                append_microseconds(out, start);
+                out += ",\"dur\":";
+                append_microseconds(out, end - start);
+                out += ",\"pid\":" + pid + ",\"tid\":" + tid;
+                if (argument >= 0) {
+                    out += ",\"args\":{\"value\":" + std::to_string(argument) + "}";
+                }
+                out += "}";
+                first = false;
+                count++;
+                if (out.size() >= 1 << 20) {
+                    file.write(out.data(), (std::streamsize) out.size());
+                    out.clear();
+                }
+            }
+        }
+        out += "\n]}\n";
+        file.write(out.data(), (std::streamsize) out.size());
+        file.close();
+        if (!file) {
+            std::cout << "[server] can not write trace " << path << std::endl;
+            return false;
+        }
+        std::cout << "[server] wrote " << count << " spans to " << path << std::endl;
+        return true;
+    }
+
+    Span::Span(const char *category, const char *name, int64_t argument)
+            : _category(category), _name(name), _argument(argument), _begin(Trace::enabled() ? Trace::now() : 0) {
+    }
+
+    Span::~Span() {
+        if (_begin != 0) {
+            Trace::record(_category, _name, _begin, Trace::now(), _argument);
+        }
+    }
+
+} // Tools
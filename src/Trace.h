@@ -0,0 +1,88 @@
+#ifndef BANKING_TRACE_H
+#define BANKING_TRACE_H
+
+#include <string>
+#include <cstdint>
+#include <sqlite3.h>
+
+namespace Tools {
+
+    /*
+     * This is the trace of what the threads of the process spent their time on, kept for offline analysis.
+     * Every thread records spans into a ring buffer of its own, without locks, keeping the latest ones.
+     * The trace is written as Chrome trace-event JSON, which chrome://tracing and Perfetto open.
+     * Nothing is recorded unless tracing is enabled, a span then only costs a check of a flag.
+     */
+    class Trace {
+
+    public:
+
+        /*
+         * Enables or disables recording spans.
+         */
+        static void enable(bool enabled);
+
+        /*
+         * Returns whether spans are recorded.
+         */
+        static bool enabled();
+
+        /*
+         * Names the calling thread in the trace, if tracing is enabled.
+         * The name must be a string literal, or otherwise outlive the process.
+         */
+        static void name(const char *name);
+
+        /*
+         * Returns the time spans are measured in, in nanoseconds.
+         */
+        static uint64_t now();
+
+        /*
+         * Records a span of the calling thread from begin to end, with a number shown as its argument.
+         * The category and name must be string literals, or otherwise outlive the process.
+         */
+        static void record(const char *category, const char *name, uint64_t begin, uint64_t end, int64_t argument);
+
+        /*
+         * Records a span for every SQL statement the connection runs, named by its SQL, if tracing is enabled.
+         */
+        static void watch(sqlite3 *db);
+
+        /*
+         * Writes the spans of all threads to path as Chrome trace-event JSON.
+         */
+        static bool dump(const std::string &path);
+    };
+
+    /*
+     * This is a span of the calling thread, from its construction to its destruction.
+     */
+    class Span {
+
+    public:
+
+        /*
+         * Starts the span. The category and name must be string literals, or otherwise outlive the process.
+         */
+        Span(const char *category, const char *name, int64_t argument = -1);
+
+        /*
+         * Ends the span and records it.
+         */
+        ~Span();
+
+        Span(const Span &) = delete;
+
+        Span &operator=(const Span &) = delete;
+
+    private:
+        const char *_category; // category of the span
+        const char *_name; // name of the span
+        int64_t _argument; // number shown with the span, -1 for none
+        uint64_t _begin; // when the span started, 0 if tracing is disabled
+    };
+
+} // Tools
+
+#endif //BANKING_TRACE_H
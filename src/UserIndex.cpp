@@ -0,0 +1,110 @@
+#include <iostream>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#include "UserIndex.h"
+#include "Tools.h"
+
+namespace Server {
+
+    bool UserIndex::load(sqlite3 *db) {
+        _users.clear();
+        _ids.clear();
+        _banks.clear();
+
+        // load the users
+        sqlite3_stmt *stmt;
+        std::string sql = "SELECT id, citizen, name, user, pass FROM users";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            add_user(sqlite3_column_int(stmt, 0),
+                     sqlite3_column_int(stmt, 1),
+                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)),
+                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)),
+                     reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4)));
+        }
+        sqlite3_finalize(stmt);
+
+        // load the banks each user has accounts in
+        sql = "SELECT DISTINCT user, bank FROM accounts";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cout << "[server] can not prepare statement: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            add_account(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+
+        std::cout << "[server] indexed " << _users.size() << " users" << std::endl;
+        return true;
+    }
+
+    void UserIndex::add_user(uint32_t id, uint32_t citizen, const std::string &name, const std::string &user,
+                             const std::string &pass) {
+
+        // a renamed user must not stay reachable under the old username
+        auto it = _ids.find(id);
+        if (it != _ids.end() && it->second->user != user) {
+            _users.erase(it->second->user);
+        }
+
+        User &entry = _users[user];
+        entry.id = id;
+        entry.citizen = citizen;
+        entry.name = name;
+        entry.user = user;
+        Tools::Tools::random_token(entry.salt.data(), entry.salt.size());
+        entry.verifier = _verifier(entry.salt, pass);
+        _ids[id] = &entry;
+    }
+
+    void UserIndex::add_account(uint32_t user, uint16_t bank) {
+        if (bank < 64) {
+            auto it = _ids.find(user);
+            if (it != _ids.end()) {
+                it->second->banks |= uint64_t(1) << bank;
+            }
+        } else {
+            _banks.insert(uint64_t(user) << 16 | bank);
+        }
+    }
+
+    const UserIndex::User *UserIndex::authenticate(const std::string &user, const std::string &pass) const {
+        auto it = _users.find(user);
+        if (it == _users.end()) {
+            return nullptr;
+        }
+        const auto verifier = _verifier(it->second.salt, pass);
+        if (CRYPTO_memcmp(verifier.data(), it->second.verifier.data(), verifier.size()) != 0) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    bool UserIndex::has_account(uint32_t user, uint16_t bank) const {
+        if (bank < 64) {
+            auto it = _ids.find(user);
+            return it != _ids.end() && (it->second->banks >> bank & 1);
+        }
+        return _banks.count(uint64_t(user) << 16 | bank) > 0;
+    }
+
+    std::size_t UserIndex::size() const {
+        return _users.size();
+    }
+
+    std::array<unsigned char, 32> UserIndex::_verifier(const std::array<char, 16> &salt, const std::string &pass) {
+        std::array<unsigned char, 32> verifier{};
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+        EVP_DigestUpdate(ctx, salt.data(), salt.size());
+        EVP_DigestUpdate(ctx, pass.data(), pass.size());
+        EVP_DigestFinal_ex(ctx, verifier.data(), nullptr);
+        EVP_MD_CTX_free(ctx);
+        return verifier;
+    }
+
+} // Server
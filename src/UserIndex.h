@@ -0,0 +1,79 @@
+#ifndef BANKING_USERINDEX_H
+#define BANKING_USERINDEX_H
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <sqlite3.h>
+
+namespace Server {
+
+    /*
+     * This is an in-memory index of the users table, so that logins are answered without touching the database.
+     * Passwords are not kept, only a salted SHA-256 verifier per user.
+     */
+    class UserIndex {
+
+    public:
+
+        /*
+         * This is a user as seen by the login.
+         */
+        struct User {
+            uint32_t id{};
+            uint32_t citizen{};
+            std::string name{};
+            std::string user{};
+            std::array<char, 16> salt{}; // random salt of the verifier
+            std::array<unsigned char, 32> verifier{}; // SHA-256 of the salt followed by the password
+            uint64_t banks{}; // bit b is set if the user has an account in bank b, for banks below 64
+        };
+
+        /*
+         * Loads the users and the banks they have accounts in from the database.
+         */
+        bool load(sqlite3 *db);
+
+        /*
+         * Adds or replaces a user, must be called whenever a user is written to the database.
+         */
+        void add_user(uint32_t id, uint32_t citizen, const std::string &name, const std::string &user,
+                      const std::string &pass);
+
+        /*
+         * Records that the user has an account in the bank, must be called whenever an account is written to the
+         * database.
+         */
+        void add_account(uint32_t user, uint16_t bank);
+
+        /*
+         * Returns the user if the username and password match, nullptr otherwise.
+         */
+        const User *authenticate(const std::string &user, const std::string &pass) const;
+
+        /*
+         * Checks if the user has at least one account in the bank.
+         */
+        bool has_account(uint32_t user, uint16_t bank) const;
+
+        /*
+         * Returns the number of users.
+         */
+        std::size_t size() const;
+
+    private:
+        std::unordered_map<std::string, User> _users{}; // users by username
+        std::unordered_map<uint32_t, User *> _ids{}; // users by user id
+        std::unordered_set<uint64_t> _banks{}; // user id and bank id pairs for banks that do not fit the bitmap
+
+        /*
+         * Computes the verifier of the password with the salt.
+         */
+        static std::array<unsigned char, 32> _verifier(const std::array<char, 16> &salt, const std::string &pass);
+    };
+
+} // Server
+
+#endif //BANKING_USERINDEX_H